@@ -0,0 +1,44 @@
+#ifndef __ALLOCATOR_H_
+#define __ALLOCATOR_H_
+
+/*
+ * allocator.h - the malloc packages the driver replays traces against
+ *
+ * mm malloc and libc malloc are built into the driver.  Other packages
+ * are loaded at run time (mdriver -a <file.so>) from shared objects that
+ * export an allocator_t named ALLOCATOR_SYMBOL; plugin.c makes one out
+ * of any mm.c-style package.  A package with an init function runs on
+ * the driver's heap (memlib), which it is reset with before every run
+ * and measured for utilization on.  One without, like libc malloc,
+ * manages its own memory.
+ *
+ * heapstats, if there is one, describes the free space in the heap (see
+ * mm_heapstats in mm.h), spacestats the rest of it (mm_spacestats), and
+ * layout how a request becomes a block (mm_layout).  plugin.c fills
+ * them in for the packages that define mm_heapstats, mm_spacestats and
+ * mm_layout.
+ */
+#include <stddef.h>
+
+struct mm_heapstats;
+struct mm_spacestats;
+struct mm_layout;
+
+#define ALLOCATOR_SYMBOL "mm_allocator_table"
+
+typedef struct {
+    const char *name;
+    int (*init)(void);             /* NULL if not on the driver's heap */
+    void *(*malloc)(size_t size);
+    void (*free)(void *ptr);
+    void *(*realloc)(void *ptr, size_t size);
+    void *(*calloc)(size_t nmemb, size_t size);
+    int (*checkheap)(int verbose); /* NULL if the package has none */
+    /* NULL if the package has no mm_heapstats, mm_spacestats or
+       mm_layout, respectively */
+    void (*heapstats)(struct mm_heapstats *stats);
+    void (*spacestats)(struct mm_spacestats *stats);
+    void (*layout)(size_t size, struct mm_layout *layout);
+} allocator_t;
+
+#endif /* __ALLOCATOR_H_ */
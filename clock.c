@@ -9,10 +9,15 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
 #include <sys/times.h>
 #include "clock.h"
 
+#if defined(__alpha)
+static double cpuinfo_mhz(void);
+#endif
+
 
 /******************************************************* 
  * Machine dependent functions 
@@ -24,53 +29,183 @@
 
 #if defined(__i386__) || defined(__x86_64__)
 /*******************************************************
- * Pentium versions of start_counter() and get_counter()
+ * x86 versions of start_counter() and get_counter()
+ *
+ * With an invariant TSC, one that ticks at the same rate in every
+ * P-state and C-state, the counter is the TSC.  It is read fenced,
+ * lfence before rdtsc at the start and rdtscp (or rdtsc, lfence) at
+ * the end, so that neither read moves into or out of the code being
+ * timed.  Without one, it counts nanoseconds of CLOCK_MONOTONIC_RAW.
  *******************************************************/
 
+#include <cpuid.h>
+#include <linux/perf_event.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
 
-/* $begin x86cyclecounter */
-/* Initialize the cycle counter */
-static unsigned cyc_hi = 0;
-static unsigned cyc_lo = 0;
+static unsigned long long cyc_start = 0;
+static int use_tsc = -1;    /* -1 until init_counter() */
+static int have_rdtscp = 0;
+
+/* Find out whether the TSC is invariant and rdtscp there */
+static void init_counter(void)
+{
+    unsigned a, b, c, d;
+
+    use_tsc = 0;
+    if (__get_cpuid_max(0x80000000, NULL) >= 0x80000007) {
+        __cpuid(0x80000007, a, b, c, d);
+        use_tsc = (d >> 8) & 1;
+        __cpuid(0x80000001, a, b, c, d);
+        have_rdtscp = (d >> 27) & 1;
+    }
+}
 
+static unsigned long long nsecs_now(void)
+{
+    struct timespec ts;
 
-/* Set *hi and *lo to the high and low order bits  of the cycle counter.  
-   Implementation requires assembly code to use the rdtsc instruction. */
-void access_counter(unsigned *hi, unsigned *lo)
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+/* Read the counter at the start of a measurement */
+static unsigned long long counter_start(void)
 {
-    asm("rdtsc; movl %%edx,%0; movl %%eax,%1"   /* Read cycle counter */
-        : "=r" (*hi), "=r" (*lo)                /* and move results to */
-        : /* No input */                        /* the two outputs */
-        : "%edx", "%eax");
+    unsigned hi, lo;
+
+    if (!use_tsc)
+        return nsecs_now();
+    __asm__ __volatile__("lfence; rdtsc" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
+}
+
+/* Read the counter at the end, after everything before has finished */
+static unsigned long long counter_end(void)
+{
+    unsigned hi, lo;
+
+    if (!use_tsc)
+        return nsecs_now();
+    if (have_rdtscp)
+        __asm__ __volatile__("rdtscp; lfence" : "=a" (lo), "=d" (hi)
+                             : : "ecx");
+    else
+        __asm__ __volatile__("lfence; rdtsc; lfence" : "=a" (lo), "=d" (hi));
+    return ((unsigned long long)hi << 32) | lo;
 }
 
 /* Record the current value of the cycle counter. */
 void start_counter()
 {
-    access_counter(&cyc_hi, &cyc_lo);
+    if (use_tsc < 0)
+        init_counter();
+    cyc_start = counter_start();
 }
 
 /* Return the number of cycles since the last call to start_counter. */
 double get_counter()
 {
-    unsigned ncyc_hi, ncyc_lo;
-    unsigned hi, lo, borrow;
-    double result;
+    return (double)(counter_end() - cyc_start);
+}
 
-    /* Get cycle counter */
-    access_counter(&ncyc_hi, &ncyc_lo);
+/*
+ * The nominal TSC rate, which is what it ticks at whatever the clock of
+ * the core, from the sources the kernel offers.  Each returns 0 if it
+ * has nothing to say.
+ */
 
-    /* Do double precision subtraction */
-    lo = ncyc_lo - cyc_lo;
-    borrow = lo > ncyc_lo;
-    hi = ncyc_hi - cyc_hi - borrow;
-    result = (double) hi * (1 << 30) * 4 + lo;
-    if (result < 0) {
-        fprintf(stderr, "Error: counter returns neg value: %.0f\n", result);
+/* Exported by some kernels */
+static double sysfs_tsc_mhz(void)
+{
+    FILE *fp = fopen("/sys/devices/system/cpu/cpu0/tsc_freq_khz", "r");
+    double khz = 0;
+
+    if (fp == NULL)
+        return 0;
+    if (fscanf(fp, "%lf", &khz) != 1)
+        khz = 0;
+    fclose(fp);
+    return khz / 1e3;
+}
+
+/* The kernel's own TSC to nanoseconds conversion, ns = tsc * mult >>
+   shift, which perf shares with user space when the TSC is the clock */
+static double perf_tsc_mhz(void)
+{
+    struct perf_event_attr attr;
+    struct perf_event_mmap_page *page;
+    long pagesize = sysconf(_SC_PAGESIZE);
+    double mhz = 0;
+    int fd;
+
+    memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_SOFTWARE;
+    attr.config = PERF_COUNT_SW_DUMMY;
+    attr.exclude_kernel = 1;
+    if ((fd = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0)) < 0)
+        return 0;
+    page = mmap(NULL, pagesize, PROT_READ, MAP_SHARED, fd, 0);
+    if (page != MAP_FAILED) {
+        if (page->cap_user_time && page->time_mult != 0)
+            mhz = 1e3 * (double)(1ULL << page->time_shift) / page->time_mult;
+        munmap(page, pagesize);
     }
-    return result;
+    close(fd);
+    return mhz;
+}
+
+/* CPUID leaf 0x15: the TSC to crystal clock ratio and the crystal */
+static double cpuid_tsc_mhz(void)
+{
+    unsigned a, b, c, d;
+
+    if (__get_cpuid_max(0, NULL) < 0x15)
+        return 0;
+    __cpuid_count(0x15, 0, a, b, c, d);
+    if (a == 0 || b == 0 || c == 0)
+        return 0;
+    return (double)c * b / a / 1e6;
+}
+
+/* Time the TSC against CLOCK_MONOTONIC_RAW */
+static double timed_tsc_mhz(int msecs)
+{
+    struct timespec delay = { msecs / 1000, (msecs % 1000) * 1000000L };
+    unsigned long long c0, c1, t0, t1;
+
+    t0 = nsecs_now();
+    c0 = counter_start();
+    nanosleep(&delay, NULL);
+    c1 = counter_end();
+    t1 = nsecs_now();
+    return (double)(c1 - c0) / (t1 - t0) * 1e3;
+}
+
+/* The counter's rate in MHz, and where it came from in *source */
+static double counter_mhz(int msecs, const char **source)
+{
+    double mhz;
+
+    if (use_tsc < 0)
+        init_counter();
+    if (!use_tsc) {
+        *source = "no invariant TSC, nanoseconds of CLOCK_MONOTONIC_RAW";
+        return 1e3;
+    }
+    if ((mhz = sysfs_tsc_mhz()) > 0)
+        *source = "TSC, rate from sysfs";
+    else if ((mhz = perf_tsc_mhz()) > 0)
+        *source = "TSC, rate from the kernel via perf";
+    else if ((mhz = cpuid_tsc_mhz()) > 0)
+        *source = "TSC, rate from CPUID";
+    else {
+        mhz = timed_tsc_mhz(msecs);
+        *source = "TSC, rate timed against CLOCK_MONOTONIC_RAW";
+    }
+    return mhz;
 }
-/* $end x86cyclecounter */
 
 #elif defined(__alpha)
 
@@ -109,6 +244,13 @@ static unsigned int counterRoutine[] =
 /* Cast the above instructions into a function. */
 static unsigned int (*counter)(void)= (void *)counterRoutine;
 
+static double counter_mhz(int msecs __attribute__((unused)),
+                          const char **source)
+{
+    *source = "cycle counter, clock rate from /proc/cpuinfo";
+    return cpuinfo_mhz();
+}
+
 
 void start_counter()
 {
@@ -141,23 +283,35 @@ double get_counter()
  * counter routines. Newer models of sparcs (v8plus) have cycle
  * counters that can be accessed from user programs, but since there
  * are still many sparc boxes out there that don't support this, we
- * haven't provided a Sparc version here.
+ * haven't provided a Sparc version here.  The counter counts
+ * nanoseconds of CLOCK_MONOTONIC_RAW instead.
  ***************************************************************/
 
+static unsigned long long cyc_start = 0;
+
+static unsigned long long nsecs_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 void start_counter()
 {
-    printf("ERROR: You are trying to use a start_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    cyc_start = nsecs_now();
 }
 
 double get_counter() 
 {
-    printf("ERROR: You are trying to use a get_counter routine in clock.c\n");
-    printf("that has not been implemented yet on this platform.\n");
-    printf("Please choose another timing package in config.h.\n");
-    exit(1);
+    return (double)(nsecs_now() - cyc_start);
+}
+
+static double counter_mhz(int msecs __attribute__((unused)),
+                          const char **source)
+{
+    *source = "nanoseconds of CLOCK_MONOTONIC_RAW";
+    return 1e3;
 }
 #endif
 
@@ -180,15 +334,17 @@ double ovhd()
     return result;
 }
 
-/* $begin mhz */
-/* Get the clock rate from /proc */
-double mhz_full(int verbose, int sleeptime __attribute__((unused)))
+#if defined(__alpha)
+/* Get the clock rate of the first CPU from /proc */
+static double cpuinfo_mhz(void)
 {
     static char buf[2048];
 
     FILE *fp = fopen("/proc/cpuinfo", "r");
     double mhz = 0.0;
 
+    if (fp == NULL)
+        return 0;
     while (fgets(buf, 2048, fp)) {
         if (strstr(buf, "cpu MHz")) {
             sscanf(buf, "cpu MHz\t: %lf", &mhz);
@@ -196,27 +352,28 @@ double mhz_full(int verbose, int sleeptime __attribute__((unused)))
         }
     }
     fclose(fp);
-    if (verbose) 
-        printf("Processor clock rate ~= %.1f MHz\n", mhz);
     return mhz;
+}
+#endif
 
-#if 0
-    double rate;
+/* $begin mhz */
+/* The rate the counter ticks at, in MHz; sleeptime is in msecs, for
+   when it has to be timed */
+double mhz_full(int verbose, int sleeptime)
+{
+    const char *source;
+    double mhz = counter_mhz(sleeptime, &source);
 
-    start_counter();
-    sleep(sleeptime);
-    rate = get_counter() / (1e6*sleeptime);
-    if (verbose) 
-        printf("Processor clock rate ~= %.1f MHz\n", rate);
-    return rate;
-#endif
+    if (verbose)
+        printf("Counter rate %.1f MHz (%s)\n", mhz, source);
+    return mhz;
 }
 /* $end mhz */
 
 /* Version using a default sleeptime */
 double mhz(int verbose)
 {
-    return mhz_full(verbose, 2);
+    return mhz_full(verbose, 100);
 }
 
 /** Special counters that compensate for timer interrupt overhead */
@@ -288,6 +445,8 @@ double get_comp_counter()
     times(&t);
     ticks = t.tms_utime - start_tick;
     ctime = time - ticks*cyc_per_tick;
+    if (ctime < 0)  /* overcorrected, keep the raw count */
+        ctime = time;
     /*
       printf("Measured %.0f cycles.  Ticks = %d.  Corrected %.0f cycles\n",
       time, (int) ticks, ctime);
@@ -111,10 +111,22 @@
  */
 #define MAX_HEAP (100*(1<<20))  /* 100 MB */
 
+/*
+ * Heap reservation for the LD_PRELOAD-able libmm.so; must stay below
+ * MAX_SPAN.
+ */
+#define LIB_MAX_HEAP (1UL<<31)  /* 2 GB */
+
+/*
+ * Extra heap segments must lie within this many bytes of the heap base:
+ * mm.c's free list links are 32-bit counts of 8-byte words.
+ */
+#define MAX_SPAN (1UL<<35)  /* 32 GB */
+
 /*****************************************************************************
  * Set exactly one of these USE_xxx constants to "1" to select a timing method
  *****************************************************************************/
-#define USE_FCYC   1   /* cycle counter w/K-best scheme (x86 & Alpha only) */
+#define USE_FCYC   1   /* cycle counter w/K-best scheme (TSC or Alpha, else ns) */
 #define USE_ITIMER 0   /* interval timer (any Unix box) */
 #define USE_GETTOD 0   /* gettimeofday (any Unix box) */
 
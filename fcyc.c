@@ -10,6 +10,7 @@
 #include <stdlib.h>
 #include <sys/times.h>
 #include <stdio.h>
+#include <unistd.h>
 
 #include "fcyc.h"
 #include "clock.h"
@@ -20,8 +21,10 @@
 #define EPSILON 0.01         /* K samples should be EPSILON of each other*/
 #define COMPENSATE 0         /* 1-> try to compensate for clock ticks */
 #define CLEAR_CACHE 0        /* Clear cache before running test function */
-#define CACHE_BYTES (1<<19)  /* Max cache size in bytes */
-#define CACHE_BLOCK 32       /* Cache block size in bytes */
+#define CACHE_BYTES 0        /* Max cache size in bytes, 0 -> the LLC's */
+#define CACHE_BLOCK 0        /* Cache block size in bytes, 0 -> the L1's */
+#define DEFAULT_CACHE_BYTES (1<<19) /* If the cache can't be found */
+#define DEFAULT_CACHE_BLOCK 32
 
 static int kbest = K;
 static int maxsamples = MAXSAMPLES;
@@ -97,6 +100,40 @@ static int has_converged()
 	((1 + epsilon)*values[0] >= values[kbest-1]);
 }
 
+/* 
+ * llc_bytes - Size of the last level cache, from the C library or
+ *     else the largest of the caches sysfs lists for cpu0; 0 if unknown
+ */
+static long llc_bytes()
+{
+    char path[64], unit = 0;
+    long size, largest = 0;
+    int i;
+    FILE *fp;
+
+#ifdef _SC_LEVEL3_CACHE_SIZE
+    if ((size = sysconf(_SC_LEVEL3_CACHE_SIZE)) > 0)
+	return size;
+    if ((size = sysconf(_SC_LEVEL2_CACHE_SIZE)) > 0)
+	return size;
+#endif
+    for (i = 0; i < 8; i++) {
+	sprintf(path, "/sys/devices/system/cpu/cpu0/cache/index%d/size", i);
+	if ((fp = fopen(path, "r")) == NULL)
+	    break;
+	if (fscanf(fp, "%ld%c", &size, &unit) >= 1) {
+	    if (unit == 'K')
+		size <<= 10;
+	    else if (unit == 'M')
+		size <<= 20;
+	    if (size > largest)
+		largest = size;
+	}
+	fclose(fp);
+    }
+    return largest;
+}
+
 /* 
  * clear - Code to clear cache 
  */
@@ -106,7 +143,20 @@ static void clear()
 {
     int x = sink;
     int *cptr, *cend;
-    int incr = cache_block/sizeof(int);
+    int incr;
+    if (cache_bytes <= 0) {
+	long bytes = llc_bytes();
+	cache_bytes = bytes > 0 && bytes < (1L<<30) ? (int)bytes
+	    : DEFAULT_CACHE_BYTES;
+    }
+    if (cache_block <= 0) {
+	long bytes = 0;
+#ifdef _SC_LEVEL1_DCACHE_LINESIZE
+	bytes = sysconf(_SC_LEVEL1_DCACHE_LINESIZE);
+#endif
+	cache_block = bytes > 0 ? (int)bytes : DEFAULT_CACHE_BLOCK;
+    }
+    incr = cache_block/sizeof(int);
     if (!cache_buf) {
 	cache_buf = malloc(cache_bytes);
 	if (!cache_buf) {
@@ -184,7 +234,7 @@ void set_fcyc_clear_cache(int clear)
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = 0, the size of the last level cache (512KB if unknown)
  */
 void set_fcyc_cache_size(int bytes)
 {
@@ -199,7 +249,7 @@ void set_fcyc_cache_size(int bytes)
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 0, the L1 line size (32 if unknown)
  */
 void set_fcyc_cache_block(int bytes) {
     cache_block = bytes;
@@ -26,13 +26,13 @@ void set_fcyc_clear_cache(int clear);
 
 /* 
  * set_fcyc_cache_size - Set size of cache to use when clearing cache 
- *     Default = 1<<19 (512KB)
+ *     Default = 0, the size of the last level cache (512KB if unknown)
  */
 void set_fcyc_cache_size(int bytes);
 
 /* 
  * set_fcyc_cache_block - Set size of cache block 
- *     Default = 32
+ *     Default = 0, the L1 line size (32 if unknown)
  */
 void set_fcyc_cache_block(int bytes);
 
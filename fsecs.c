@@ -26,7 +26,10 @@ void init_fsecs(void)
     /* set key parameters for the fcyc package */
     set_fcyc_maxsamples(20); 
     set_fcyc_clear_cache(1);
-    set_fcyc_compensate(1);
+    /* the compensation takes a calibrated cost off for every clock
+       tick in a run; with the fenced TSC it overshoots, down to
+       negative times */
+    set_fcyc_compensate(0);
     set_fcyc_epsilon(0.01);
     set_fcyc_k(3);
     Mhz = mhz(verbose > 0);
@@ -0,0 +1,97 @@
+/*
+ * heaptest.c - check that a file-backed heap outlives its process
+ *
+ *   heaptest [<file>]
+ *
+ * A child process sets up a heap in <file> (default /tmp/heaptest.<pid>),
+ * keeps a string in it as the root and exits.  Before it goes, it forks
+ * a child of its own that doesn't exec and is still running when the
+ * heap is reopened.  heaptest then attaches to the heap, as a restarted
+ * program would, and checks that the string is still there: the
+ * leftover child must not keep the file locked.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "mm.h"
+#include "memlib.h"
+
+static const char message[] = "still here";
+
+/* fail - Report what went wrong and give up */
+static void fail(const char *file, const char *what)
+{
+    fprintf(stderr, "heaptest: %s: %s\n", file, what);
+    unlink(file);
+    exit(1);
+}
+
+/*
+ * first_run - Set up the heap and keep message in it, leaving behind a
+ *     forked child that lives until the read end of the pipe closes
+ */
+static void first_run(const char *file, const char *backend, int fds[2])
+{
+    char *p, c;
+
+    if (mem_set_backend(backend) < 0 || mem_init() < 0 || mm_init() < 0)
+        fail(file, "can't set up the heap");
+    if ((p = mm_malloc(sizeof(message))) == NULL)
+        fail(file, "malloc failed");
+    strcpy(p, message);
+    mm_set_root(p);
+
+    if (fork() == 0) {
+        close(fds[1]);
+        while (read(fds[0], &c, 1) > 0)
+            ;
+        _exit(0);
+    }
+    mm_detach();
+    exit(0);
+}
+
+int main(int argc, char **argv)
+{
+    char file[256], backend[sizeof(file) + 8];
+    const char *root;
+    int fds[2], status;
+    pid_t pid;
+
+    if (argc > 2) {
+        fprintf(stderr, "Usage: heaptest [<file>]\n");
+        exit(1);
+    }
+    if (argc == 2)
+        snprintf(file, sizeof(file), "%s", argv[1]);
+    else
+        snprintf(file, sizeof(file), "/tmp/heaptest.%d", (int)getpid());
+    snprintf(backend, sizeof(backend), "file:%s", file);
+    unlink(file);
+
+    if (pipe(fds) < 0 || (pid = fork()) < 0)
+        fail(file, "can't start the first run");
+    if (pid == 0)
+        first_run(file, backend, fds);
+    if (waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+            WEXITSTATUS(status) != 0)
+        exit(1);
+
+    /* the first run's child still holds whatever it inherited */
+    if (mem_set_backend(backend) < 0 || mem_init() < 0)
+        fail(file, "can't reopen the heap (still locked?)");
+    if (mem_persisted_size() == 0 || mm_attach() < 0)
+        fail(file, "nothing to attach to");
+    root = mm_get_root();
+    if (root == NULL || strcmp(root, message) != 0)
+        fail(file, "the root is gone");
+    close(fds[1]);
+
+    mem_deinit();
+    unlink(file);
+    printf("heaptest: ok\n");
+    return 0;
+}
@@ -0,0 +1,70 @@
+/*
+ * hist.c - log-linear histograms of latencies
+ */
+#include <string.h>
+
+#include "hist.h"
+
+/*
+ * bucket - The bucket for value v.  For v of HIST_SUB or more, the top
+ *          bit of v picks the power of two and the HIST_SUB_BITS bits
+ *          below it the bucket within that.
+ */
+static int bucket(uint64_t v)
+{
+    int top;
+
+    if (v < HIST_SUB)
+        return v;
+    top = 63 - __builtin_clzll(v);
+    return (top - HIST_SUB_BITS + 1) * HIST_SUB +
+        (int)((v >> (top - HIST_SUB_BITS)) & (HIST_SUB - 1));
+}
+
+/* bucket_max - The largest value that goes in bucket b */
+static uint64_t bucket_max(int b)
+{
+    int shift;
+
+    if (b < HIST_SUB)
+        return b;
+    shift = b / HIST_SUB - 1;
+    return ((uint64_t)(HIST_SUB + b % HIST_SUB + 1) << shift) - 1;
+}
+
+void hist_clear(hist_t *h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void hist_add(hist_t *h, uint64_t value)
+{
+    h->buckets[bucket(value)]++;
+    h->count++;
+    h->sum += value;
+    if (value > h->max)
+        h->max = value;
+}
+
+/*
+ * hist_quantile - Report the top of the bucket the quantile falls in,
+ *                 which overstates it by less than one bucket width
+ */
+uint64_t hist_quantile(const hist_t *h, double q)
+{
+    uint64_t rank, seen = 0, top;
+    int b;
+
+    if (h->count == 0)
+        return 0;
+    rank = q * h->count;
+    if (rank >= h->count)
+        rank = h->count - 1;
+    for (b = 0; b < HIST_BUCKETS; b++) {
+        seen += h->buckets[b];
+        if (seen > rank)
+            break;
+    }
+    top = bucket_max(b);
+    return top < h->max ? top : h->max;
+}
@@ -0,0 +1,31 @@
+#ifndef __HIST_H_
+#define __HIST_H_
+
+/*
+ * hist.h - log-linear histograms of latencies
+ *
+ * Values below HIST_SUB are counted exactly.  Above that, each power
+ * of two is split into HIST_SUB equal buckets, so a bucket is never
+ * wider than 1/HIST_SUB of the values in it and percentiles read off
+ * the histogram are within that of the true ones, whatever the range.
+ */
+#include <stdint.h>
+
+#define HIST_SUB_BITS 4
+#define HIST_SUB      (1 << HIST_SUB_BITS)
+#define HIST_BUCKETS  ((64 - HIST_SUB_BITS + 1) * HIST_SUB)
+
+typedef struct {
+    uint64_t count;              /* values added */
+    uint64_t max;                /* largest of them */
+    uint64_t sum;
+    uint64_t buckets[HIST_BUCKETS];
+} hist_t;
+
+void hist_clear(hist_t *h);
+void hist_add(hist_t *h, uint64_t value);
+
+/* The value q (0 to 1) of the way through the values added, 0 if none */
+uint64_t hist_quantile(const hist_t *h, double q);
+
+#endif /* __HIST_H_ */
@@ -0,0 +1,20 @@
+/*
+ * json.c - pieces of JSON output shared by mdriver and tracestat
+ */
+#include <stdio.h>
+
+#include "json.h"
+
+void json_string(FILE *f, const char *s)
+{
+    putc('"', f);
+    for (; *s; s++) {
+        if (*s == '"' || *s == '\\')
+            fprintf(f, "\\%c", *s);
+        else if ((unsigned char)*s < 0x20)
+            fprintf(f, "\\u%04x", *s);
+        else
+            putc(*s, f);
+    }
+    putc('"', f);
+}
@@ -0,0 +1,12 @@
+#ifndef __JSON_H_
+#define __JSON_H_
+
+/*
+ * json.h - pieces of JSON output shared by mdriver and tracestat
+ */
+#include <stdio.h>
+
+/* Write s to f as a JSON string, quotes and escapes included */
+void json_string(FILE *f, const char *s);
+
+#endif /* __JSON_H_ */
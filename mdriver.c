@@ -7,9 +7,16 @@
  * Copyright (c) 2004, R. Bryant and D. O'Hallaron, All rights reserved.
  * May not be used, modified, or copied without permission.
  */
+#define _GNU_SOURCE /* sched_setaffinity */
 #include <assert.h>
+#include <dlfcn.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <float.h>
+#include <getopt.h>
+#include <limits.h>
+#include <pthread.h>
+#include <sched.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdarg.h>
@@ -18,12 +25,23 @@
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/utsname.h>
+#include <sys/wait.h>
 
 
 #include "mm.h"
 #include "memlib.h"
 #include "fsecs.h"
 #include "config.h"
+#include "trace.h"
+#include "hist.h"
+#include "clock.h"
+#include "perfctr.h"
+#include "allocator.h"
+#include "regress.h"
+#include "json.h"
 
 /**********************
  * Constants and macros
@@ -34,6 +52,30 @@
 #define HDRLINES       4 /* number of header lines in a trace file */
 #define LINENUM(i) (i+5) /* cnvt trace request nums to linenums (origin 1) */
 
+/* Multithreaded replay (-T) */
+#define MAX_THREADS   64 /* most threads -T accepts */
+#define THREAD_RUNS    3 /* keep the best of this many runs */
+#define REPLAY_SECS 0.01 /* repeat short traces for at least this long */
+
+/* Malloc packages loaded with -a */
+#define MAX_PLUGINS    8
+
+/* Timing samples (-R) and comparing them with a baseline */
+#define DEFAULT_SAMPLES 30   /* samples per trace for --baseline alone */
+#define SAMPLE_SECS  0.001   /* repeat short traces for this long a sample */
+#define REGRESS_ALPHA  0.01  /* chance of a false alarm over all traces */
+#define REGRESS_MIN    0.05  /* smaller slowdowns are never flagged: runs
+                                differ by a few % in heap placement and
+                                clock speed, which no test within one
+                                run can see */
+
+/* Worker processes for -j, and CPUs for --pin */
+#define MAX_JOBS      64
+#define MAX_CPUS    1024
+
+/* --touch without a fraction: read 1% of the live blocks per request */
+#define DEFAULT_TOUCH 0.01
+
 /* Returns true if p is ALIGNMENT-byte aligned */
 #define IS_ALIGNED(p)  ((((unsigned long)(p)) % ALIGNMENT) == 0)
 
@@ -54,34 +96,21 @@
  * Remember that index (-1) is the null pointer.
  */
 
-/* Records the extent of each block's payload */
+/*
+ * Records the extent of each block's payload.  The ranges of a trace
+ * form a treap: a binary search tree on lo that is also a heap on prio,
+ * which keeps it balanced with high probability, so that overlaps are
+ * found in O(log n) even on the largest traces.
+ */
 typedef struct range_t {
     char *lo;              /* low payload address */
     char *hi;              /* high payload address */
-    struct range_t *next;  /* next list element */
+    struct range_t *left;  /* ranges below lo... */
+    struct range_t *right; /* ... and above it */
+    unsigned prio;         /* random, no higher than its parent's */
     int index;             /* same index as free; for debugging */
 } range_t;
 
-/* Characterizes a single trace operation (allocator request) */
-typedef struct {
-    enum { ALLOC, FREE, REALLOC } type; /* type of request */
-    int index;                        /* index for free() to use later */
-    size_t size;                      /* byte size of alloc/realloc request */
-} traceop_t;
-
-/* Holds the information for one trace file*/
-typedef struct {
-    char filename[MAXLINE];
-    int ignore_ranges;   /* don't check ranges (i.e. this is too big) */
-    int num_ids;         /* number of alloc/realloc ids */
-    int num_ops;         /* number of distinct requests */
-    int weight;          /* weight for this trace (unused) */
-    traceop_t *ops;      /* array of requests */
-    char **blocks;       /* array of ptrs returned by malloc/realloc... */
-    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
-    int *block_rand_base;/* index into random_data, if debug is on */
-} trace_t;
-
 /*
  * Holds the params to the xxx_speed functions, which are timed by fcyc.
  * This struct is necessary because fcyc accepts only a pointer array
@@ -90,8 +119,83 @@ typedef struct {
 typedef struct {
     trace_t *trace;
     range_t *ranges;
+
+    /* --touch: the package replayed, the indices of the live blocks,
+       and where each index is in live (-1 if the block isn't) */
+    const allocator_t *allocator;
+    int *live;
+    int *live_pos;
 } speed_t;
 
+/* One thread of a multithreaded replay */
+typedef struct {
+    const allocator_t *allocator;
+    const trace_t *trace;      /* shared with the other threads, read only */
+    int reps;                  /* replay the trace this many times */
+    char **blocks;             /* this thread's blocks for the trace */
+    pthread_barrier_t *start;  /* all threads start together */
+    double start_secs;         /* when this thread started and finished */
+    double end_secs;
+    int failed;                /* set if an allocation failed */
+} replay_t;
+
+/* Multithreaded results for one trace and one malloc package */
+typedef struct {
+    int reps;        /* times each thread replays the trace */
+    double secs1;    /* best time for the trace on a single thread */
+    double ops;      /* ops run by all threads together */
+    double secs;     /* best wall clock time for all threads */
+    double thread_kops[MAX_THREADS]; /* per-thread throughput in that run */
+    double eff;      /* throughput relative to num_threads single threads */
+    int valid;       /* every thread ran its trace to completion */
+} thread_stats_t;
+
+/* One sample of the heap during a util run (-F) */
+typedef struct {
+    int op;              /* requests done */
+    size_t live;         /* payload bytes allocated */
+    size_t heap;         /* heap size */
+    int known;           /* the allocator described its free space: */
+    mm_heapstats_t free;
+} frag_sample_t;
+
+/* The samples of one trace */
+typedef struct {
+    frag_sample_t *samples;
+    int n, max;
+} frag_t;
+
+/* A live block of a streamed trace (-S) */
+typedef struct {
+    int id;              /* index in the trace, -1 for an empty slot */
+    int rand_base;       /* index into random_data, if debug is on */
+    char *p;             /* payload returned by malloc/realloc... */
+    size_t size;         /* ... and its size */
+} live_t;
+
+/*
+ * The live blocks of a streamed trace, found by index.  This is an open
+ * addressing hash table sized by how many blocks are live at once, so
+ * unlike the blocks arrays of a trace_t it doesn't grow with the length
+ * of the trace.
+ */
+typedef struct {
+    live_t *slots;
+    size_t mask;         /* number of slots - 1 */
+    size_t num_live;
+    size_t peak_live;
+} livetab_t;
+
+/* The aggregate results the performance index is computed from */
+typedef struct {
+    double util;       /* average utilization */
+    double kops;       /* average throughput */
+    double util_index; /* the two parts of the index, 0 to 1 */
+    double thru_index;
+    double perfindex;  /* 0 to 100 */
+    int correct;       /* traces run correctly */
+} summary_t;
+
 /* Summarizes the important stats for some malloc function on some trace */
 typedef struct {
     /* set in read_trace */
@@ -106,9 +210,62 @@ typedef struct {
     /* defined only for the student malloc package */
     double util;     /* space utilization for this trace (always 0 for libc) */
 
+    /* page faults taken while the trace ran on a fresh heap (the util
+       run for mm, the validity run for libc), the driver's peak RSS in
+       that run, and the bytes of the heap resident at its end, -1 for
+       libc */
+    double faults;
+    double major_faults;
+    double peak_rss;
+    double resident;
+
+    /* -H: latency of each request type in cycles, indexed by ALLOC,
+       FREE and REALLOC, or NULL */
+    hist_t *lat;
+
+    /* -P: hardware counters over one timed run, -1 where unavailable */
+    int counted;
+    double counters[PERF_COUNTERS];
+
+    /* -R: the time of each of num_samples runs, or NULL */
+    double *samples;
+
+    /* -F: the most fragmented sample of the util run */
+    int frag_samples;    /* samples taken, 0 if none */
+    int frag_op;         /* requests done at that point */
+    double frag_heap;    /* heap size, */
+    double frag_live;    /* payload bytes, */
+    double frag_free;    /* free block bytes, -1 if unknown, */
+    double frag_largest; /* and the largest free block, -1 if unknown */
+
+    /* -O: the heap where the live payload first peaks, by what holds
+       it; space_heap is 0 if it wasn't measured */
+    int space_op;                     /* requests done then */
+    double space_heap;
+    double space_payload;
+    double space_header;              /* the rest of the size malloc */
+    double space_padding;             /* looks for, */
+    double space_bump;
+    double space_slack;               /* what the block found has on top */
+    double space_free[MM_STAT_BUCKETS]; /* free blocks by bucket, */
+    double space_wild;                /* but those that end the heap */
+
     /* Note: secs and util are only defined if valid is true */
 } stats_t;
 
+/*
+ * What a -j worker sends back for each trace it ran.  A record is
+ * smaller than PIPE_BUF, so the workers can share one pipe without
+ * their writes interleaving.
+ */
+typedef struct {
+    int tracenum;    /* index of the trace in the trace list */
+    int errors;      /* errors found in the trace */
+    stats_t stats;   /* lat is always NULL */
+} job_result_t;
+
+typedef char job_result_fits[sizeof(job_result_t) <= PIPE_BUF ? 1 : -1];
+
 
 /********************
  * For debugging.  If debug-mode is on, then we have each block start
@@ -137,6 +294,62 @@ int onetime_flag = 0;
 /* by default, no timeouts */
 static int set_timeout = 0;
 
+/* -S: read each trace from disk a window at a time instead of all at once */
+static int stream_traces = 0;
+
+/* -H: time every request and report latency percentiles */
+static int latency_hists = 0;
+
+/* -P: count hardware events during a timed run of each trace */
+static int perf_counters = 0;
+static perfctr_t perfctr;
+
+/* -R: time each trace this many times, one run (or batch) at a time */
+static int num_samples = 0;
+
+/* -F: sample the heap every frag_every requests of the util runs,
+   into frag_fd */
+static int frag_every = 0;
+static int frag_fd = -1;
+
+/* -O: account for the heap at the peak of each trace */
+static int space_report = 0;
+
+/* --json and --csv: where to write the results, if anywhere */
+static FILE *json_file = NULL;
+static FILE *csv_file = NULL;
+
+/* -j: processes checking traces at once; --pin: the CPUs to run them
+   on, in which case they time the traces as well */
+static int num_jobs = 0;
+static int pin_cpus[MAX_CPUS];
+static int num_pin_cpus = 0;
+
+/* --touch: the share of the live blocks read between two requests in
+   the timed replays, which also write every payload; -1 if they don't */
+static double touch_fraction = -1;
+
+/* -T: threads replaying at once; -m: each on a different trace */
+static int num_threads = 0;
+static int mix_traces = 0;
+
+static const allocator_t mm_allocator = {
+    "mm", mm_init, mm_malloc, mm_free, mm_realloc, mm_calloc, mm_checkheap,
+    mm_heapstats, mm_spacestats, mm_layout
+};
+static const allocator_t libc_allocator = {
+    "libc", NULL, malloc, free, realloc, calloc, NULL, NULL, NULL, NULL
+};
+
+/* -a: more packages to run the traces on, and their results */
+static const allocator_t *plugins[MAX_PLUGINS];
+static stats_t *plugin_stats[MAX_PLUGINS];
+static int num_plugins = 0;
+
+/* The package the mm tests (eval_mm_*, eval_stream_valid) run on:
+   mm malloc, or one of the plugins in turn */
+static const allocator_t *test_mm = &mm_allocator;
+
 
 /* Directory where default tracefiles are found */
 static char tracedir[MAXLINE] = TRACEDIR;
@@ -152,18 +365,30 @@ char autoresult[MAXLINE]; /* autoresult string */
  * Function prototypes
  *********************/
 
-/* these functions manipulate range lists */
+/* these functions manipulate the range tree */
 static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index);
 static void remove_range(range_t **ranges, char *lo);
 static void clear_ranges(range_t **ranges);
+static void check_ranges(const trace_t *trace, int opnum, const range_t *r);
 
 /* These functions implement the debugging code */
 static void init_random_data(void);
+static void fill_block(char *p, size_t size, int *rand_base);
+static void check_block(const trace_t *trace, int opnum, int index,
+                        const char *p, size_t size, int rand_base);
 static void check_index(const trace_t *trace, int opnum, int index);
 static void randomize_block(trace_t *trace, int index);
 
+/* these functions manipulate the live blocks of streamed traces */
+static void live_init(livetab_t *live);
+static live_t *live_find(livetab_t *live, int id);
+static live_t *live_add(livetab_t *live, int id);
+static void live_remove(livetab_t *live, live_t *b);
+static void live_clear(livetab_t *live);
+
 /* These functions read, allocate, and free storage for traces */
+static void trace_path(char *path, const char *tracedir, const char *filename);
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename);
 static void reinit_trace(trace_t *trace);
@@ -176,11 +401,83 @@ static void eval_libc_speed(void *ptr);
 /* Routines for evaluating correctnes, space utilization, and speed
    of the student's malloc package in mm.c */
 static int eval_mm_valid(trace_t *trace, range_t **ranges);
-static double eval_mm_util(trace_t *trace, int tracenum);
+static double eval_mm_util(trace_t *trace, int tracenum, frag_t *frag);
 static void eval_mm_speed(void *ptr);
 
+/* Replays that use the payloads (--touch) */
+static fsecs_test_funct touch_start(speed_t *speed_params,
+                                    const allocator_t *allocator,
+                                    fsecs_test_funct speed);
+static void touch_end(speed_t *speed_params);
+static void eval_touch_speed(void *ptr);
+
+/* Per-request latencies (-H) */
+static unsigned long long counter_overhead(void);
+static hist_t *eval_latency(const allocator_t *allocator, trace_t *trace);
+static void print_latency(int n, const stats_t *stats);
+
+/* Timing samples and the regression check (-R) */
+static double *sample_speed(fsecs_test_funct f, void *argp);
+static void save_samples(const char *name, int n, const stats_t *stats);
+static int check_baseline(const char *name, int n, const stats_t *stats);
+
+/* Fragmentation timeline (-F) */
+static void open_frag(const char *name);
+static void frag_sample(frag_t *frag, int op, size_t live);
+static void frag_finish(frag_t *frag, stats_t *stats);
+static void print_frag(int n, const stats_t *stats);
+
+/* Space accounting (-O) */
+static void eval_mm_space(trace_t *trace, int tracenum, stats_t *stats);
+static void print_space(int n, const stats_t *stats);
+
+/* Hardware counters (-P) */
+static void count_speed(fsecs_test_funct f, void *argp, stats_t *stats);
+static void print_counters(int n, const stats_t *stats);
+
+/* Machine-readable output (--json, --csv) */
+static void open_outputs(const char *json_name, const char *csv_name);
+static void close_outputs(void);
+static void write_json(FILE *f, int argc, char **argv, int n,
+                       const stats_t *libc_stats, const stats_t *mm_stats,
+                       const summary_t *summary);
+static void write_csv(FILE *f, int argc, char **argv, int n,
+                      const stats_t *libc_stats, const stats_t *mm_stats,
+                      const summary_t *summary);
+
+/* Replay of traces streamed from disk (-S) */
+static trace_stream_t *open_stream(stats_t *stats, trace_t *trace,
+                                   const char *tracedir, const char *filename);
+static int eval_stream_valid(trace_t *trace, trace_stream_t *stream,
+                             range_t **ranges, livetab_t *live, double *util);
+static double eval_stream_speed(const allocator_t *allocator,
+                                trace_stream_t *stream, livetab_t *live);
+static void stream_test(stats_t *stats, const char *tracedir,
+                        const char *filename, const allocator_t *allocator,
+                        range_t **ranges);
+
+/* Multithreaded replay (-T) */
+static void *replay_thread(void *ptr);
+static int eval_threads(const allocator_t *allocator, trace_t **traces,
+                        int num_traces, int first, int nthreads,
+                        thread_stats_t *stats);
+static void run_threaded_tests(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, const stats_t *mm_stats);
+static double wall_secs(void);
+
+/* Page faults and peak RSS of one run, see faults_start */
+typedef struct {
+    long minor, major;
+} faults_t;
+
 /* Various helper routines */
+static void faults_start(faults_t *f);
+static void faults_end(const faults_t *f, stats_t *stats);
 static void printresults(int n, stats_t *stats);
+static void show_results(int n, stats_t *stats);
+static void print_comparison(int n, const stats_t *libc_stats,
+                             const stats_t *mm_stats);
+static const allocator_t *load_allocator(const char *path);
 static void usage(void);
 static void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
     __attribute__((format(printf, 3,4)));
@@ -198,6 +495,256 @@ static void timeout_handler(int sig __attribute__((unused))) {
     longjmp(timeout_jmpbuf, 1);
 }
 
+/*
+ * util_trace - Measure the util of a trace that ran correctly, and the
+ *     page faults it takes and memory it keeps, on a freshly mapped heap
+ */
+static void util_trace(stats_t *stats, trace_t *trace, int tracenum)
+{
+    faults_t faults;
+
+    /* remap the heap so the util run faults in every page it uses */
+    mem_deinit();
+    if (mem_init() < 0)
+        unix_error("mem_init failed for the %s backend",
+                   mem_backend_name());
+    faults_start(&faults);
+    if (frag_every > 0) {
+        frag_t frag = { NULL, 0, 0 };
+        stats->util = eval_mm_util(trace, tracenum, &frag);
+        faults_end(&faults, stats);
+        frag_finish(&frag, stats);
+    }
+    else {
+        stats->util = eval_mm_util(trace, tracenum, NULL);
+        faults_end(&faults, stats);
+    }
+    stats->resident = mem_resident();
+    if (space_report)
+        eval_mm_space(trace, tracenum, stats);
+}
+
+/* What time_trace measures; pinned -j workers and the parent split it */
+#define TIME_SECS   1   /* the run time */
+#define TIME_EXTRAS 2   /* the -H, -P and -R runs */
+
+/*
+ * time_trace - Time a trace that ran correctly, and take its -H, -P and
+ *     -R measurements if asked for, whichever of them parts says
+ */
+static void time_trace(stats_t *stats, trace_t *trace, speed_t *speed_params,
+                       int parts)
+{
+    fsecs_test_funct speed;
+
+    speed_params->trace = trace;
+    speed = touch_start(speed_params, test_mm, eval_mm_speed);
+    if (parts & TIME_SECS)
+        stats->secs = fsecs(speed, speed_params);
+    if (parts & TIME_EXTRAS) {
+        if (latency_hists)
+            stats->lat = eval_latency(test_mm, trace);
+        if (perf_counters)
+            count_speed(speed, speed_params, stats);
+        if (num_samples > 0)
+            stats->samples = sample_speed(speed, speed_params);
+    }
+    touch_end(speed_params);
+}
+
+/*
+ * parse_cpus - Read a list of CPUs such as "2,3" or "0-3,8" into cpus;
+ *     returns how many, or -1 if it is malformed
+ */
+static int parse_cpus(const char *list, int cpus[MAX_CPUS])
+{
+    const char *p = list;
+    char *end;
+    long lo, hi;
+    int n = 0;
+
+    do {
+        lo = hi = strtol(p, &end, 10);
+        if (end == p || lo < 0)
+            return -1;
+        if (*end == '-') {
+            p = end + 1;
+            hi = strtol(p, &end, 10);
+            if (end == p || hi < lo)
+                return -1;
+        }
+        if (hi >= MAX_CPUS || n + (hi - lo) >= MAX_CPUS)
+            return -1;
+        while (lo <= hi)
+            cpus[n++] = lo++;
+        p = end + 1;
+    } while (*end == ',');
+
+    return *end == '\0' ? n : -1;
+}
+
+/*
+ * pin_cpu - Run the calling process on the given CPU only
+ */
+static void pin_cpu(int cpu)
+{
+    cpu_set_t set;
+
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) < 0)
+        unix_error("Can't run on CPU %d", cpu);
+}
+
+/*
+ * run_worker - Body of -j worker w: take the next trace until there are
+ *     none left, check it and measure its util on a heap of its own, and
+ *     time it too if it is pinned.  The results go to fd.
+ */
+static void run_worker(int w, int fd, int *next, int num_tracefiles,
+                       const char *tracedir, char **tracefiles)
+{
+    range_t *ranges = NULL;
+    speed_t speed_params;
+    job_result_t r;
+    trace_t *trace;
+
+    if (num_pin_cpus > 0)
+        pin_cpu(pin_cpus[w % num_pin_cpus]);
+    memset(&speed_params, 0, sizeof(speed_params));
+
+    while ((r.tracenum = __atomic_fetch_add(next, 1, __ATOMIC_RELAXED)) <
+           num_tracefiles) {
+        memset(&r.stats, 0, sizeof(r.stats));
+        errors = 0;
+        if (mem_init() < 0)
+            unix_error("mem_init failed for the %s backend",
+                       mem_backend_name());
+        trace = read_trace(&r.stats, tracedir, tracefiles[r.tracenum]);
+        r.stats.valid = eval_mm_valid(trace, &ranges);
+        if (r.stats.valid) {
+            util_trace(&r.stats, trace, r.tracenum);
+            if (num_pin_cpus > 0)
+                time_trace(&r.stats, trace, &speed_params, TIME_SECS);
+        }
+        free_trace(trace);
+        mem_deinit();
+
+        r.errors = errors;
+        if (write(fd, &r, sizeof(r)) != sizeof(r))
+            unix_error("write failed in run_worker");
+    }
+}
+
+/*
+ * run_parallel_tests - run_tests for -j.  Workers forked from here check
+ *     the traces and measure their util in parallel, each on its own
+ *     heap, and send back the stats, which land in mm_stats in trace
+ *     order.  The timing runs then follow one at a time in this process,
+ *     so that they don't compete for CPUs, unless --pin gave the workers
+ *     CPUs of their own to time the traces on.  The -H, -P and -R runs
+ *     are always made here.
+ */
+static void run_parallel_tests(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, stats_t *mm_stats,
+                               speed_t *speed_params)
+{
+    pid_t pids[MAX_JOBS];
+    int *next;          /* next trace for a worker, shared by them all */
+    char *done;         /* trace i has been reported */
+    int fds[2], jobs, w, status;
+    volatile int i;
+    volatile int timed_out = 0;
+    job_result_t r;
+    trace_t *trace;
+    ssize_t n;
+
+    jobs = num_jobs < num_tracefiles ? num_jobs : num_tracefiles;
+    next = mmap(NULL, sizeof(*next), PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (next == MAP_FAILED)
+        unix_error("mmap failed in run_parallel_tests");
+    *next = 0;
+    if ((done = calloc(num_tracefiles, 1)) == NULL)
+        unix_error("calloc failed in run_parallel_tests");
+    if (pipe(fds) < 0)
+        unix_error("pipe failed in run_parallel_tests");
+
+    for (w = 0; w < jobs; w++) {
+        if ((pids[w] = fork()) < 0)
+            unix_error("fork failed in run_parallel_tests");
+        if (pids[w] == 0) {
+            close(fds[0]);
+            run_worker(w, fds[1], next, num_tracefiles, tracedir, tracefiles);
+            _exit(0);
+        }
+    }
+    close(fds[1]);
+
+    /* On a timeout, stop the workers; what they didn't finish is invalid */
+    if (setjmp(timeout_jmpbuf) == 0) {
+        while ((n = read(fds[0], &r, sizeof(r))) == sizeof(r)) {
+            mm_stats[r.tracenum] = r.stats;
+            done[r.tracenum] = 1;
+            errors += r.errors;
+        }
+        if (n != 0)
+            unix_error("read failed in run_parallel_tests");
+    }
+    else {
+        timed_out = 1;
+        for (w = 0; w < jobs; w++)
+            kill(pids[w], SIGKILL);
+    }
+    close(fds[0]);
+
+    for (w = 0; w < jobs; w++) {
+        if (waitpid(pids[w], &status, 0) < 0)
+            unix_error("waitpid failed in run_parallel_tests");
+        if (WIFSIGNALED(status) && WTERMSIG(status) != SIGKILL)
+            printf("A -j worker died of signal %d (%s)\n", WTERMSIG(status),
+                   strsignal(WTERMSIG(status)));
+    }
+    munmap(next, sizeof(*next));
+
+    /* Short of a timeout, a trace nobody reported on crashed its worker */
+    for (i = 0; i < num_tracefiles; i++) {
+        if (!done[i]) {
+            trace_path(mm_stats[i].filename, tracedir, tracefiles[i]);
+            mm_stats[i].valid = 0;
+            if (!timed_out) {
+                printf("ERROR [trace %s]: the worker running it died\n",
+                       mm_stats[i].filename);
+                errors++;
+            }
+        }
+    }
+    free(done);
+    if (timed_out)
+        return;
+
+    /* The timing runs, one trace at a time */
+    if (setjmp(timeout_jmpbuf) != 0) {
+        for (; i < num_tracefiles; i++)
+            mm_stats[i].valid = 0;
+        return;
+    }
+    for (i = 0; i < num_tracefiles; i++) {
+        if (!mm_stats[i].valid ||
+            (num_pin_cpus > 0 && !latency_hists && !perf_counters &&
+             num_samples == 0))
+            continue;
+        if (mem_init() < 0)
+            unix_error("mem_init failed for the %s backend",
+                       mem_backend_name());
+        trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
+        time_trace(&mm_stats[i], trace, speed_params,
+                   num_pin_cpus > 0 ? TIME_EXTRAS : TIME_SECS | TIME_EXTRAS);
+        free_trace(trace);
+        mem_deinit();
+    }
+}
+
 /* Run the tests; return the number of tests run (may be less than
    num_tracefiles, if there's a timeout) */
 static void run_tests(int num_tracefiles, const char *tracedir,
@@ -206,16 +753,34 @@ static void run_tests(int num_tracefiles, const char *tracedir,
     volatile int i;
     volatile int timed_out = 0;
 
+    if (num_jobs > 1 && !stream_traces && !onetime_flag) {
+        run_parallel_tests(num_tracefiles, tracedir, tracefiles, mm_stats,
+                           speed_params);
+        return;
+    }
+
     for (i=0; i < num_tracefiles; i++) {
         /* initialize simulated memory system in memlib.c *
          * start each trace with a clean system */
-        mem_init();
+        if (mem_init() < 0)
+            unix_error("mem_init failed for the %s backend",
+                       mem_backend_name());
 
         /* handle timeouts */
         if(setjmp(timeout_jmpbuf) != 0) {
             timed_out = 1;
         }
 
+        if (stream_traces) {
+            if (!timed_out)
+                stream_test(&mm_stats[i], tracedir, tracefiles[i],
+                            test_mm, &ranges);
+            mem_deinit();
+            if (onetime_flag)
+                return;
+            continue;
+        }
+
         trace_t *trace;
         trace = read_trace(&mm_stats[i], tracedir, tracefiles[i]);
         strcpy(mm_stats[i].filename, trace->filename);
@@ -235,12 +800,12 @@ static void run_tests(int num_tracefiles, const char *tracedir,
         if (mm_stats[i].valid) {
             if (verbose > 1)
                 printf("efficiency, ");
-            mm_stats[i].util = eval_mm_util(trace, i);
-            speed_params->trace = trace;
+            util_trace(&mm_stats[i], trace, i);
             speed_params->ranges = ranges;
             if (verbose > 1)
                 printf("and performance.\n");
-            mm_stats[i].secs = fsecs(eval_mm_speed, speed_params);
+            time_trace(&mm_stats[i], trace, speed_params,
+                       TIME_SECS | TIME_EXTRAS);
         }
 
         free_trace(trace);
@@ -255,8 +820,7 @@ static void run_tests(int num_tracefiles, const char *tracedir,
  **************/
 int main(int argc, char **argv)
 {
-    int i;
-    char c;
+    int i, c;
     char **tracefiles = NULL;  /* null-terminated array of trace file names */
     int num_tracefiles = 0;    /* the number of traces in that array */
 
@@ -267,12 +831,34 @@ int main(int argc, char **argv)
 
     int run_libc = 0;     /* If set, run libc malloc (set by -l) */
     int autograder = 0;   /* if set then called by autograder (-A) */
+    const char *json_name = NULL; /* --json and --csv files, "-" for stdout */
+    const char *csv_name = NULL;
+    const char *backend = NULL;   /* as given to -b */
+    const char *frag_name = "frag.csv"; /* -F timeline */
+    const char *save_name = NULL;       /* -R samples to save, */
+    const char *baseline_name = NULL;   /* and to compare with */
+    int regressions = 0;
+    summary_t summary;
 
     /* temporaries used to compute the performance index */
-    double secs, ops, util, avg_mm_util, avg_mm_throughput = 0, p1, p2, perfindex;
+    double secs, ops, util, avg_mm_util, avg_mm_throughput = 0;
+    double p1 = 0, p2 = 0, perfindex;
     double util_weight = 0, perf_weight = 0;
     int numcorrect;
 
+    enum { OPT_JSON = 256, OPT_CSV, OPT_PIN, OPT_FRAG, OPT_SAVE, OPT_BASE,
+           OPT_TOUCH };
+    static const struct option long_opts[] = {
+        { "json", optional_argument, NULL, OPT_JSON },
+        { "csv", optional_argument, NULL, OPT_CSV },
+        { "pin", required_argument, NULL, OPT_PIN },
+        { "frag", required_argument, NULL, OPT_FRAG },
+        { "save", required_argument, NULL, OPT_SAVE },
+        { "baseline", required_argument, NULL, OPT_BASE },
+        { "touch", optional_argument, NULL, OPT_TOUCH },
+        { NULL, 0, NULL, 0 }
+    };
+
 
     setbuf(stdout, 0);
     setbuf(stderr, 0);
@@ -280,9 +866,51 @@ int main(int argc, char **argv)
     /*
      * Read and interpret the command line arguments
      */
-    while ((c = getopt(argc, argv, "d:f:c:s:t:v:hVAlD")) != EOF) {
+    while ((c = getopt_long(argc, argv, "a:b:d:f:c:j:s:t:v:F:R:T:hHOPVAlmDS",
+                            long_opts, NULL)) != EOF) {
         switch (c) {
 
+        case 'a': /* Load another malloc package to run the traces on */
+            if (num_plugins == MAX_PLUGINS) {
+                fprintf(stderr, "-a takes at most %d packages\n", MAX_PLUGINS);
+                exit(1);
+            }
+            plugins[num_plugins++] = load_allocator(optarg);
+            break;
+
+        case OPT_JSON: /* Write the results as JSON as well */
+            json_name = optarg != NULL ? optarg : "-";
+            break;
+
+        case OPT_CSV: /* Write the results as CSV as well */
+            csv_name = optarg != NULL ? optarg : "-";
+            break;
+
+        case 'b': /* Memory backend for the heap */
+            if (mem_set_backend(optarg) < 0) {
+                fprintf(stderr, "Unknown memory backend %s\n", optarg);
+                usage();
+                exit(1);
+            }
+            backend = optarg;
+            break;
+
+        case 'j': /* Check traces in several processes at once */
+            num_jobs = atoi(optarg);
+            if (num_jobs < 1 || num_jobs > MAX_JOBS) {
+                fprintf(stderr, "-j takes 1 to %d processes\n", MAX_JOBS);
+                exit(1);
+            }
+            break;
+
+        case OPT_PIN: /* CPUs to run on */
+            if ((num_pin_cpus = parse_cpus(optarg, pin_cpus)) < 0) {
+                fprintf(stderr, "Bad CPU list %s\n", optarg);
+                usage();
+                exit(1);
+            }
+            break;
+
         case 'A': /* Hidden Autolab driver argument */
             autograder = 1;
             break;
@@ -318,6 +946,70 @@ int main(int argc, char **argv)
             run_libc = 1;
             break;
 
+        case 'T': /* Replay on several threads at once as well */
+            num_threads = atoi(optarg);
+            if (num_threads < 1 || num_threads > MAX_THREADS) {
+                fprintf(stderr, "-T takes 1 to %d threads\n", MAX_THREADS);
+                exit(1);
+            }
+            break;
+
+        case 'm': /* With -T, give each thread a different trace */
+            mix_traces = 1;
+            break;
+
+        case 'F': /* Sample the heap during the util runs */
+            frag_every = atoi(optarg);
+            if (frag_every < 1) {
+                fprintf(stderr, "-F takes a number of requests\n");
+                exit(1);
+            }
+            break;
+
+        case OPT_FRAG: /* Where -F puts its samples */
+            frag_name = optarg;
+            break;
+
+        case 'R': /* Time each trace many times */
+            num_samples = atoi(optarg);
+            if (num_samples < 2) {
+                fprintf(stderr, "-R takes 2 or more samples\n");
+                exit(1);
+            }
+            break;
+
+        case OPT_SAVE: /* Save the -R samples */
+            save_name = optarg;
+            break;
+
+        case OPT_BASE: /* Compare the -R samples with saved ones */
+            baseline_name = optarg;
+            break;
+
+        case OPT_TOUCH: /* Use the payloads in the timed replays */
+            touch_fraction = optarg != NULL ? atof(optarg) : DEFAULT_TOUCH;
+            if (touch_fraction < 0 || touch_fraction > 1) {
+                fprintf(stderr, "--touch takes a fraction from 0 to 1\n");
+                exit(1);
+            }
+            break;
+
+        case 'O': /* Where the heap goes at the peak of each trace */
+            space_report = 1;
+            break;
+
+        case 'H': /* Latency percentiles for each request type */
+            latency_hists = 1;
+            break;
+
+        case 'P': /* Hardware performance counters */
+            perf_counters = 1;
+            break;
+
+        case 'S': /* Stream traces from disk */
+            stream_traces = 1;
+            break;
+
         case 'V': /* Increase verbosity level */
             verbose += 1;
             break;
@@ -348,6 +1040,22 @@ int main(int argc, char **argv)
         }
     }
 
+    open_outputs(json_name, csv_name);
+
+    /* Workers each need a heap of their own */
+    if (num_jobs > 1 && backend != NULL && strchr(backend, ':') != NULL) {
+        fprintf(stderr, "-j can't share the named heap of -b %s\n", backend);
+        exit(1);
+    }
+    if (num_pin_cpus > 0 && num_jobs <= 1)
+        pin_cpu(pin_cpus[0]);
+    if (frag_every > 0 && !stream_traces)
+        open_frag(frag_name);
+    if ((save_name != NULL || baseline_name != NULL) && num_samples == 0)
+        num_samples = DEFAULT_SAMPLES;
+    if (baseline_name != NULL && access(baseline_name, R_OK) < 0)
+        unix_error("Can't read the baseline %s", baseline_name);
+
     if (tracefiles == NULL) {
         tracefiles = default_tracefiles;
         num_tracefiles = sizeof(default_tracefiles) / sizeof(char *) - 1;
@@ -360,6 +1068,15 @@ int main(int argc, char **argv)
 
     /* Initialize the timing package */
     init_fsecs();
+    if (verbose > 1)
+        printf("Using the %s heap backend\n", mem_backend_name());
+
+    /* Hardware counters are a nice-to-have: go on without them */
+    if (perf_counters && perf_open(&perfctr) < 0) {
+        printf("Hardware counters unavailable (%s), -P ignored\n",
+               strerror(errno));
+        perf_counters = 0;
+    }
 
     /* Initialize the timeout */
     if (set_timeout > 0) {
@@ -381,16 +1098,36 @@ int main(int argc, char **argv)
 
         /* Evaluate the libc malloc package using the K-best scheme */
         for (i=0; i < num_tracefiles; i++) {
+            if (stream_traces) {
+                stream_test(&libc_stats[i], tracedir, tracefiles[i],
+                            &libc_allocator, NULL);
+                continue;
+            }
+
             trace_t *trace = read_trace(&libc_stats[i], tracedir, tracefiles[i]);
 
+            faults_t faults;
+
             if (verbose > 1)
                 printf("Checking libc malloc for correctness, ");
+            faults_start(&faults);
             libc_stats[i].valid = eval_libc_valid(trace);
+            faults_end(&faults, &libc_stats[i]);
+            libc_stats[i].resident = -1;
             if (libc_stats[i].valid) {
+                fsecs_test_funct speed;
+
                 speed_params.trace = trace;
+                speed = touch_start(&speed_params, &libc_allocator,
+                                    eval_libc_speed);
                 if (verbose > 1)
                     printf("and performance.\n");
-                libc_stats[i].secs = fsecs(eval_libc_speed, &speed_params);
+                libc_stats[i].secs = fsecs(speed, &speed_params);
+                if (latency_hists)
+                    libc_stats[i].lat = eval_latency(&libc_allocator, trace);
+                if (perf_counters)
+                    count_speed(speed, &speed_params, &libc_stats[i]);
+                touch_end(&speed_params);
             }
             free_trace(trace);
         }
@@ -398,7 +1135,7 @@ int main(int argc, char **argv)
         /* Display the libc results in a compact table */
         if (verbose) {
             printf("\nResults for libc malloc:\n");
-            printresults(num_tracefiles, libc_stats);
+            show_results(num_tracefiles, libc_stats);
         }
     }
 
@@ -428,10 +1165,63 @@ int main(int argc, char **argv)
             }
         } else {
             printf("\nResults for mm malloc:\n");
-            printresults(num_tracefiles, mm_stats);
-            printf("\n");
+            show_results(num_tracefiles, mm_stats);
+        }
+    }
+
+    /*
+     * Optionally run the traces on the packages loaded with -a as well.
+     * Their errors don't count against mm malloc.
+     */
+    for (i = 0; i < num_plugins && !onetime_flag; i++) {
+        int mm_errors = errors;
+
+        if (verbose > 1)
+            printf("\nTesting %s\n", plugins[i]->name);
+        plugin_stats[i] = calloc(num_tracefiles, sizeof(stats_t));
+        if (plugin_stats[i] == NULL)
+            unix_error("plugin_stats calloc in main failed");
+        errors = 0;
+        test_mm = plugins[i];
+        run_tests(num_tracefiles, tracedir, tracefiles, plugin_stats[i],
+                  ranges, &speed_params);
+        test_mm = &mm_allocator;
+        if (verbose) {
+            printf("\nResults for %s:\n", plugins[i]->name);
+            show_results(num_tracefiles, plugin_stats[i]);
         }
+        errors = mm_errors;
     }
+    if (num_plugins > 0 && verbose && !onetime_flag)
+        print_comparison(num_tracefiles, libc_stats, mm_stats);
+
+    /*
+     * Optionally see how mm and libc malloc scale with threads
+     */
+    if (latency_hists && stream_traces)
+        printf("-H needs whole traces in memory, skipped with -S\n");
+    if (perf_counters && stream_traces)
+        printf("-P needs whole traces in memory, skipped with -S\n");
+    if (frag_every > 0 && stream_traces)
+        printf("-F needs whole traces in memory, skipped with -S\n");
+    if (space_report && stream_traces)
+        printf("-O needs whole traces in memory, skipped with -S\n");
+    if (num_samples > 0 && stream_traces)
+        printf("-R needs whole traces in memory, skipped with -S\n");
+    if (num_jobs > 1 && stream_traces)
+        printf("-j needs whole traces in memory, ignored with -S\n");
+    if (num_threads > 0 && stream_traces)
+        printf("-T needs whole traces in memory, skipped with -S\n");
+    else if (num_threads > 0 && !onetime_flag)
+        run_threaded_tests(num_tracefiles, tracedir, tracefiles, mm_stats);
+
+    /*
+     * Optionally keep the timing samples, and see if they got slower
+     */
+    if (save_name != NULL && !onetime_flag)
+        save_samples(save_name, num_tracefiles, mm_stats);
+    if (baseline_name != NULL && !onetime_flag)
+        regressions = check_baseline(baseline_name, num_tracefiles, mm_stats);
 
     /*
      * Accumulate the aggregate statistics for the student's mm package
@@ -541,27 +1331,131 @@ int main(int argc, char **argv)
         printf("\nAUTORESULT_STRING=%s\n", autoresult);
     }
 
-    exit(0);
+    summary.util = avg_mm_util;
+    summary.kops = avg_mm_throughput / 1e3;
+    summary.util_index = p1;
+    summary.thru_index = p2;
+    summary.perfindex = perfindex;
+    summary.correct = numcorrect;
+    if (json_file != NULL)
+        write_json(json_file, argc, argv, num_tracefiles, libc_stats,
+                   mm_stats, &summary);
+    if (csv_file != NULL)
+        write_csv(csv_file, argc, argv, num_tracefiles, libc_stats,
+                  mm_stats, &summary);
+    close_outputs();
+
+    exit(regressions > 0 ? 2 : 0);
 }
 
 
 /*****************************************************************
- * The following routines manipulate the range list, which keeps
+ * The following routines manipulate the range tree, which keeps
  * track of the extent of every allocated block payload. We use the
- * range list to detect any overlapping allocated blocks.
+ * range tree to detect any overlapping allocated blocks.
  ****************************************************************/
 
+/* Range records are carved out of chunks of this many, and recycled */
+#define RANGE_CHUNK 4096
+
+static range_t *free_ranges = NULL;  /* recycled records, linked by left */
+
+/*
+ * new_range - Get a range record from the pool.  Records are never
+ *     handed back to libc, so a trace doesn't cost a malloc per block.
+ */
+static range_t *new_range(void)
+{
+    range_t *p;
+    int i;
+
+    if (free_ranges == NULL) {
+        if ((p = malloc(RANGE_CHUNK * sizeof(range_t))) == NULL)
+            unix_error("malloc error in new_range");
+        for (i = 0; i < RANGE_CHUNK; i++) {
+            p[i].left = free_ranges;
+            free_ranges = &p[i];
+        }
+    }
+    p = free_ranges;
+    free_ranges = p->left;
+    return p;
+}
+
+static void free_range(range_t *p)
+{
+    p->left = free_ranges;
+    free_ranges = p;
+}
+
+/*
+ * range_prio - A random priority for a new range; the same sequence for
+ *     every run, so that a failing check can be rerun the same way
+ */
+static unsigned range_prio(void)
+{
+    static unsigned state = 2463534242u;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+/*
+ * insert_range - Insert p into the treap at *root: on the way back up,
+ *     rotate it above any parent with a lower priority
+ */
+static void insert_range(range_t **root, range_t *p)
+{
+    range_t *r = *root;
+
+    if (r == NULL) {
+        p->left = p->right = NULL;
+        *root = p;
+    } else if (p->lo < r->lo) {
+        insert_range(&r->left, p);
+        if (r->left->prio > r->prio) {
+            *root = r->left;
+            r->left = (*root)->right;
+            (*root)->right = r;
+        }
+    } else {
+        insert_range(&r->right, p);
+        if (r->right->prio > r->prio) {
+            *root = r->right;
+            r->right = (*root)->left;
+            (*root)->left = r;
+        }
+    }
+}
+
+/* merge_ranges - Join two treaps, all of a's ranges below all of b's */
+static range_t *merge_ranges(range_t *a, range_t *b)
+{
+    if (a == NULL)
+        return b;
+    if (b == NULL)
+        return a;
+    if (a->prio > b->prio) {
+        a->right = merge_ranges(a->right, b);
+        return a;
+    }
+    b->left = merge_ranges(a, b->left);
+    return b;
+}
+
 /*
  * add_range - As directed by request opnum in trace tracenum,
  *     we've just called the student's mm_malloc to allocate a block of
  *     size bytes at addr lo. After checking the block for correctness,
- *     we create a range struct for this block and add it to the range list.
+ *     we create a range struct for this block and add it to the range tree.
  */
 static int add_range(range_t **ranges, char *lo, int size,
                      const trace_t *trace, int opnum, int index)
 {
     char *hi = lo + size - 1;
-    range_t *p;
+    range_t *p, *below = NULL, *above = NULL;
 
     assert(size > 0);
 
@@ -581,33 +1475,45 @@ static int add_range(range_t **ranges, char *lo, int size,
         return 0;
     }
 
-    /* If we can't afford the linear-time loop, we check less thoroughly and
-       just assume the overlap will be caught by writing random bits. */
-    if(trace->ignore_ranges || debug_mode == DBG_NONE) return 1;
-
-
-    /* The payload must not overlap any other payloads */
-    for (p = *ranges;  p != NULL;  p = p->next) {
-        if ((lo >= p->lo && lo <= p-> hi) ||
-            (hi >= p->lo && hi <= p->hi)) {
-            malloc_error(trace, opnum,
-                         "Payload (%p:%p) overlaps another payload (%p:%p)\n",
-                         lo, hi, p->lo, p->hi);
-            return 0;
+    /* With debugging off, we check less thoroughly and just assume the
+       overlap will be caught by writing random bits. The tree keeps
+       this cheap, so the traces' ignore_ranges flag is no longer used. */
+    if (debug_mode == DBG_NONE) return 1;
+
+    /* The payload must not overlap any other payloads: only the payloads
+       starting nearest below and above lo can */
+    for (p = *ranges; p != NULL; ) {
+        if (p->lo <= lo) {
+            below = p;
+            p = p->right;
+        } else {
+            above = p;
+            p = p->left;
         }
     }
+    if ((p = below) != NULL && p->hi >= lo)
+        ;
+    else if ((p = above) != NULL && p->lo <= hi)
+        ;
+    else
+        p = NULL;
+    if (p != NULL) {
+        malloc_error(trace, opnum,
+                     "Payload (%p:%p) overlaps another payload (%p:%p)\n",
+                     lo, hi, p->lo, p->hi);
+        return 0;
+    }
 
     /*
      * Everything looks OK, so remember the extent of this block
-     * by creating a range struct and adding it the range list.
+     * by creating a range struct and adding it the range tree.
      */
-    if ((p = (range_t *)malloc(sizeof(range_t))) == NULL)
-        unix_error("malloc error in add_range");
-    p->next = *ranges;
+    p = new_range();
     p->lo = lo;
     p->hi = hi;
     p->index = index;
-    *ranges = p;
+    p->prio = range_prio();
+    insert_range(ranges, p);
 
     return 1;
 }
@@ -617,16 +1523,13 @@ static int add_range(range_t **ranges, char *lo, int size,
  */
 static void remove_range(range_t **ranges, char *lo)
 {
-    range_t *p;
-    range_t **prevpp = ranges;
+    range_t **pp = ranges, *p;
 
-    for (p = *ranges;  p != NULL; p = p->next) {
-        if (p->lo == lo) {
-            *prevpp = p->next;
-            free(p);
-            break;
-        }
-        prevpp = &(p->next);
+    while ((p = *pp) != NULL && p->lo != lo)
+        pp = lo < p->lo ? &p->left : &p->right;
+    if (p != NULL) {
+        *pp = merge_ranges(p->left, p->right);
+        free_range(p);
     }
 }
 
@@ -635,16 +1538,27 @@ static void remove_range(range_t **ranges, char *lo)
  */
 static void clear_ranges(range_t **ranges)
 {
-    range_t *p;
-    range_t *pnext;
+    range_t *p = *ranges;
 
-    for (p = *ranges;  p != NULL;  p = pnext) {
-        pnext = p->next;
-        free(p);
-    }
+    if (p == NULL)
+        return;
+    clear_ranges(&p->left);
+    clear_ranges(&p->right);
+    free_range(p);
     *ranges = NULL;
 }
 
+/*
+ * check_ranges - check the data of every block in the tree at r
+ */
+static void check_ranges(const trace_t *trace, int opnum, const range_t *r)
+{
+    for (; r != NULL; r = r->right) {
+        check_ranges(trace, opnum, r->left);
+        check_index(trace, opnum, r->index);
+    }
+}
+
 /**********************************************
  * The following routines handle the random data used for
  * checking memory access.
@@ -660,39 +1574,43 @@ static void init_random_data(void) {
     }
 }
 
-static void randomize_block(trace_t *traces, int index) {
-    size_t size;
+/*
+ * fill_block - Fill a block with random data, from a random place in
+ *              random_data that is saved in *rand_base
+ */
+static void fill_block(char *p, size_t size, int *rand_base) {
     size_t i;
     randint_t *block;
     int base;
 
     if(debug_mode == DBG_NONE) return;
 
-    traces->block_rand_base[index] = random();
+    *rand_base = random();
 
-    block = (randint_t*)traces->blocks[index];
-    size = traces->block_sizes[index] / sizeof(*block);
-    base = traces->block_rand_base[index];
+    block = (randint_t*)p;
+    size = size / sizeof(*block);
+    base = *rand_base;
 
     for(i = 0; i < size; i++) {
         block[i] = random_data[(base + i) % RANDOM_DATA_LEN];
     }
 }
 
-static void check_index(const trace_t *trace, int opnum, int index) {
-    size_t size;
+/*
+ * check_block - Check that block index still holds the data that
+ *               fill_block() put there
+ */
+static void check_block(const trace_t *trace, int opnum, int index,
+                        const char *p, size_t size, int base) {
     size_t i;
-    randint_t *block;
-    int base;
+    const randint_t *block;
     int ngarbled = 0;
     int firstgarbled = -1;
 
-    if(index < 0) return; /* we're doing free(NULL) */
     if(debug_mode == DBG_NONE) return;
 
-    block = (randint_t*)trace->blocks[index];
-    size = trace->block_sizes[index] / sizeof(*block);
-    base = trace->block_rand_base[index];
+    block = (const randint_t*)p;
+    size = size / sizeof(*block);
 
     for(i = 0; i < size; i++) {
         if(block[i] != random_data[(base + i) % RANDOM_DATA_LEN]) {
@@ -707,22 +1625,166 @@ static void check_index(const trace_t *trace, int opnum, int index) {
     }
 }
 
-/**********************************************
- * The following routines manipulate tracefiles
+static void randomize_block(trace_t *traces, int index) {
+    fill_block(traces->blocks[index], traces->block_sizes[index],
+               &traces->block_rand_base[index]);
+}
+
+static void check_index(const trace_t *trace, int opnum, int index) {
+    if(index < 0) return; /* we're doing free(NULL) */
+
+    check_block(trace, opnum, index, trace->blocks[index],
+                trace->block_sizes[index], trace->block_rand_base[index]);
+}
+
+/**********************************************
+ * The following routines manage the table of live blocks
+ * of a streamed trace
+ *********************************************/
+
+#define LIVE_MIN_SLOTS 1024
+
+/* Slot where the search for id starts */
+static size_t live_hash(const livetab_t *live, int id)
+{
+    return ((uint64_t)(uint32_t)id * 0x9e3779b97f4a7c15ULL >> 32) & live->mask;
+}
+
+/*
+ * live_init - Start an empty table
+ */
+static void live_init(livetab_t *live)
+{
+    size_t i;
+
+    if ((live->slots = malloc(LIVE_MIN_SLOTS * sizeof(live_t))) == NULL)
+        unix_error("malloc failed in live_init");
+    for (i = 0; i < LIVE_MIN_SLOTS; i++)
+        live->slots[i].id = -1;
+    live->mask = LIVE_MIN_SLOTS - 1;
+    live->num_live = 0;
+    live->peak_live = 0;
+}
+
+/*
+ * live_find - The live block with index id, or NULL
+ */
+static live_t *live_find(livetab_t *live, int id)
+{
+    size_t i;
+
+    for (i = live_hash(live, id); live->slots[i].id != -1;
+         i = (i + 1) & live->mask) {
+        if (live->slots[i].id == id)
+            return &live->slots[i];
+    }
+    return NULL;
+}
+
+/*
+ * live_grow - Double the table once it is half full
+ */
+static void live_grow(livetab_t *live)
+{
+    live_t *old = live->slots;
+    size_t i, n = live->mask + 1;
+
+    if ((live->slots = malloc(2 * n * sizeof(live_t))) == NULL)
+        unix_error("malloc failed in live_grow");
+    for (i = 0; i < 2 * n; i++)
+        live->slots[i].id = -1;
+    live->mask = 2 * n - 1;
+    for (i = 0; i < n; i++) {
+        if (old[i].id != -1) {
+            size_t j = live_hash(live, old[i].id);
+            while (live->slots[j].id != -1)
+                j = (j + 1) & live->mask;
+            live->slots[j] = old[i];
+        }
+    }
+    free(old);
+}
+
+/*
+ * live_add - The live block with index id, added with no payload if
+ *            it isn't there yet.  The pointer is good until the next
+ *            live_add() or live_remove().
+ */
+static live_t *live_add(livetab_t *live, int id)
+{
+    live_t *b;
+    size_t i;
+
+    if ((b = live_find(live, id)) != NULL)
+        return b;
+    if (2 * (live->num_live + 1) > live->mask + 1)
+        live_grow(live);
+
+    for (i = live_hash(live, id); live->slots[i].id != -1;
+         i = (i + 1) & live->mask)
+        ;
+    b = &live->slots[i];
+    b->id = id;
+    b->p = NULL;
+    b->size = 0;
+    b->rand_base = 0;
+    if (++live->num_live > live->peak_live)
+        live->peak_live = live->num_live;
+    return b;
+}
+
+/*
+ * live_remove - Remove a block, moving back any later ones in its run
+ *               that would no longer be found past the hole
+ */
+static void live_remove(livetab_t *live, live_t *b)
+{
+    size_t hole = b - live->slots, i, home;
+
+    for (i = (hole + 1) & live->mask; live->slots[i].id != -1;
+         i = (i + 1) & live->mask) {
+        home = live_hash(live, live->slots[i].id);
+        if (((i - home) & live->mask) >= ((i - hole) & live->mask)) {
+            live->slots[hole] = live->slots[i];
+            hole = i;
+        }
+    }
+    live->slots[hole].id = -1;
+    live->num_live--;
+}
+
+/*
+ * live_clear - Empty the table, and shrink it back to its first size
+ */
+static void live_clear(livetab_t *live)
+{
+    free(live->slots);
+    live_init(live);
+}
+
+/**********************************************
+ * The following routines manipulate tracefiles
  *********************************************/
 
 /*
- * read_trace - read a trace file and store it in memory
+ * trace_path - the path of a trace file in tracedir
+ */
+static void trace_path(char *path, const char *tracedir, const char *filename)
+{
+    if (snprintf(path, MAXLINE, "%s%s", tracedir, filename) >= MAXLINE)
+        app_error("Trace name too long: %s%s\n", tracedir, filename);
+}
+
+/*
+ * read_trace - read a trace file and store it in memory.  Text traces
+ *              are parsed once and mapped from their binary conversion
+ *              after that, see trace.c.
  */
 static trace_t *read_trace(stats_t *stats, const char *tracedir,
                            const char *filename)
 {
-    FILE *tracefile;
     trace_t *trace;
-    char type[MAXLINE];
-    int index, size;
-    int max_index = 0;
-    int op_index;
+    char path[MAXLINE];
 
     if (verbose > 1)
         printf("Reading tracefile: %s\n", filename);
@@ -731,28 +1793,9 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
     if ((trace = (trace_t *) malloc(sizeof(trace_t))) == NULL)
         unix_error("malloc 1 failed in read_trace");
 
-    /* Read the trace file header */
-    strcpy(trace->filename, tracedir);
-    strcat(trace->filename, filename);
-    if ((tracefile = fopen(trace->filename, "r")) == NULL) {
-        unix_error("Could not open %s in read_trace", trace->filename);
-    }
-    fscanf(tracefile, "%d", &trace->weight);
-    fscanf(tracefile, "%d", &trace->num_ids);
-    fscanf(tracefile, "%d", &trace->num_ops);
-    fscanf(tracefile, "%d", &trace->ignore_ranges);
-
-    if(trace->weight < 0 || trace->weight > 3) {
-        app_error("%s: weight can only be in {0, 1, 2 3}", trace->filename);
-    }
-    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
-        app_error("%s: ignore-ranges can only be zero or one", trace->filename);
-    }
-
-    /* We'll store each request line in the trace in this array */
-    if ((trace->ops =
-         (traceop_t *)malloc(trace->num_ops * sizeof(traceop_t))) == NULL)
-        unix_error("malloc 2 failed in read_trace");
+    /* Load the requests */
+    trace_path(path, tracedir, filename);
+    trace_load(trace, path);
 
     /* We'll keep an array of pointers to the allocated blocks here... */
     if ((trace->blocks =
@@ -769,42 +1812,6 @@ static trace_t *read_trace(stats_t *stats, const char *tracedir,
          calloc(trace->num_ids, sizeof(*trace->block_rand_base))) == NULL)
         unix_error("malloc 5 failed in read_trace");
 
-
-    /* read every request line in the trace file */
-    index = 0;
-    op_index = 0;
-    while (fscanf(tracefile, "%s", type) != EOF) {
-        switch(type[0]) {
-        case 'a':
-            fscanf(tracefile, "%d %d", &index, &size);
-            trace->ops[op_index].type = ALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'r':
-            fscanf(tracefile, "%d %d", &index, &size);
-            trace->ops[op_index].type = REALLOC;
-            trace->ops[op_index].index = index;
-            trace->ops[op_index].size = size;
-            max_index = (index > max_index) ? index : max_index;
-            break;
-        case 'f':
-            fscanf(tracefile, "%d", &index);
-            trace->ops[op_index].type = FREE;
-            trace->ops[op_index].index = index;
-            break;
-        default:
-            app_error("Bogus type character (%c) in tracefile %s\n",
-                      type[0], trace->filename);
-        }
-        op_index++;
-        if(op_index == trace->num_ops) break;
-    }
-    fclose(tracefile);
-    assert(max_index == trace->num_ids - 1);
-    assert(trace->num_ops == op_index);
-
     /* fill in the stats */
     strcpy(stats->filename, trace->filename);
     stats->weight = trace->weight;
@@ -824,13 +1831,13 @@ static void reinit_trace(trace_t *trace)
 }
 
 /*
- * free_trace - Free the trace record and the four arrays it points
- *              to, all of which were allocated in read_trace().
+ * free_trace - Free the trace record, its requests and the three arrays
+ *              it points to, all of which were set up in read_trace().
  */
 static void free_trace(trace_t *trace)
 {
-    free(trace->ops);         /* free the three arrays... */
-    free(trace->blocks);
+    trace_unload(trace);      /* unmap or free the requests... */
+    free(trace->blocks);      /* free the three arrays... */
     free(trace->block_sizes);
     free(trace->block_rand_base);
     free(trace);              /* and the trace record itself... */
@@ -859,7 +1866,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
     reinit_trace(trace);
 
     /* Call the mm package's init function */
-    if (mm_init() < 0) {
+    if (test_mm->init() < 0) {
         malloc_error(trace, 0, "mm_init failed.");
         return 0;
     }
@@ -870,17 +1877,12 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         size = trace->ops[i].size;
 
         if(debug_mode == DBG_EXPENSIVE) {
-            range_t *r;
-
             /* Let the students check their own heap */
-            mm_checkheap(verbose);
+            if (test_mm->checkheap != NULL)
+                test_mm->checkheap(verbose);
 
             /* Now check that all our allocated blocks have the right data */
-            r = *ranges;
-            while(r) {
-                check_index(trace, i, r->index);
-                r = r->next;
-            }
+            check_ranges(trace, i, *ranges);
         }
 
         switch (trace->ops[i].type) {
@@ -888,7 +1890,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
         case ALLOC: /* mm_malloc */
 
             /* Call the student's malloc */
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = test_mm->malloc(size)) == NULL) {
                 malloc_error(trace, i, "mm_malloc failed.");
                 return 0;
             }
@@ -914,7 +1916,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
 
             /* Call the student's realloc */
             oldp = trace->blocks[index];
-            newp = mm_realloc(oldp, size);
+            newp = test_mm->realloc(oldp, size);
             if( (newp == NULL) && (size != 0) ) {
                 malloc_error(trace, i, "mm_realloc failed.");
                 return 0;
@@ -959,7 +1961,7 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
                 p = trace->blocks[index];
                 remove_range(ranges, p);
             }
-            mm_free(p);
+            test_mm->free(p);
             break;
 
         default:
@@ -979,12 +1981,16 @@ static int eval_mm_valid(trace_t *trace, range_t **ranges)
  *   Utilization is the ratio hwm/heapsize, where heapsize is the
  *   size of the heap in bytes after running the student's malloc
  *   package on the trace. Note that our implementation of mem_sbrk()
- *   doesn't allow the students to decrement the brk pointer, so brk
- *   is always the high water mark of the heap.
+ *   doesn't allow the students to decrement the brk pointer, but extra
+ *   segments can be unmapped again, so we use memlib's high water mark
+ *   of the heap size.
  *
  *   A higher number is better: 1 is optimal.
+ *
+ *   With -F, the heap is also sampled into frag every frag_every
+ *   requests.
  */
-static double eval_mm_util(trace_t *trace, int tracenum)
+static double eval_mm_util(trace_t *trace, int tracenum, frag_t *frag)
 {
     int i;
     int index;
@@ -998,7 +2004,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
 
     /* initialize the heap and the mm malloc package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (test_mm->init() < 0)
         app_error("trace %d: mm_init failed in eval_mm_util", tracenum);
 
     for (i = 0;  i < trace->num_ops;  i++) {
@@ -1008,7 +2014,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             index = trace->ops[i].index;
             size = trace->ops[i].size;
 
-            if ((p = mm_malloc(size)) == NULL) {
+            if ((p = test_mm->malloc(size)) == NULL) {
                 app_error("trace %d: mm_malloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1026,7 +2032,8 @@ static double eval_mm_util(trace_t *trace, int tracenum)
             oldsize = trace->block_sizes[index];
 
             oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0) {
+            if ((newp = test_mm->realloc(oldp,newsize)) == NULL &&
+                newsize != 0) {
                 app_error("trace %d: mm_realloc failed in eval_mm_util",
                           tracenum);
             }
@@ -1048,7 +2055,7 @@ static double eval_mm_util(trace_t *trace, int tracenum)
                 p = trace->blocks[index];
             }
 
-            mm_free(p);
+            test_mm->free(p);
 
             total_size -= size;
             break;
@@ -1061,11 +2068,14 @@ static double eval_mm_util(trace_t *trace, int tracenum)
         /* update the high-water mark */
         max_total_size = (total_size > max_total_size) ?
             total_size : max_total_size;
+
+        if (frag != NULL && (i + 1) % frag_every == 0)
+            frag_sample(frag, i + 1, total_size);
     }
 
     printf(".");
 
-    return ((double)max_total_size / (double)mem_heapsize());
+    return ((double)max_total_size / (double)mem_peak_heapsize());
 }
 
 
@@ -1082,7 +2092,7 @@ static void eval_mm_speed(void *ptr)
 
     /* Reset the heap and initialize the mm package */
     mem_reset_brk();
-    if (mm_init() < 0)
+    if (test_mm->init() < 0)
         app_error("mm_init failed in eval_mm_speed");
 
     /* Interpret each trace request */
@@ -1092,7 +2102,7 @@ static void eval_mm_speed(void *ptr)
         case ALLOC: /* mm_malloc */
             index = trace->ops[i].index;
             size = trace->ops[i].size;
-            if ((p = mm_malloc(size)) == NULL)
+            if ((p = test_mm->malloc(size)) == NULL)
                 app_error("mm_malloc error in eval_mm_speed");
             trace->blocks[index] = p;
             break;
@@ -1101,7 +2111,7 @@ static void eval_mm_speed(void *ptr)
             index = trace->ops[i].index;
             newsize = trace->ops[i].size;
             oldp = trace->blocks[index];
-            if ((newp = mm_realloc(oldp,newsize)) == NULL && newsize != 0)
+            if ((newp = test_mm->realloc(oldp,newsize)) == NULL && newsize != 0)
                 app_error("mm_realloc error in eval_mm_speed");
             trace->blocks[index] = newp;
             break;
@@ -1113,7 +2123,7 @@ static void eval_mm_speed(void *ptr)
             } else {
                 block = trace->blocks[index];
             }
-            mm_free(block);
+            test_mm->free(block);
             break;
 
         default:
@@ -1218,150 +2228,2075 @@ static void eval_libc_speed(void *ptr)
     }
 }
 
-/*************************************
- * Some miscellaneous helper routines
- ************************************/
+/**********************************************************************
+ * Replays that use the memory (--touch).  The plain replays never look
+ * at a payload, so an allocator that scatters the live blocks over many
+ * pages and cache lines times the same as one that packs them.  These
+ * write each payload as a program initializing it would, and between
+ * requests read a share of the live blocks, picked at random (the same
+ * way every replay), so that the misses locality saves or costs show
+ * in the throughput.
+ **********************************************************************/
+
+#define TOUCH_STRIDE 64 /* bytes between the reads of a block: a line */
 
+static volatile unsigned touch_sink;
 
 /*
- * printresults - prints a performance summary for some malloc package
+ * touch_start - Set up speed_params for replays of its trace on
+ *     allocator, and return the function to time them with: speed, or
+ *     eval_touch_speed with --touch
  */
-static void printresults(int n, stats_t *stats)
+static fsecs_test_funct touch_start(speed_t *speed_params,
+                                    const allocator_t *allocator,
+                                    fsecs_test_funct speed)
 {
-    int i;
-    /* weighted sums all */
-    double sumsecs = 0;
-    double sumops  = 0;
-    double sumutil = 0;
-    int sum_perf_weight = 0;
-    int sum_util_weight = 0;
+    int n = speed_params->trace->num_ids;
+
+    if (touch_fraction < 0)
+        return speed;
+    speed_params->allocator = allocator;
+    speed_params->live = malloc(n * sizeof(int));
+    speed_params->live_pos = malloc(n * sizeof(int));
+    if (n > 0 && (speed_params->live == NULL ||
+                  speed_params->live_pos == NULL))
+        unix_error("malloc failed in touch_start");
+    return eval_touch_speed;
+}
 
-    char wstr;
+static void touch_end(speed_t *speed_params)
+{
+    if (touch_fraction < 0)
+        return;
+    free(speed_params->live);
+    free(speed_params->live_pos);
+    speed_params->live = speed_params->live_pos = NULL;
+}
 
-    /* Print the individual results for each trace */
-    printf("  %2s%6s %5s%8s%9s  %s\n",
-           "valid", "util", "ops", "secs", "Kops", "trace");
-    for (i=0; i < n; i++) {
-        if (stats[i].valid) {
-            switch(stats[i].weight)
-                {
-                case WNONE:
-                    wstr = ' ';
-                    break;
-                case WALL:
-                    wstr = '*';
-                    break;
-                case WUTIL:
-                    wstr = 'u';
-                    break;
-                case WPERF:
-                    wstr = 'p';
-                    break;
-                default:
-                    app_error("wrong value for weight found!");
-                }
+/*
+ * eval_touch_speed - Replay the trace like eval_mm_speed and
+ *     eval_libc_speed, writing each new payload (the new part, for a
+ *     realloc) and reading touch_fraction of the live blocks, one byte
+ *     per line, after every request
+ */
+static void eval_touch_speed(void *ptr)
+{
+    speed_t *params = ptr;
+    trace_t *trace = params->trace;
+    const allocator_t *allocator = params->allocator;
+    int *live = params->live, *pos = params->live_pos;
+    int i, k, index, num_live = 0;
+    size_t size, oldsize, off;
+    unsigned state = 2463534242u, sum = 0;
+    double reads = 0;
+    char *p;
 
-            /* prints done in a somewhat silly way to avoid hassle
-             * if future columns need to be added/modified like this time */
+    reinit_trace(trace);
+    for (i = 0; i < trace->num_ids; i++)
+        pos[i] = -1;
+    if (allocator->init != NULL) {
+        mem_reset_brk();
+        if (allocator->init() < 0)
+            app_error("%s init failed in eval_touch_speed", allocator->name);
+    }
 
-            printf("%2c", wstr);
-            printf("%4s", "yes");
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        switch (trace->ops[i].type) {
 
-            /* print '--' if util isn't weighted */
-            if(stats[i].weight == WNONE || stats[i].weight == WALL
-               || stats[i].weight == WUTIL)
-                printf(" %5.0f%%", stats[i].util * 100.0);
-            else
-                printf(" %6s", "--");
+        case ALLOC:
+            size = trace->ops[i].size;
+            if ((p = allocator->malloc(size)) == NULL)
+                app_error("%s malloc failed in eval_touch_speed",
+                          allocator->name);
+            memset(p, i, size);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            pos[index] = num_live;
+            live[num_live++] = index;
+            break;
 
-            /* print '--' if perf isn't weighted */
-            if(stats[i].weight == WNONE || stats[i].weight == WALL
-               || stats[i].weight == WPERF)
-                printf("%8.0f%10.6f%6.0f", stats[i].ops, stats[i].secs,
-                       (stats[i].ops/1e3)/stats[i].secs);
-            else
-                printf("%8s%10s%6s", "--", "--", "--");
+        case REALLOC:
+            size = trace->ops[i].size;
+            oldsize = trace->block_sizes[index];
+            p = allocator->realloc(trace->blocks[index], size);
+            if (p == NULL && size != 0)
+                app_error("%s realloc failed in eval_touch_speed",
+                          allocator->name);
+            if (size > oldsize)
+                memset(p + oldsize, i, size - oldsize);
+            trace->blocks[index] = p;
+            trace->block_sizes[index] = size;
+            if (pos[index] < 0) {
+                pos[index] = num_live;
+                live[num_live++] = index;
+            }
+            break;
 
-            printf(" %s\n", stats[i].filename);
+        case FREE:
+            if (index < 0) {
+                allocator->free(NULL);
+                break;
+            }
+            allocator->free(trace->blocks[index]);
+            /* move the last live block into its place */
+            k = pos[index];
+            live[k] = live[--num_live];
+            pos[live[k]] = k;
+            pos[index] = -1;
+            break;
 
-            if(stats[i].weight == WALL || stats[i].weight == WPERF)
-                {
-                    sum_perf_weight += 1;
-                    sumsecs += stats[i].secs;
-                    sumops += stats[i].ops;
-                }
-            if(stats[i].weight == WALL || stats[i].weight == WUTIL)
-                {
-                    sum_util_weight += 1;
-                    sumutil += stats[i].util;
-                }
+        default:
+            app_error("Nonexistent request type in eval_touch_speed");
         }
-        else {
-            printf("%2s%4s %6s%8s%10s%6s %s\n",
-                   stats[i].weight != 0 ? "*" : "",
-                   "no",
-                   "-",
-                   "-",
-                   "-",
-                   "-",
-                   stats[i].filename);
+
+        for (reads += touch_fraction * num_live; reads >= 1; reads -= 1) {
+            state ^= state << 13;
+            state ^= state >> 17;
+            state ^= state << 5;
+            k = live[state % num_live];
+            p = trace->blocks[k];
+            size = trace->block_sizes[k];
+            for (off = 0; off < size; off += TOUCH_STRIDE)
+                sum += (unsigned char)p[off];
         }
     }
+    touch_sink = sum;
+}
 
-    /* Print the aggregate results for the set of traces */
-    if (errors == 0) {
-        if(sum_perf_weight == 0) sum_perf_weight = 1;
-        if(sum_util_weight == 0) sum_util_weight = 1;
+/**********************************************************************
+ * Per-request latencies (-H). One more replay of the trace, with every
+ * call timed on its own by the cycle counter, so the rare slow request
+ * (a long free list search, a heap extension) shows up in the tail
+ * percentiles instead of vanishing into the average of fsecs().
+ **********************************************************************/
 
-        printf("%2d %2d  %5.0f%%%8.0f%10.6f%6.0f\n",
-               sum_util_weight,
-               sum_perf_weight,
-               (sumutil/(double)sum_util_weight)*100.0,
-               sumops,
-               sumsecs,
-               (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs);
+/*
+ * counter_overhead - The fewest cycles two back to back counter reads
+ *     take, which every timed call includes and so is subtracted
+ */
+static unsigned long long counter_overhead(void)
+{
+    static unsigned long long overhead = ~0ULL;
+    unsigned long long t0, t1;
+    int i;
+
+    if (overhead == ~0ULL)
+        for (i = 0; i < 10000; i++) {
+            t0 = read_counter();
+            t1 = read_counter();
+            if (t1 - t0 < overhead)
+                overhead = t1 - t0;
+        }
+    return overhead;
+}
+
+/*
+ * eval_latency - Replay the trace once, timing each request, and return
+ *     a histogram for each request type
+ */
+static hist_t *eval_latency(const allocator_t *allocator, trace_t *trace)
+{
+    unsigned long long t0, t1, overhead = counter_overhead();
+    hist_t *lat;
+    char *p;
+    int i, index, size;
+
+    if ((lat = malloc(3 * sizeof(hist_t))) == NULL)
+        unix_error("malloc failed in eval_latency");
+    for (i = 0; i < 3; i++)
+        hist_clear(&lat[i]);
+
+    reinit_trace(trace);
+    if (allocator->init != NULL) {
+        mem_reset_brk();
+        if (allocator->init() < 0)
+            app_error("mm_init failed in eval_latency");
     }
-    else {
-        printf("     %8s%10s%6s\n",
-               "-",
-               "-",
-               "-");
+
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+
+        case ALLOC:
+            t0 = read_counter();
+            p = allocator->malloc(size);
+            t1 = read_counter();
+            if (p == NULL)
+                app_error("malloc error in eval_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case REALLOC:
+            t0 = read_counter();
+            p = allocator->realloc(trace->blocks[index], size);
+            t1 = read_counter();
+            if (p == NULL && size != 0)
+                app_error("realloc error in eval_latency");
+            trace->blocks[index] = p;
+            break;
+
+        case FREE:
+            p = index >= 0 ? trace->blocks[index] : NULL;
+            t0 = read_counter();
+            allocator->free(p);
+            t1 = read_counter();
+            if (index >= 0)
+                trace->blocks[index] = NULL;
+            break;
+
+        default:
+            app_error("Nonexistent request type in eval_latency");
+        }
+        hist_add(&lat[trace->ops[i].type],
+                 t1 - t0 > overhead ? t1 - t0 - overhead : 0);
     }
 
+    /* Don't leave blocks behind in libc's heap */
+    if (allocator->init == NULL)
+        for (i = 0; i < trace->num_ids; i++)
+            free(trace->blocks[i]);
+    return lat;
 }
 
 /*
- * app_error - Report an arbitrary application error
+ * print_latency - prints the latency percentiles of each request type
+ *     for some malloc package
  */
-void app_error(const char *fmt, ...) {
-    va_list ap;
-    va_start(ap, fmt);
-    vprintf(fmt, ap);
-    va_end(ap);
-    exit(1);
+static void print_latency(int n, const stats_t *stats)
+{
+    static const char *names[] = { "malloc", "free", "realloc" };
+    const hist_t *h;
+    int i, type;
+
+    printf("Latency in cycles (counter overhead of %llu taken off):\n",
+           counter_overhead());
+    printf("  %-8s%9s%7s%7s%7s%8s%10s  %s\n", "request", "count", "p50",
+           "p90", "p99", "p99.9", "max", "trace");
+    for (i = 0; i < n; i++) {
+        if (stats[i].lat == NULL)
+            continue;
+        for (type = ALLOC; type <= REALLOC; type++) {
+            h = &stats[i].lat[type];
+            if (h->count == 0)
+                continue;
+            printf("  %-8s%9llu%7llu%7llu%7llu%8llu%10llu  %s\n",
+                   names[type], (unsigned long long)h->count,
+                   (unsigned long long)hist_quantile(h, 0.5),
+                   (unsigned long long)hist_quantile(h, 0.9),
+                   (unsigned long long)hist_quantile(h, 0.99),
+                   (unsigned long long)hist_quantile(h, 0.999),
+                   (unsigned long long)h->max, stats[i].filename);
+        }
+    }
+    printf("\n");
 }
 
+/**********************************************************************
+ * Timing samples (-R).  fsecs() reports one number per trace, the best
+ * of a few runs, which can't tell a slowdown from noise.  -R keeps the
+ * time of every run instead, so that two builds can be compared with a
+ * test that accounts for the spread.
+ **********************************************************************/
+
 /*
- * unix_error - Report the error and its errno.
+ * sample_speed - Time num_samples runs of f.  A trace too short to time
+ *     on its own is run in batches of at least SAMPLE_SECS, and each
+ *     sample is the average over the batch.
  */
-void unix_error(const char *fmt, ...) {
-    va_list ap;
-    va_start(ap, fmt);
-    vprintf(fmt, ap);
-    printf(": %s\n", strerror(errno));
-    va_end(ap);
-    exit(1);
+static double *sample_speed(fsecs_test_funct f, void *argp)
+{
+    double *secs, start, t;
+    int i, k, reps = 1;
+
+    if ((secs = malloc(num_samples * sizeof(*secs))) == NULL)
+        unix_error("malloc failed in sample_speed");
+
+    f(argp);  /* warm up */
+    start = wall_secs();
+    f(argp);
+    t = wall_secs() - start;
+    if (t < SAMPLE_SECS)
+        reps = t > 0 ? SAMPLE_SECS / t + 1 : 1000;
+
+    for (i = 0; i < num_samples; i++) {
+        start = wall_secs();
+        for (k = 0; k < reps; k++)
+            f(argp);
+        secs[i] = (wall_secs() - start) / reps;
+    }
+    return secs;
 }
 
 /*
- * malloc_error - Report an error returned by the mm_malloc package
+ * save_samples - Save the samples of the traces that ran correctly
  */
-void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
+static void save_samples(const char *name, int n, const stats_t *stats)
 {
-    va_list ap;
-    va_start(ap, fmt);
-
-    errors++;
+    sampleset_t *sets;
+    int i, num_sets = 0;
+
+    if ((sets = calloc(n, sizeof(*sets))) == NULL)
+        unix_error("calloc failed in save_samples");
+    for (i = 0; i < n; i++) {
+        if (stats[i].samples == NULL)
+            continue;
+        strcpy(sets[num_sets].name, stats[i].filename);
+        sets[num_sets].n = num_samples;
+        sets[num_sets].secs = stats[i].samples;
+        num_sets++;
+    }
+    if (sampleset_save(name, sets, num_sets) < 0)
+        unix_error("Can't save the samples to %s", name);
+    free(sets);
+}
+
+/*
+ * same_trace - Whether two trace paths name the same file, whichever
+ *     directory it was read from
+ */
+static int same_trace(const char *a, const char *b)
+{
+    const char *p;
+
+    if ((p = strrchr(a, '/')) != NULL)
+        a = p + 1;
+    if ((p = strrchr(b, '/')) != NULL)
+        b = p + 1;
+    return strcmp(a, b) == 0;
+}
+
+/*
+ * check_baseline - Compare the samples of each trace with the baseline's
+ *     and print the change in the median.  A trace is flagged as slower
+ *     if the Mann-Whitney test says so at REGRESS_ALPHA, split over all
+ *     the traces compared (Bonferroni), and its median slowed down by at
+ *     least REGRESS_MIN.  Returns the number of traces flagged.
+ */
+static int check_baseline(const char *name, int n, const stats_t *stats)
+{
+    sampleset_t *base;
+    const sampleset_t *b;
+    double alpha, m0, m1, lo, hi, p;
+    int i, k, num_base, compared = 0, flagged = 0;
+
+    if ((base = sampleset_load(name, &num_base)) == NULL)
+        unix_error("Can't read the baseline %s", name);
+    for (i = 0; i < n; i++)
+        for (k = 0; k < num_base; k++)
+            if (stats[i].samples != NULL &&
+                same_trace(base[k].name, stats[i].filename))
+                compared++;
+    alpha = compared > 0 ? REGRESS_ALPHA / compared : REGRESS_ALPHA;
+
+    printf("Timing against %s (%d samples; Mann-Whitney, p < %.2g):\n",
+           name, num_samples, alpha);
+    printf("  %10s%11s%9s  %-17s%9s  %s\n", "base usecs", "usecs",
+           "change", "95% interval", "p", "trace");
+    for (i = 0; i < n; i++) {
+        if (stats[i].samples == NULL)
+            continue;
+        for (k = 0, b = NULL; k < num_base && b == NULL; k++)
+            if (same_trace(base[k].name, stats[i].filename))
+                b = &base[k];
+        if (b == NULL) {
+            printf("  %10s%11s%9s  %-17s%9s  %s (not in baseline)\n", "--",
+                   "--", "--", "--", "--", stats[i].filename);
+            continue;
+        }
+
+        m0 = sample_median(b->secs, b->n);
+        m1 = sample_median(stats[i].samples, num_samples);
+        bootstrap_ratio(b->secs, b->n, stats[i].samples, num_samples, 0.95,
+                        &lo, &hi);
+        p = mann_whitney(b->secs, b->n, stats[i].samples, num_samples);
+        printf("  %10.2f%11.2f%+8.1f%%  [%+6.1f%%, %+6.1f%%]%9.2g  %s",
+               m0 * 1e6, m1 * 1e6, 100 * (m1 / m0 - 1), 100 * (lo - 1),
+               100 * (hi - 1), p, stats[i].filename);
+        if (p < alpha && m1 >= m0 * (1 + REGRESS_MIN)) {
+            printf("  SLOWER");
+            flagged++;
+        }
+        else if (1 - p < alpha && m1 <= m0 * (1 - REGRESS_MIN)) {
+            printf("  faster");
+        }
+        printf("\n");
+    }
+    printf("%d of %d traces slower\n\n", flagged, compared);
+
+    sampleset_free(base, num_base);
+    return flagged;
+}
+
+/**********************************************************************
+ * Space accounting (-O).  When a trace's util is poor, this says where
+ * the heap went.  The trace is replayed once more up to the first
+ * request at which its live payload peaks, the point util is about,
+ * and the heap is split into the payload, the rest of the block sizes
+ * malloc looks for (header, alignment padding, the bump up to the
+ * smallest block), the slack of the blocks it finds on top of that,
+ * free blocks by bucket, the wilderness (the free blocks that end the
+ * heap and its segments) and the rest, the package's own bookkeeping.
+ * It takes a package with heapstats, spacestats and layout, such as
+ * mm.c.
+ **********************************************************************/
+
+/*
+ * eval_mm_space - Replay trace to the peak of its live payload, and
+ *     account for the heap there
+ */
+static void eval_mm_space(trace_t *trace, int tracenum, stats_t *stats)
+{
+    mm_heapstats_t heap;
+    mm_spacestats_t space;
+    mm_layout_t layout;
+    long long total = 0, max_total = -1;
+    int i, k, index, size, peak = 0;
+    char *p;
+
+    if (test_mm->heapstats == NULL || test_mm->spacestats == NULL ||
+        test_mm->layout == NULL)
+        return;
+
+    /* the first request after which the payload is at its peak */
+    reinit_trace(trace);
+    for (i = 0; i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        if (trace->ops[i].type == FREE) {
+            if (index >= 0)
+                total -= trace->block_sizes[index];
+            continue;
+        }
+        total += (long long)trace->ops[i].size - trace->block_sizes[index];
+        trace->block_sizes[index] = trace->ops[i].size;
+        if (total > max_total) {
+            max_total = total;
+            peak = i;
+        }
+    }
+
+    reinit_trace(trace);
+    mem_reset_brk();
+    if (test_mm->init() < 0)
+        app_error("trace %d: mm_init failed in eval_mm_space", tracenum);
+    for (i = 0; i <= peak && i < trace->num_ops; i++) {
+        index = trace->ops[i].index;
+        size = trace->ops[i].size;
+        switch (trace->ops[i].type) {
+        case ALLOC:
+            if ((p = test_mm->malloc(size)) == NULL)
+                app_error("trace %d: mm_malloc failed in eval_mm_space",
+                          tracenum);
+            break;
+        case REALLOC:
+            p = test_mm->realloc(trace->blocks[index], size);
+            if (p == NULL && size != 0)
+                app_error("trace %d: mm_realloc failed in eval_mm_space",
+                          tracenum);
+            break;
+        default:
+            if (index < 0) {
+                test_mm->free(NULL);
+                continue;
+            }
+            test_mm->free(trace->blocks[index]);
+            p = NULL;
+            size = 0;
+        }
+        trace->blocks[index] = p;
+        trace->block_sizes[index] = size;
+    }
+
+    stats->space_op = i;
+    stats->space_heap = mem_heapsize();
+    stats->space_payload = stats->space_header = stats->space_padding =
+        stats->space_bump = 0;
+    for (k = 0; k < trace->num_ids; k++) {
+        if (trace->blocks[k] == NULL)
+            continue;
+        test_mm->layout(trace->block_sizes[k], &layout);
+        stats->space_payload += trace->block_sizes[k];
+        stats->space_header += layout.header;
+        stats->space_padding += layout.padding;
+        stats->space_bump += layout.bump;
+    }
+    test_mm->heapstats(&heap);
+    test_mm->spacestats(&space);
+    stats->space_slack = space.alloc_bytes - stats->space_payload -
+        stats->space_header - stats->space_padding - stats->space_bump;
+    stats->space_wild = 0;
+    for (k = 0; k < MM_STAT_BUCKETS; k++) {
+        stats->space_free[k] = heap.free_bytes[k] - space.top_free[k];
+        stats->space_wild += space.top_free[k];
+    }
+}
+
+/* space_other - The part of the heap -O found nothing else in */
+static double space_other(const stats_t *stats)
+{
+    double other = stats->space_heap - stats->space_payload -
+        stats->space_header - stats->space_padding - stats->space_bump -
+        stats->space_slack - stats->space_wild;
+    int k;
+
+    for (k = 0; k < MM_STAT_BUCKETS; k++)
+        other -= stats->space_free[k];
+    return other;
+}
+
+/*
+ * print_space - Print each trace's heap by use, in % of the heap, then
+ *     its free blocks by bucket; nothing for an allocator without space
+ *     stats
+ */
+static void print_space(int n, const stats_t *stats)
+{
+    static const char *parts[] = {
+        "payload", "header", "padding", "bump", "slack", "free", "wild",
+        "other"
+    };
+    int used[MM_STAT_BUCKETS] = { 0 };
+    double v[8], heap;
+    int i, k, any = 0;
+
+    for (i = 0; i < n && stats[i].space_heap == 0; i++)
+        ;
+    if (i == n)
+        return;
+
+    printf("Heap at the peak of the live payload, %% of the heap:\n");
+    printf("  %9s%11s", "op", "heap");
+    for (k = 0; k < 8; k++)
+        printf("%8s", parts[k]);
+    printf("  %s\n", "trace");
+    for (i = 0; i < n; i++) {
+        if (stats[i].space_heap == 0)
+            continue;
+        heap = stats[i].space_heap;
+        v[0] = stats[i].space_payload;
+        v[1] = stats[i].space_header;
+        v[2] = stats[i].space_padding;
+        v[3] = stats[i].space_bump;
+        v[4] = stats[i].space_slack;
+        v[5] = 0;
+        for (k = 0; k < MM_STAT_BUCKETS; k++) {
+            v[5] += stats[i].space_free[k];
+            if (stats[i].space_free[k] > 0)
+                used[k] = any = 1;
+        }
+        v[6] = stats[i].space_wild;
+        v[7] = space_other(&stats[i]);
+        printf("  %9d%11.0f", stats[i].space_op, heap);
+        for (k = 0; k < 8; k++)
+            printf("%7.1f%%", 100 * v[k] / heap);
+        printf("  %s\n", stats[i].filename);
+    }
+    printf("\n");
+    if (!any)
+        return;
+
+    printf("Free blocks by bucket (blocks up to 2^k bytes), %% of the heap:\n");
+    printf("  ");
+    for (k = 0; k < MM_STAT_BUCKETS; k++)
+        if (used[k])
+            printf("%6d", k);
+    printf("  %s\n", "trace");
+    for (i = 0; i < n; i++) {
+        if (stats[i].space_heap == 0)
+            continue;
+        printf("  ");
+        for (k = 0; k < MM_STAT_BUCKETS; k++)
+            if (used[k])
+                printf("%5.1f%%", 100 * stats[i].space_free[k] /
+                       stats[i].space_heap);
+        printf("  %s\n", stats[i].filename);
+    }
+    printf("\n");
+}
+
+/**********************************************************************
+ * Fragmentation timeline (-F).  The util run of each trace samples the
+ * live payload, heap size and free space every frag_every requests.
+ * The samples go to one CSV file, a trace at a time, and the most
+ * fragmented point is kept as its summary: the one with the most free
+ * bytes outside the largest free block, which no big request can use.
+ * For packages that can't describe their free space, it is the one
+ * with the most heap bytes not holding payload.
+ **********************************************************************/
+
+/*
+ * open_frag - Start the timeline file with its column names
+ */
+static void open_frag(const char *name)
+{
+    char line[MAXLINE];
+    int i, len;
+
+    if ((frag_fd = open(name, O_WRONLY | O_CREAT | O_TRUNC | O_APPEND,
+                        0644)) < 0)
+        unix_error("Can't open %s", name);
+    len = snprintf(line, sizeof(line),
+                   "allocator,trace,op,live,heap,free_blocks,largest_free");
+    for (i = 0; i < MM_STAT_BUCKETS; i++)
+        len += snprintf(line + len, sizeof(line) - len, ",free_2^%d", i);
+    line[len++] = '\n';
+    if (write(frag_fd, line, len) != len)
+        unix_error("Can't write %s", name);
+}
+
+/*
+ * frag_sample - Record the heap after op requests with live payload
+ *     bytes allocated
+ */
+static void frag_sample(frag_t *frag, int op, size_t live)
+{
+    frag_sample_t *f;
+
+    if (frag->n == frag->max) {
+        frag->max = frag->max ? 2 * frag->max : 256;
+        frag->samples = realloc(frag->samples,
+                                frag->max * sizeof(*frag->samples));
+        if (frag->samples == NULL)
+            unix_error("realloc failed in frag_sample");
+    }
+    f = &frag->samples[frag->n++];
+    f->op = op;
+    f->live = live;
+    f->heap = mem_heapsize();
+    f->known = test_mm->heapstats != NULL;
+    if (f->known)
+        test_mm->heapstats(&f->free);
+}
+
+/*
+ * frag_waste - How fragmented the heap of a sample is, in bytes
+ */
+static size_t frag_waste(const frag_sample_t *f)
+{
+    size_t free_bytes = 0;
+    int k;
+
+    if (!f->known)
+        return f->heap - f->live;
+    for (k = 0; k < MM_STAT_BUCKETS; k++)
+        free_bytes += f->free.free_bytes[k];
+    return free_bytes - f->free.largest_free;
+}
+
+/*
+ * frag_finish - Append the samples of a trace to the timeline file, in
+ *     one write so that -j workers don't interleave their lines, and
+ *     summarize them in stats
+ */
+static void frag_finish(frag_t *frag, stats_t *stats)
+{
+    const frag_sample_t *f, *worst = NULL;
+    char *buf = NULL;
+    size_t len = 0;
+    FILE *out;
+    int i, k;
+
+    if ((out = open_memstream(&buf, &len)) == NULL)
+        unix_error("open_memstream failed in frag_finish");
+    for (i = 0; i < frag->n; i++) {
+        f = &frag->samples[i];
+        fprintf(out, "%s,\"%s\",%d,%zu,%zu", test_mm->name, stats->filename,
+                f->op, f->live, f->heap);
+        if (f->known) {
+            fprintf(out, ",%zu,%zu", f->free.free_blocks,
+                    f->free.largest_free);
+            for (k = 0; k < MM_STAT_BUCKETS; k++)
+                fprintf(out, ",%zu", f->free.free_bytes[k]);
+        }
+        else {
+            fprintf(out, ",,");
+            for (k = 0; k < MM_STAT_BUCKETS; k++)
+                fprintf(out, ",");
+        }
+        fprintf(out, "\n");
+        if (worst == NULL || frag_waste(f) > frag_waste(worst))
+            worst = f;
+    }
+    fclose(out);
+    if (write(frag_fd, buf, len) != (ssize_t)len)
+        unix_error("Can't write the -F timeline");
+    free(buf);
+
+    stats->frag_samples = frag->n;
+    if (worst != NULL) {
+        stats->frag_op = worst->op;
+        stats->frag_heap = worst->heap;
+        stats->frag_live = worst->live;
+        stats->frag_free = stats->frag_largest = -1;
+        if (worst->known) {
+            stats->frag_free = 0;
+            for (k = 0; k < MM_STAT_BUCKETS; k++)
+                stats->frag_free += worst->free.free_bytes[k];
+            stats->frag_largest = worst->free.largest_free;
+        }
+    }
+    free(frag->samples);
+}
+
+/*
+ * print_frag - Print the worst point of each trace's timeline, if the
+ *     allocator gave any (libc has no heap stats to sample)
+ */
+static void print_frag(int n, const stats_t *stats)
+{
+    int i;
+
+    for (i = 0; i < n && stats[i].frag_samples == 0; i++)
+        ;
+    if (i == n)
+        return;
+
+    printf("Most fragmented point (sampled every %d requests):\n",
+           frag_every);
+    printf("  %9s%11s%11s%6s%11s%10s  %s\n", "op", "heap", "live", "util",
+           "free", "largest", "trace");
+    for (i = 0; i < n; i++) {
+        if (stats[i].frag_samples == 0)
+            continue;
+        printf("  %9d%11.0f%11.0f%5.0f%%", stats[i].frag_op,
+               stats[i].frag_heap, stats[i].frag_live,
+               stats[i].frag_heap > 0 ?
+               100 * stats[i].frag_live / stats[i].frag_heap : 0);
+        if (stats[i].frag_free >= 0)
+            printf("%11.0f%10.0f", stats[i].frag_free, stats[i].frag_largest);
+        else
+            printf("%11s%10s", "--", "--");
+        printf("  %s\n", stats[i].filename);
+    }
+    printf("\n");
+}
+
+/**********************************************************************
+ * Hardware counters (-P). One more timed run of each trace with the
+ * counters on, to tell whether a change to the allocator saved cache
+ * or TLB misses or just instructions.
+ **********************************************************************/
+
+/*
+ * count_speed - Count the hardware events of one run of f, as timed
+ *     by fsecs()
+ */
+static void count_speed(fsecs_test_funct f, void *argp, stats_t *stats)
+{
+    perf_start(&perfctr);
+    f(argp);
+    perf_stop(&perfctr, stats->counters);
+    stats->counted = 1;
+}
+
+/*
+ * print_counters - prints the hardware counters of each trace for some
+ *     malloc package, per request and, with -V, in total
+ */
+static void print_counters(int n, const stats_t *stats)
+{
+    int i, k, total;
+
+    for (total = 0; total <= (verbose > 1); total++) {
+        printf("Hardware counters %s:\n", total ? "in total" : "per request");
+        for (k = 0; k < PERF_COUNTERS; k++)
+            printf("%11s", perf_names[k]);
+        printf("  trace\n");
+        for (i = 0; i < n; i++) {
+            if (!stats[i].counted)
+                continue;
+            for (k = 0; k < PERF_COUNTERS; k++) {
+                if (stats[i].counters[k] < 0)
+                    printf("%11s", "--");
+                else if (total)
+                    printf("%11.0f", stats[i].counters[k]);
+                else
+                    printf("%11.2f", stats[i].counters[k] / stats[i].ops);
+            }
+            printf("  %s\n", stats[i].filename);
+        }
+        printf("\n");
+    }
+}
+
+/**********************************************************************
+ * Replay of traces streamed from disk (-S). Only a window of the trace
+ * is in memory at a time, and the blocks it allocates are kept in a
+ * livetab_t rather than arrays with a slot for every index, so traces
+ * of any length can be run. The checked pass also measures utilization;
+ * the timed passes run without checks, like eval_mm_speed.
+ **********************************************************************/
+
+/*
+ * open_stream - Start streaming a trace, and fill in its stats
+ */
+static trace_stream_t *open_stream(stats_t *stats, trace_t *trace,
+                                   const char *tracedir, const char *filename)
+{
+    char path[MAXLINE];
+    trace_stream_t *stream;
+
+    if (verbose > 1)
+        printf("Streaming tracefile: %s\n", filename);
+
+    trace_path(path, tracedir, filename);
+    stream = trace_stream_open(trace, path);
+    trace->blocks = NULL;
+    trace->block_sizes = NULL;
+    trace->block_rand_base = NULL;
+
+    strcpy(stats->filename, trace->filename);
+    stats->weight = trace->weight;
+    stats->ops = trace->num_ops;
+    return stream;
+}
+
+/*
+ * eval_stream_valid - Check the mm malloc package for correctness on
+ *    a streamed trace, as eval_mm_valid does, and measure its space
+ *    utilization on the way, as eval_mm_util does
+ */
+static int eval_stream_valid(trace_t *trace, trace_stream_t *stream,
+                             range_t **ranges, livetab_t *live, double *util)
+{
+    const traceop_t *ops;
+    int i, n, base, opnum, index;
+    size_t size, total_size = 0, max_total_size = 0;
+    char *p, *newp;
+    live_t *b;
+
+    /* Reset the heap and free any records in the range list */
+    mem_reset_brk();
+    clear_ranges(ranges);
+    live_clear(live);
+
+    /* Call the mm package's init function */
+    if (test_mm->init() < 0) {
+        malloc_error(trace, 0, "mm_init failed.");
+        return 0;
+    }
+
+    /* Interpret each operation in the trace in order */
+    for (base = 0; (ops = trace_stream_next(stream, &n)) != NULL; base += n) {
+        for (i = 0; i < n; i++) {
+            opnum = base + i;
+            index = ops[i].index;
+            size = ops[i].size;
+
+            if (debug_mode == DBG_EXPENSIVE) {
+                size_t j;
+
+                /* Let the students check their own heap */
+                if (test_mm->checkheap != NULL)
+                    test_mm->checkheap(verbose);
+
+                /* Now check that all our allocated blocks have the right data */
+                for (j = 0; j <= live->mask; j++) {
+                    b = &live->slots[j];
+                    if (b->id != -1)
+                        check_block(trace, opnum, b->id, b->p, b->size,
+                                    b->rand_base);
+                }
+            }
+
+            switch (ops[i].type) {
+
+            case ALLOC: /* mm_malloc */
+                if ((p = test_mm->malloc(size)) == NULL) {
+                    malloc_error(trace, opnum, "mm_malloc failed.");
+                    return 0;
+                }
+                if (add_range(ranges, p, size, trace, opnum, index) == 0)
+                    return 0;
+
+                b = live_add(live, index);
+                b->p = p;
+                b->size = size;
+                fill_block(b->p, b->size, &b->rand_base);
+                total_size += size;
+                break;
+
+            case REALLOC: /* mm_realloc */
+                b = live_add(live, index);
+                check_block(trace, opnum, index, b->p, b->size, b->rand_base);
+
+                newp = test_mm->realloc(b->p, size);
+                if (newp == NULL && size != 0) {
+                    malloc_error(trace, opnum, "mm_realloc failed.");
+                    return 0;
+                }
+                if (newp != NULL && size == 0) {
+                    malloc_error(trace, opnum, "mm_realloc with size 0 "
+                                 "returned non-NULL.");
+                    return 0;
+                }
+
+                remove_range(ranges, b->p);
+                if (size > 0 &&
+                    add_range(ranges, newp, size, trace, opnum, index) == 0)
+                    return 0;
+
+                /* Check up to min(size, oldsize) for correct copying */
+                total_size += size - b->size;
+                b->p = newp;
+                if (size < b->size)
+                    b->size = size;
+                check_block(trace, opnum, index, b->p, b->size, b->rand_base);
+                b->size = size;
+                fill_block(b->p, b->size, &b->rand_base);
+                if (size == 0)
+                    live_remove(live, b);
+                break;
+
+            case FREE: /* mm_free */
+                if (index >= 0 && (b = live_find(live, index)) != NULL) {
+                    check_block(trace, opnum, index, b->p, b->size,
+                                b->rand_base);
+                    remove_range(ranges, b->p);
+                    test_mm->free(b->p);
+                    total_size -= b->size;
+                    live_remove(live, b);
+                } else {
+                    test_mm->free(NULL);
+                }
+                break;
+
+            default:
+                app_error("Nonexistent request type in eval_stream_valid");
+            }
+
+            /* update the high-water mark */
+            if (total_size > max_total_size)
+                max_total_size = total_size;
+        }
+    }
+
+    *util = (double)max_total_size / (double)mem_peak_heapsize();
+    return 1;
+}
+
+/*
+ * eval_stream_speed - Time one unchecked replay of a streamed trace
+ */
+static double eval_stream_speed(const allocator_t *allocator,
+                                trace_stream_t *stream, livetab_t *live)
+{
+    const traceop_t *ops;
+    int i, n;
+    size_t j;
+    double start, secs;
+    char *p;
+    live_t *b;
+
+    live_clear(live);
+    if (allocator->init != NULL) {
+        mem_reset_brk();
+        if (allocator->init() < 0)
+            app_error("mm_init failed in eval_stream_speed");
+    }
+
+    /* Don't time the wait for the reader to start up */
+    ops = trace_stream_next(stream, &n);
+    start = wall_secs();
+    for (; ops != NULL; ops = trace_stream_next(stream, &n)) {
+        for (i = 0; i < n; i++) {
+            switch (ops[i].type) {
+
+            case ALLOC:
+                if ((p = allocator->malloc(ops[i].size)) == NULL)
+                    app_error("malloc error in eval_stream_speed");
+                live_add(live, ops[i].index)->p = p;
+                break;
+
+            case REALLOC:
+                b = live_add(live, ops[i].index);
+                p = allocator->realloc(b->p, ops[i].size);
+                if (p == NULL && ops[i].size != 0)
+                    app_error("realloc error in eval_stream_speed");
+                b->p = p;
+                if (p == NULL)
+                    live_remove(live, b);
+                break;
+
+            case FREE:
+                if (ops[i].index >= 0 &&
+                    (b = live_find(live, ops[i].index)) != NULL) {
+                    allocator->free(b->p);
+                    live_remove(live, b);
+                } else {
+                    allocator->free(NULL);
+                }
+                break;
+            }
+        }
+    }
+    secs = wall_secs() - start;
+
+    /* Don't leave blocks behind in libc's heap */
+    if (allocator->init == NULL) {
+        for (j = 0; j <= live->mask; j++)
+            if (live->slots[j].id != -1)
+                allocator->free(live->slots[j].p);
+    }
+    return secs;
+}
+
+/*
+ * stream_test - Evaluate a malloc package on a streamed trace: check
+ *    mm malloc and measure its utilization, then keep the fastest of
+ *    enough replays to take REPLAY_SECS.  libc malloc is only timed.
+ */
+static void stream_test(stats_t *stats, const char *tracedir,
+                        const char *filename, const allocator_t *allocator,
+                        range_t **ranges)
+{
+    trace_t trace;
+    trace_stream_t *stream;
+    livetab_t live;
+    double secs, total = 0;
+    faults_t faults;
+
+    stream = open_stream(stats, &trace, tracedir, filename);
+    live_init(&live);
+
+    if (allocator->init != NULL) {
+        if (verbose > 1)
+            printf("Checking mm_malloc for correctness and efficiency, ");
+
+        /* remap the heap so the checked run faults in every page it uses */
+        mem_deinit();
+        if (mem_init() < 0)
+            unix_error("mem_init failed for the %s backend",
+                       mem_backend_name());
+        faults_start(&faults);
+        stats->valid = eval_stream_valid(&trace, stream, ranges, &live,
+                                         &stats->util);
+        faults_end(&faults, stats);
+        stats->resident = mem_resident();
+        clear_ranges(ranges);
+        if (verbose > 1)
+            printf("peak of %zu live blocks, ", live.peak_live);
+    } else {
+        stats->valid = 1;
+        stats->resident = -1;
+    }
+
+    if (stats->valid && !onetime_flag) {
+        if (verbose > 1)
+            printf("and performance.\n");
+        faults_start(&faults);
+        stats->secs = DBL_MAX;
+        do {
+            trace_stream_rewind(stream);
+            secs = eval_stream_speed(allocator, stream, &live);
+            if (allocator->init == NULL && total == 0)
+                faults_end(&faults, stats);
+            if (secs < stats->secs)
+                stats->secs = secs;
+            total += secs;
+        } while (total < REPLAY_SECS);
+    }
+
+    free(live.slots);
+    trace_stream_close(stream);
+}
+
+/**********************************************************************
+ * Multithreaded replay (-T). Every thread replays a whole trace with its
+ * own block array, all against the same heap, so these runs measure how
+ * the allocator copes with contention rather than check correctness.
+ **********************************************************************/
+
+/*
+ * replay_thread - Replay one trace reps times on one thread, once all the
+ *     threads are ready. Whatever the trace leaves allocated is freed
+ *     after each pass.
+ */
+static void *replay_thread(void *ptr)
+{
+    replay_t *replay = ptr;
+    const allocator_t *allocator = replay->allocator;
+    const trace_t *trace = replay->trace;
+    char **blocks = replay->blocks;
+    int i, index, rep;
+    char *p;
+
+    memset(blocks, 0, trace->num_ids * sizeof(*blocks));
+    replay->failed = 0;
+    pthread_barrier_wait(replay->start);
+
+    replay->start_secs = wall_secs();
+    for (rep = 0; rep < replay->reps; rep++) {
+        for (i = 0;  i < trace->num_ops;  i++) {
+            index = trace->ops[i].index;
+            switch (trace->ops[i].type) {
+
+            case ALLOC: /* malloc */
+                if ((p = allocator->malloc(trace->ops[i].size)) == NULL) {
+                    replay->failed = 1;
+                    return NULL;
+                }
+                blocks[index] = p;
+                break;
+
+            case REALLOC: /* realloc */
+                p = allocator->realloc(blocks[index], trace->ops[i].size);
+                if (p == NULL && trace->ops[i].size != 0) {
+                    replay->failed = 1;
+                    return NULL;
+                }
+                blocks[index] = p;
+                break;
+
+            case FREE: /* free */
+                if (index >= 0) {
+                    allocator->free(blocks[index]);
+                    blocks[index] = NULL;
+                } else {
+                    allocator->free(0);
+                }
+                break;
+            }
+        }
+        for (i = 0; i < trace->num_ids; i++)
+            if (blocks[i] != NULL) {
+                allocator->free(blocks[i]);
+                blocks[i] = NULL;
+            }
+    }
+    replay->end_secs = wall_secs();
+    return NULL;
+}
+
+/*
+ * eval_threads - Replay on nthreads threads at once, each thread on its
+ *     own copy of traces[first] or, with -m, on the traces that follow
+ *     it in turn, each as many times as stats[] for that trace says.
+ *     Keeps the best of THREAD_RUNS runs in stats[first] and returns
+ *     whether every thread got through its trace.
+ */
+static int eval_threads(const allocator_t *allocator, trace_t **traces,
+                        int num_traces, int first, int nthreads,
+                        thread_stats_t *stats)
+{
+    pthread_t tids[MAX_THREADS];
+    replay_t replay[MAX_THREADS];
+    pthread_barrier_t start;
+    double secs, lo, hi;
+    int k, j, run;
+
+    stats += first;
+    stats->ops = 0;
+    stats->secs = DBL_MAX;
+    stats->valid = 1;
+    for (k = 0; k < nthreads; k++) {
+        j = mix_traces ? (first + k) % num_traces : first;
+        replay[k].allocator = allocator;
+        replay[k].trace = traces[j];
+        replay[k].reps = stats[j - first].reps;
+        replay[k].start = &start;
+        replay[k].blocks = malloc(replay[k].trace->num_ids * sizeof(char *));
+        if (replay[k].blocks == NULL)
+            unix_error("malloc failed in eval_threads");
+        stats->ops += (double)replay[k].trace->num_ops * replay[k].reps;
+    }
+
+    for (run = 0; run < THREAD_RUNS && stats->valid; run++) {
+        /* each mm run starts on a fresh heap */
+        if (allocator->init != NULL) {
+            mem_reset_brk();
+            if (allocator->init() < 0)
+                app_error("mm_init failed in eval_threads");
+        }
+
+        pthread_barrier_init(&start, NULL, nthreads + 1);
+        for (k = 0; k < nthreads; k++)
+            if ((errno = pthread_create(&tids[k], NULL, replay_thread,
+                                        &replay[k])) != 0)
+                unix_error("pthread_create failed in eval_threads");
+        pthread_barrier_wait(&start);
+        for (k = 0; k < nthreads; k++)
+            pthread_join(tids[k], NULL);
+        pthread_barrier_destroy(&start);
+
+        /* from the first thread starting to the last one finishing */
+        lo = DBL_MAX;
+        hi = 0;
+        for (k = 0; k < nthreads; k++) {
+            if (replay[k].failed)
+                stats->valid = 0;
+            if (replay[k].start_secs < lo)
+                lo = replay[k].start_secs;
+            if (replay[k].end_secs > hi)
+                hi = replay[k].end_secs;
+        }
+        secs = hi - lo;
+        if (stats->valid && secs < stats->secs) {
+            stats->secs = secs;
+            for (k = 0; k < nthreads; k++)
+                stats->thread_kops[k] =
+                    (double)replay[k].trace->num_ops * replay[k].reps / 1e3 /
+                    (replay[k].end_secs - replay[k].start_secs);
+        }
+    }
+
+    for (k = 0; k < nthreads; k++)
+        free(replay[k].blocks);
+    return stats->valid;
+}
+
+/*
+ * set_efficiency - How close num_threads threads came to num_threads
+ *     times the throughput of one: the time their traces take one after
+ *     the other on a single thread, over num_threads times the time they
+ *     took together.
+ */
+static void set_efficiency(thread_stats_t *stats, int n)
+{
+    double serial;
+    int i, k, j;
+
+    for (i = 0; i < n; i++) {
+        stats[i].eff = 0;
+        if (!stats[i].valid)
+            continue;
+        serial = 0;
+        for (k = 0; k < num_threads; k++) {
+            j = mix_traces ? (i + k) % n : i;
+            serial += stats[j].secs1;
+        }
+        stats[i].eff = serial / (num_threads * stats[i].secs);
+    }
+}
+
+/*
+ * print_thread_stats - One malloc package's columns of the -T table
+ */
+static void print_thread_stats(const thread_stats_t *stats)
+{
+    double kops = 0;
+    int k;
+
+    if (!stats->valid) {
+        printf("%9s%8s%6s", "-", "-", "-");
+        return;
+    }
+    for (k = 0; k < num_threads; k++)
+        kops += stats->thread_kops[k];
+    printf("%9.0f%8.0f%5.0f%%", stats->ops / 1e3 / stats->secs,
+           kops / num_threads, stats->eff * 100.0);
+}
+
+/*
+ * run_threaded_tests - Replay the traces that mm got right on num_threads
+ *     threads, for mm and for libc malloc, and print the aggregate and
+ *     per-thread throughput and how well it scales from one thread.
+ */
+static void run_threaded_tests(int num_tracefiles, const char *tracedir,
+                               char **tracefiles, const stats_t *mm_stats)
+{
+    trace_t **traces;
+    thread_stats_t *mm_tstats, *libc_tstats;
+    stats_t scratch;
+    double ops, mm_secs, libc_secs, mm_serial, libc_serial;
+    int i, k, n = 0;
+
+    if ((traces = calloc(num_tracefiles, sizeof(*traces))) == NULL)
+        unix_error("calloc failed in run_threaded_tests");
+    for (i = 0; i < num_tracefiles; i++)
+        if (mm_stats[i].valid)
+            traces[n++] = read_trace(&scratch, tracedir, tracefiles[i]);
+    if (n == 0) {
+        free(traces);
+        return;
+    }
+    mm_tstats = calloc(n, sizeof(*mm_tstats));
+    libc_tstats = calloc(n, sizeof(*libc_tstats));
+    if (mm_tstats == NULL || libc_tstats == NULL)
+        unix_error("calloc failed in run_threaded_tests");
+
+    if (mem_init() < 0)
+        unix_error("mem_init failed for the %s backend", mem_backend_name());
+    mm_set_threadsafe(1);
+
+    /* single-thread times first, with -m every run needs several. A
+       short trace is repeated until one thread takes REPLAY_SECS on it */
+    if (verbose > 1)
+        printf("\nReplaying each trace on one thread\n");
+    for (i = 0; i < n; i++) {
+        mm_tstats[i].reps = 1;
+        if (eval_threads(&mm_allocator, traces, n, i, 1, mm_tstats) &&
+            mm_tstats[i].secs < REPLAY_SECS) {
+            mm_tstats[i].reps = REPLAY_SECS / (mm_tstats[i].secs + 1e-9) + 1;
+            eval_threads(&mm_allocator, traces, n, i, 1, mm_tstats);
+        }
+        mm_tstats[i].secs1 = mm_tstats[i].secs;
+        libc_tstats[i].reps = mm_tstats[i].reps;
+        eval_threads(&libc_allocator, traces, n, i, 1, libc_tstats);
+        libc_tstats[i].secs1 = libc_tstats[i].secs;
+    }
+    if (verbose > 1)
+        printf("Replaying on %d threads\n", num_threads);
+    for (i = 0; i < n; i++) {
+        int mm_valid = mm_tstats[i].valid, libc_valid = libc_tstats[i].valid;
+        eval_threads(&mm_allocator, traces, n, i, num_threads, mm_tstats);
+        eval_threads(&libc_allocator, traces, n, i, num_threads, libc_tstats);
+        mm_tstats[i].valid &= mm_valid;
+        libc_tstats[i].valid &= libc_valid;
+    }
+    /* a mixed run is only as good as all of its traces */
+    for (i = 0; mix_traces && i < n; i++)
+        for (k = 0; k < num_threads; k++) {
+            mm_tstats[i].valid &= mm_tstats[(i + k) % n].secs1 != DBL_MAX;
+            libc_tstats[i].valid &= libc_tstats[(i + k) % n].secs1 != DBL_MAX;
+        }
+    set_efficiency(mm_tstats, n);
+    set_efficiency(libc_tstats, n);
+
+    mm_set_threadsafe(0);
+    mem_deinit();
+
+    if (verbose) {
+        printf("Results for %d threads, each on %s:\n", num_threads,
+               mix_traces ? "the next trace in turn" : "a copy of the trace");
+        printf("%23s%24s\n", "mm malloc", "libc malloc");
+        printf("%9s%8s%6s%9s%8s%6s  %s\n", "Kops", "thread", "eff",
+               "Kops", "thread", "eff", "trace");
+        ops = mm_secs = libc_secs = mm_serial = libc_serial = 0;
+        for (i = 0; i < n; i++) {
+            print_thread_stats(&mm_tstats[i]);
+            print_thread_stats(&libc_tstats[i]);
+            printf("  %s%s\n", traces[i]->filename, mix_traces ? " ..." : "");
+            if (verbose > 1)
+                for (k = 0; k < num_threads; k++)
+                    printf("%15s%8.0f%23.0f  thread %d\n", "",
+                           mm_tstats[i].valid ? mm_tstats[i].thread_kops[k] : 0,
+                           libc_tstats[i].valid ?
+                           libc_tstats[i].thread_kops[k] : 0, k);
+            if (mm_tstats[i].valid && libc_tstats[i].valid) {
+                ops += mm_tstats[i].ops;
+                mm_secs += mm_tstats[i].secs;
+                libc_secs += libc_tstats[i].secs;
+                mm_serial += mm_tstats[i].eff * num_threads * mm_tstats[i].secs;
+                libc_serial +=
+                    libc_tstats[i].eff * num_threads * libc_tstats[i].secs;
+            }
+        }
+        if (mm_secs > 0 && libc_secs > 0)
+            printf("%9.0f%8s%5.0f%%%9.0f%8s%5.0f%%\n",
+                   ops / 1e3 / mm_secs, "",
+                   mm_serial / (num_threads * mm_secs) * 100.0,
+                   ops / 1e3 / libc_secs, "",
+                   libc_serial / (num_threads * libc_secs) * 100.0);
+        printf("\n");
+    }
+
+    for (i = 0; i < n; i++)
+        free_trace(traces[i]);
+    free(traces);
+    free(mm_tstats);
+    free(libc_tstats);
+}
+
+/**********************************************************************
+ * Machine-readable output (--json, --csv). Every stats_t field of every
+ * trace, for mm and (with -l) libc malloc, along with the aggregate
+ * results and what the numbers were measured on, so that scripts don't
+ * have to scrape the tables.
+ **********************************************************************/
+
+static const char *request_names[] = { "malloc", "free", "realloc" };
+
+/*
+ * open_outputs - Open the --json and --csv files.  When either goes to
+ *     stdout, everything else the driver prints goes to stderr instead,
+ *     so that stdout can be piped straight into another program.
+ */
+static void open_outputs(const char *json_name, const char *csv_name)
+{
+    FILE *out = NULL;
+    int fd;
+
+    if ((json_name != NULL && strcmp(json_name, "-") == 0) ||
+        (csv_name != NULL && strcmp(csv_name, "-") == 0)) {
+        if ((fd = dup(STDOUT_FILENO)) < 0 ||
+            dup2(STDERR_FILENO, STDOUT_FILENO) < 0 ||
+            (out = fdopen(fd, "w")) == NULL)
+            unix_error("can't move the tables to stderr");
+    }
+    if (json_name != NULL) {
+        json_file = strcmp(json_name, "-") == 0 ? out : fopen(json_name, "w");
+        if (json_file == NULL)
+            unix_error("can't write %s", json_name);
+    }
+    if (csv_name != NULL) {
+        csv_file = strcmp(csv_name, "-") == 0 ? out : fopen(csv_name, "w");
+        if (csv_file == NULL)
+            unix_error("can't write %s", csv_name);
+    }
+}
+
+/* cpu_model - The CPU's name from /proc/cpuinfo, or "" */
+static void cpu_model(char *buf, size_t len)
+{
+    char line[MAXLINE], *p;
+    FILE *f;
+
+    buf[0] = '\0';
+    if ((f = fopen("/proc/cpuinfo", "r")) == NULL)
+        return;
+    while (fgets(line, sizeof(line), f) != NULL)
+        if (strncmp(line, "model name", 10) == 0 &&
+            (p = strchr(line, ':')) != NULL) {
+            p += strspn(p + 1, " \t") + 1;
+            p[strcspn(p, "\n")] = '\0';
+            snprintf(buf, len, "%s", p);
+            break;
+        }
+    fclose(f);
+}
+
+/* metadata - Describe the build and host, as name/value pairs */
+#define NUM_META 10
+static void metadata(const char *names[NUM_META],
+                     char values[NUM_META][MAXLINE])
+{
+    static const char *keys[NUM_META] = {
+        "driver_build", "compiler", "debug", "backend", "host", "os",
+        "machine", "cpu", "cpus", "time"
+    };
+    struct utsname un;
+    time_t now = time(NULL);
+    int i;
+
+    for (i = 0; i < NUM_META; i++)
+        names[i] = keys[i];
+    if (uname(&un) < 0)
+        memset(&un, 0, sizeof(un));
+    snprintf(values[0], MAXLINE, "%s %s", __DATE__, __TIME__);
+    snprintf(values[1], MAXLINE, "%s", __VERSION__);
+#ifdef NDEBUG
+    snprintf(values[2], MAXLINE, "no");
+#else
+    snprintf(values[2], MAXLINE, "yes");
+#endif
+    snprintf(values[3], MAXLINE, "%s", mem_backend_name());
+    snprintf(values[4], MAXLINE, "%s", un.nodename);
+    snprintf(values[5], MAXLINE, "%s %s", un.sysname, un.release);
+    snprintf(values[6], MAXLINE, "%s", un.machine);
+    cpu_model(values[7], MAXLINE);
+    snprintf(values[8], MAXLINE, "%ld", sysconf(_SC_NPROCESSORS_ONLN));
+    strftime(values[9], MAXLINE, "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+}
+
+/* kops - A trace's throughput, 0 if it wasn't timed */
+static double kops(const stats_t *stats)
+{
+    return stats->secs > 0 ? stats->ops / 1e3 / stats->secs : 0;
+}
+
+/*
+ * json_stats - Write one trace's results as a JSON object.  Fields that
+ *     weren't measured are null.
+ */
+static void json_stats(FILE *f, const char *allocator, const stats_t *stats)
+{
+    const hist_t *h;
+    int k;
+
+    fprintf(f, "    {\"allocator\": ");
+    json_string(f, allocator);
+    fprintf(f, ", \"trace\": ");
+    json_string(f, stats->filename);
+    fprintf(f, ", \"weight\": %d, \"valid\": %s, \"ops\": %.0f",
+            stats->weight, stats->valid ? "true" : "false", stats->ops);
+    if (stats->valid)
+        fprintf(f, ", \"secs\": %.9g, \"kops\": %.6g, \"util\": %.6g",
+                stats->secs, kops(stats), stats->util);
+    else
+        fprintf(f, ", \"secs\": null, \"kops\": null, \"util\": null");
+    fprintf(f, ", \"faults\": %.0f, \"major_faults\": %.0f, "
+            "\"peak_rss\": %.0f", stats->faults, stats->major_faults,
+            stats->peak_rss);
+    if (stats->resident >= 0)
+        fprintf(f, ", \"resident\": %.0f", stats->resident);
+    else
+        fprintf(f, ", \"resident\": null");
+
+    fprintf(f, ",\n     \"latency\": ");
+    if (stats->lat == NULL) {
+        fprintf(f, "null");
+    } else {
+        fprintf(f, "{");
+        for (k = ALLOC; k <= REALLOC; k++) {
+            h = &stats->lat[k];
+            fprintf(f, "%s\"%s\": {\"count\": %llu, \"mean\": %.6g, "
+                    "\"p50\": %llu, \"p90\": %llu, \"p99\": %llu, "
+                    "\"p99.9\": %llu, \"max\": %llu}",
+                    k > ALLOC ? ",\n                 " : "", request_names[k],
+                    (unsigned long long)h->count,
+                    h->count ? (double)h->sum / h->count : 0,
+                    (unsigned long long)hist_quantile(h, 0.5),
+                    (unsigned long long)hist_quantile(h, 0.9),
+                    (unsigned long long)hist_quantile(h, 0.99),
+                    (unsigned long long)hist_quantile(h, 0.999),
+                    (unsigned long long)h->max);
+        }
+        fprintf(f, "}");
+    }
+
+    fprintf(f, ",\n     \"counters\": ");
+    if (!stats->counted) {
+        fprintf(f, "null");
+    } else {
+        fprintf(f, "{");
+        for (k = 0; k < PERF_COUNTERS; k++) {
+            fprintf(f, "%s\"%s\": ", k ? ", " : "", perf_names[k]);
+            if (stats->counters[k] < 0)
+                fprintf(f, "null");
+            else
+                fprintf(f, "%.0f", stats->counters[k]);
+        }
+        fprintf(f, "}");
+    }
+
+    fprintf(f, ",\n     \"frag\": ");
+    if (stats->frag_samples == 0) {
+        fprintf(f, "null");
+    } else {
+        fprintf(f, "{\"samples\": %d, \"op\": %d, \"heap\": %.0f, "
+                "\"live\": %.0f, ", stats->frag_samples, stats->frag_op,
+                stats->frag_heap, stats->frag_live);
+        if (stats->frag_free < 0)
+            fprintf(f, "\"free\": null, \"largest_free\": null}");
+        else
+            fprintf(f, "\"free\": %.0f, \"largest_free\": %.0f}",
+                    stats->frag_free, stats->frag_largest);
+    }
+
+    fprintf(f, ",\n     \"space\": ");
+    if (stats->space_heap == 0) {
+        fprintf(f, "null");
+    } else {
+        fprintf(f, "{\"op\": %d, \"heap\": %.0f, \"payload\": %.0f, "
+                "\"header\": %.0f, \"padding\": %.0f, \"bump\": %.0f, "
+                "\"slack\": %.0f, \"free\": [", stats->space_op,
+                stats->space_heap, stats->space_payload, stats->space_header,
+                stats->space_padding, stats->space_bump, stats->space_slack);
+        for (k = 0; k < MM_STAT_BUCKETS; k++)
+            fprintf(f, "%s%.0f", k ? ", " : "", stats->space_free[k]);
+        fprintf(f, "], \"wild\": %.0f, \"other\": %.0f}",
+                stats->space_wild, space_other(stats));
+    }
+    fprintf(f, "}");
+}
+
+/*
+ * write_json - Write the metadata, each trace's results and the summary
+ *     as one JSON object
+ */
+static void write_json(FILE *f, int argc, char **argv, int n,
+                       const stats_t *libc_stats, const stats_t *mm_stats,
+                       const summary_t *summary)
+{
+    const char *names[NUM_META];
+    char values[NUM_META][MAXLINE];
+    int i, k, first = 1;
+
+    metadata(names, values);
+    fprintf(f, "{\n  \"meta\": {\n");
+    for (i = 0; i < NUM_META; i++) {
+        fprintf(f, "    \"%s\": ", names[i]);
+        json_string(f, values[i]);
+        fprintf(f, ",\n");
+    }
+    fprintf(f, "    \"args\": [");
+    for (i = 0; i < argc; i++) {
+        if (i > 0)
+            fprintf(f, ", ");
+        json_string(f, argv[i]);
+    }
+    fprintf(f, "]\n  },\n  \"results\": [\n");
+
+    for (i = 0; libc_stats != NULL && i < n; i++, first = 0) {
+        fprintf(f, "%s", first ? "" : ",\n");
+        json_stats(f, "libc", &libc_stats[i]);
+    }
+    for (i = 0; i < n; i++, first = 0) {
+        fprintf(f, "%s", first ? "" : ",\n");
+        json_stats(f, "mm", &mm_stats[i]);
+    }
+    for (k = 0; k < num_plugins; k++)
+        for (i = 0; plugin_stats[k] != NULL && i < n; i++) {
+            fprintf(f, ",\n");
+            json_stats(f, plugins[k]->name, &plugin_stats[k][i]);
+        }
+
+    fprintf(f, "\n  ],\n  \"summary\": {\"util\": %.6g, \"kops\": %.6g, "
+            "\"util_index\": %.6g, \"thru_index\": %.6g, "
+            "\"perf_index\": %.6g, \"correct\": %d, \"errors\": %d}\n}\n",
+            summary->util, summary->kops, summary->util_index,
+            summary->thru_index, summary->perfindex, summary->correct, errors);
+}
+
+/* csv_stats - Write one trace's results as a CSV row; blank if unmeasured */
+static void csv_stats(FILE *f, const char *allocator, const stats_t *stats)
+{
+    const hist_t *h;
+    const char *p;
+    double free_bytes;
+    int k;
+
+    fprintf(f, "%s,\"", allocator);
+    for (p = stats->filename; *p; p++)     /* quotes are doubled */
+        fprintf(f, *p == '"' ? "\"\"" : "%c", *p);
+    fprintf(f, "\",%d,%d,%.0f,", stats->weight, stats->valid, stats->ops);
+    if (stats->valid)
+        fprintf(f, "%.9g,%.6g,%.6g,", stats->secs, kops(stats), stats->util);
+    else
+        fprintf(f, ",,,");
+    fprintf(f, "%.0f", stats->faults);
+
+    for (k = ALLOC; k <= REALLOC; k++) {
+        h = stats->lat != NULL ? &stats->lat[k] : NULL;
+        if (h == NULL)
+            fprintf(f, ",,,,,,,");
+        else
+            fprintf(f, ",%llu,%.6g,%llu,%llu,%llu,%llu,%llu",
+                    (unsigned long long)h->count,
+                    h->count ? (double)h->sum / h->count : 0,
+                    (unsigned long long)hist_quantile(h, 0.5),
+                    (unsigned long long)hist_quantile(h, 0.9),
+                    (unsigned long long)hist_quantile(h, 0.99),
+                    (unsigned long long)hist_quantile(h, 0.999),
+                    (unsigned long long)h->max);
+    }
+    for (k = 0; k < PERF_COUNTERS; k++) {
+        if (stats->counted && stats->counters[k] >= 0)
+            fprintf(f, ",%.0f", stats->counters[k]);
+        else
+            fprintf(f, ",");
+    }
+    if (stats->frag_samples == 0)
+        fprintf(f, ",,,,,");
+    else if (stats->frag_free < 0)
+        fprintf(f, ",%d,%.0f,%.0f,,", stats->frag_op, stats->frag_heap,
+                stats->frag_live);
+    else
+        fprintf(f, ",%d,%.0f,%.0f,%.0f,%.0f", stats->frag_op,
+                stats->frag_heap, stats->frag_live, stats->frag_free,
+                stats->frag_largest);
+    fprintf(f, ",%.0f,%.0f,", stats->major_faults, stats->peak_rss);
+    if (stats->resident >= 0)
+        fprintf(f, "%.0f", stats->resident);
+    if (stats->space_heap == 0) {
+        fprintf(f, ",,,,,,,,,,");
+    } else {
+        for (k = 0, free_bytes = 0; k < MM_STAT_BUCKETS; k++)
+            free_bytes += stats->space_free[k];
+        fprintf(f, ",%d,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f,%.0f",
+                stats->space_op, stats->space_heap, stats->space_payload,
+                stats->space_header, stats->space_padding, stats->space_bump,
+                stats->space_slack, free_bytes, stats->space_wild,
+                space_other(stats));
+    }
+    fprintf(f, "\n");
+}
+
+/*
+ * write_csv - Write one row per trace and malloc package, after the
+ *     metadata and summary as # comment lines
+ */
+static void write_csv(FILE *f, int argc, char **argv, int n,
+                      const stats_t *libc_stats, const stats_t *mm_stats,
+                      const summary_t *summary)
+{
+    static const char *stats[] = {
+        "count", "mean", "p50", "p90", "p99", "p99.9", "max"
+    };
+    const char *names[NUM_META];
+    char values[NUM_META][MAXLINE];
+    int i, k;
+
+    metadata(names, values);
+    for (i = 0; i < NUM_META; i++)
+        fprintf(f, "# %s: %s\n", names[i], values[i]);
+    fprintf(f, "# args:");
+    for (i = 0; i < argc; i++)
+        fprintf(f, " %s", argv[i]);
+    fprintf(f, "\n# summary: util %.6g, kops %.6g, util_index %.6g, "
+            "thru_index %.6g, perf_index %.6g, correct %d, errors %d\n",
+            summary->util, summary->kops, summary->util_index,
+            summary->thru_index, summary->perfindex, summary->correct, errors);
+
+    fprintf(f, "allocator,trace,weight,valid,ops,secs,kops,util,faults");
+    for (k = ALLOC; k <= REALLOC; k++)
+        for (i = 0; i < (int)(sizeof(stats) / sizeof(*stats)); i++)
+            fprintf(f, ",%s_%s", request_names[k], stats[i]);
+    for (k = 0; k < PERF_COUNTERS; k++)
+        fprintf(f, ",%s", perf_names[k]);
+    fprintf(f, ",frag_op,frag_heap,frag_live,frag_free,frag_largest");
+    fprintf(f, ",major_faults,peak_rss,resident");
+    fprintf(f, ",space_op,space_heap,space_payload,space_header,"
+            "space_padding,space_bump,space_slack,space_free,space_wild,"
+            "space_other\n");
+
+    for (i = 0; libc_stats != NULL && i < n; i++)
+        csv_stats(f, "libc", &libc_stats[i]);
+    for (i = 0; i < n; i++)
+        csv_stats(f, "mm", &mm_stats[i]);
+    for (k = 0; k < num_plugins; k++)
+        for (i = 0; plugin_stats[k] != NULL && i < n; i++)
+            csv_stats(f, plugins[k]->name, &plugin_stats[k][i]);
+}
+
+/*
+ * close_outputs - Close the --json and --csv files, once each: with
+ *     both on stdout they are the same FILE
+ */
+static void close_outputs(void)
+{
+    if (json_file != NULL && fclose(json_file) != 0)
+        unix_error("can't write the JSON results");
+    if (csv_file != NULL && csv_file != json_file && fclose(csv_file) != 0)
+        unix_error("can't write the CSV results");
+}
+
+/*************************************
+ * Some miscellaneous helper routines
+ ************************************/
+
+/*
+ * wall_secs - wall clock time in seconds, for the -T runs
+ */
+static double wall_secs(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+
+/*
+ * faults_start - Note the page faults the driver has taken so far, and
+ *     reset its peak RSS where Linux allows it, so that faults_end can
+ *     tell what one run took
+ */
+static void faults_start(faults_t *f)
+{
+    struct rusage ru;
+    int fd;
+
+    if ((fd = open("/proc/self/clear_refs", O_WRONLY)) >= 0) {
+        if (write(fd, "5", 1) < 0) {
+            /* before Linux 4.0: the peak is that of the whole run */
+        }
+        close(fd);
+    }
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+        unix_error("getrusage failed");
+    f->minor = ru.ru_minflt;
+    f->major = ru.ru_majflt;
+}
+
+/*
+ * faults_end - Set the faults of a run since faults_start, and the peak
+ *     RSS (VmHWM; ru_maxrss doesn't reset and keeps that of exited
+ *     threads)
+ */
+static void faults_end(const faults_t *f, stats_t *stats)
+{
+    char line[MAXLINE];
+    struct rusage ru;
+    long kb = -1;
+    FILE *fp;
+
+    if (getrusage(RUSAGE_SELF, &ru) < 0)
+        unix_error("getrusage failed");
+    stats->faults = ru.ru_minflt - f->minor;
+    stats->major_faults = ru.ru_majflt - f->major;
+
+    if ((fp = fopen("/proc/self/status", "r")) != NULL) {
+        while (fgets(line, sizeof(line), fp) != NULL)
+            if (sscanf(line, "VmHWM: %ld kB", &kb) == 1)
+                break;
+        fclose(fp);
+    }
+    stats->peak_rss = (kb >= 0 ? kb : ru.ru_maxrss) * 1024.0;
+}
+
+/*
+ * printresults - prints a performance summary for some malloc package
+ */
+static void printresults(int n, stats_t *stats)
+{
+    int i;
+    /* weighted sums all */
+    double sumsecs = 0;
+    double sumops  = 0;
+    double sumutil = 0;
+    double sumfaults = 0;
+    double summajor = 0;
+    double sumresident = 0;
+    double maxrss = 0;
+    int sum_perf_weight = 0;
+    int sum_util_weight = 0;
+
+    char wstr;
+
+    /* Print the individual results for each trace */
+    printf("  %2s%6s%7s %5s%8s%9s%8s%6s%8s  %s\n", "valid", "util",
+           "resKB", "ops", "secs", "Kops", "faults", "major", "rssKB", "trace");
+    for (i=0; i < n; i++) {
+        if (stats[i].valid) {
+            switch(stats[i].weight)
+                {
+                case WNONE:
+                    wstr = ' ';
+                    break;
+                case WALL:
+                    wstr = '*';
+                    break;
+                case WUTIL:
+                    wstr = 'u';
+                    break;
+                case WPERF:
+                    wstr = 'p';
+                    break;
+                default:
+                    app_error("wrong value for weight found!");
+                }
+
+            /* prints done in a somewhat silly way to avoid hassle
+             * if future columns need to be added/modified like this time */
+
+            printf("%2c", wstr);
+            printf("%4s", "yes");
+
+            /* print '--' if util isn't weighted */
+            if(stats[i].weight == WNONE || stats[i].weight == WALL
+               || stats[i].weight == WUTIL)
+                printf(" %5.0f%%", stats[i].util * 100.0);
+            else
+                printf(" %6s", "--");
+
+            /* the heap's resident size, which libc's doesn't have */
+            if (stats[i].resident >= 0) {
+                printf("%7.0f", stats[i].resident / 1024);
+                sumresident += stats[i].resident;
+            }
+            else
+                printf("%7s", "--");
+
+            /* print '--' if perf isn't weighted */
+            if(stats[i].weight == WNONE || stats[i].weight == WALL
+               || stats[i].weight == WPERF)
+                printf("%8.0f%10.6f%6.0f", stats[i].ops, stats[i].secs,
+                       (stats[i].ops/1e3)/stats[i].secs);
+            else
+                printf("%8s%10s%6s", "--", "--", "--");
+
+            printf("%8.0f%6.0f%8.0f", stats[i].faults,
+                   stats[i].major_faults, stats[i].peak_rss / 1024);
+            sumfaults += stats[i].faults;
+            summajor += stats[i].major_faults;
+            if (stats[i].peak_rss > maxrss)
+                maxrss = stats[i].peak_rss;
+
+            printf(" %s\n", stats[i].filename);
+
+            if(stats[i].weight == WALL || stats[i].weight == WPERF)
+                {
+                    sum_perf_weight += 1;
+                    sumsecs += stats[i].secs;
+                    sumops += stats[i].ops;
+                }
+            if(stats[i].weight == WALL || stats[i].weight == WUTIL)
+                {
+                    sum_util_weight += 1;
+                    sumutil += stats[i].util;
+                }
+        }
+        else {
+            printf("%2s%4s %6s%7s%8s%10s%6s%8s%6s%8s %s\n",
+                   stats[i].weight != 0 ? "*" : "",
+                   "no",
+                   "-",
+                   "-",
+                   "-",
+                   "-",
+                   "-",
+                   "-",
+                   "-",
+                   "-",
+                   stats[i].filename);
+        }
+    }
+
+    /* Print the aggregate results for the set of traces */
+    if (errors == 0) {
+        if(sum_perf_weight == 0) sum_perf_weight = 1;
+        if(sum_util_weight == 0) sum_util_weight = 1;
+
+        printf("%2d %2d  %5.0f%%%7.0f%8.0f%10.6f%6.0f%8.0f%6.0f%8.0f\n",
+               sum_util_weight,
+               sum_perf_weight,
+               (sumutil/(double)sum_util_weight)*100.0,
+               sumresident / 1024,
+               sumops,
+               sumsecs,
+               (sumsecs==0.0) ? 0 : (sumops/1e3)/sumsecs,
+               sumfaults,
+               summajor,
+               maxrss / 1024);
+    }
+    else {
+        printf("            %7s%8s%10s%6s%8s%6s%8s\n",
+               "-",
+               "-",
+               "-",
+               "-",
+               "-",
+               "-",
+               "-");
+    }
+
+}
+
+/*
+ * show_results - prints the table of results for some malloc package,
+ *     and its latencies and counters if asked for
+ */
+static void show_results(int n, stats_t *stats)
+{
+    printresults(n, stats);
+    printf("\n");
+    if (latency_hists && !stream_traces)
+        print_latency(n, stats);
+    if (perf_counters && !stream_traces)
+        print_counters(n, stats);
+    if (frag_every > 0 && !stream_traces)
+        print_frag(n, stats);
+    if (space_report && !stream_traces)
+        print_space(n, stats);
+}
+
+/*
+ * print_comparison - prints the utilization and throughput of every
+ *     malloc package side by side, one trace to a row
+ */
+static void print_comparison(int n, const stats_t *libc_stats,
+                             const stats_t *mm_stats)
+{
+    const stats_t *stats[MAX_PLUGINS + 2];
+    const char *names[MAX_PLUGINS + 2];
+    double util[MAX_PLUGINS + 2], ops[MAX_PLUGINS + 2], secs[MAX_PLUGINS + 2];
+    int i, k, m = 0, valid[MAX_PLUGINS + 2];
+
+    names[m] = "mm";
+    stats[m++] = mm_stats;
+    for (k = 0; k < num_plugins; k++) {
+        names[m] = plugins[k]->name;
+        stats[m++] = plugin_stats[k];
+    }
+    if (libc_stats != NULL) {
+        names[m] = "libc";
+        stats[m++] = libc_stats;
+    }
+
+    printf("Comparison (util, Kops):\n");
+    for (k = 0; k < m; k++) {
+        printf("%16s", names[k]);
+        util[k] = ops[k] = secs[k] = valid[k] = 0;
+    }
+    printf("  trace\n");
+    for (i = 0; i < n; i++) {
+        for (k = 0; k < m; k++) {
+            const stats_t *st = &stats[k][i];
+            if (!st->valid) {
+                printf("%16s", "--");
+                continue;
+            }
+            if (k == m - 1 && libc_stats != NULL)
+                printf("%7s%9.0f", "", st->ops / 1e3 / st->secs);
+            else
+                printf("%6.0f%%%9.0f", st->util * 100,
+                       st->ops / 1e3 / st->secs);
+            util[k] += st->util;
+            ops[k] += st->ops;
+            secs[k] += st->secs;
+            valid[k]++;
+        }
+        printf("  %s\n", stats[0][i].filename);
+    }
+    for (k = 0; k < m; k++) {
+        if (valid[k] == 0 || secs[k] == 0)
+            printf("%16s", "--");
+        else if (k == m - 1 && libc_stats != NULL)
+            printf("%7s%9.0f", "", ops[k] / 1e3 / secs[k]);
+        else
+            printf("%6.0f%%%9.0f", util[k] / valid[k] * 100,
+                   ops[k] / 1e3 / secs[k]);
+    }
+    printf("  (%d traces)\n\n", n);
+}
+
+/*
+ * load_allocator - Load a malloc package from a shared object built
+ *     with plugin.c
+ */
+static const allocator_t *load_allocator(const char *path)
+{
+    char name[MAXLINE];
+    const allocator_t *allocator;
+    void *handle;
+
+    /* dlopen() only looks in the current directory if told to */
+    snprintf(name, sizeof(name), "%s%s", strchr(path, '/') ? "" : "./", path);
+    if ((handle = dlopen(name, RTLD_NOW | RTLD_LOCAL)) == NULL)
+        app_error("Can't load %s: %s\n", path, dlerror());
+    if ((allocator = dlsym(handle, ALLOCATOR_SYMBOL)) == NULL)
+        app_error("%s exports no %s\n", path, ALLOCATOR_SYMBOL);
+    if (allocator->init == NULL)
+        app_error("%s: only packages on the driver's heap can be loaded\n",
+                  path);
+    return allocator;
+}
+
+/*
+ * app_error - Report an arbitrary application error
+ */
+void app_error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+/*
+ * unix_error - Report the error and its errno.
+ */
+void unix_error(const char *fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    printf(": %s\n", strerror(errno));
+    va_end(ap);
+    exit(1);
+}
+
+/*
+ * malloc_error - Report an error returned by the mm_malloc package
+ */
+void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+
+    errors++;
 
     printf("ERROR [trace %s, line %d]: ", trace->filename, LINENUM(opnum));
     vprintf(fmt, ap);
@@ -1375,16 +4310,63 @@ void malloc_error(const trace_t *trace, int opnum, const char *fmt, ...)
  */
 static void usage(void)
 {
-    fprintf(stderr, "Usage: mdriver [-hlVdD] [-f <file>]\n");
+    int i;
+
+    fprintf(stderr, "Usage: mdriver [-hHlmOPSVdD] [-a <file.so>] [-b <backend>] [-j <n>]\n");
+    fprintf(stderr, "               [-F <n>] [-R <n>] [-T <n>] [-f <file>] [--pin=<cpus>]\n");
+    fprintf(stderr, "               [--frag=<file>] [--save=<file>] [--baseline=<file>]\n");
+    fprintf(stderr, "               [--touch[=<f>]] [--json[=<file>]] [--csv[=<file>]]\n");
     fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-a <file>  Also run the traces on the malloc package in\n");
+    fprintf(stderr, "\t           shared object <file> (built from plugin.c), and\n");
+    fprintf(stderr, "\t           compare; may be given up to %d times.\n", MAX_PLUGINS);
+    fprintf(stderr, "\t-b <name>  Heap backend:");
+    for (i = 0; mem_backend_names(i) != NULL; i++)
+        fprintf(stderr, " %s", mem_backend_names(i));
+    fprintf(stderr, " (default sim).\n");
+    fprintf(stderr, "\t           file:<path> keeps the heap in <path>.\n");
     fprintf(stderr, "\t-d <i>     Debug: 0 off; 1 default; 2 lots.\n");
     fprintf(stderr, "\t-D         Equivalent to -d2.\n");
     fprintf(stderr, "\t-c <file>  Run trace file <file> once, check for correctness only.\n");
     fprintf(stderr, "\t-t <dir>   Directory to find default traces.\n");
     fprintf(stderr, "\t-h         Print this message.\n");
     fprintf(stderr, "\t-l         Run libc malloc as well.\n");
+    fprintf(stderr, "\t-j <n>     Check the traces in <n> processes at once, then\n");
+    fprintf(stderr, "\t           time them one after another.\n");
+    fprintf(stderr, "\t--pin=<cpus>\n");
+    fprintf(stderr, "\t           Run on these CPUs (e.g. 2,3 or 2-5); with -j, one\n");
+    fprintf(stderr, "\t           process on each, timing its own traces.\n");
+    fprintf(stderr, "\t-T <n>     Also replay each trace on <n> threads at once,\n");
+    fprintf(stderr, "\t           for mm and libc malloc.\n");
+    fprintf(stderr, "\t-m         With -T, give each thread a different trace.\n");
+    fprintf(stderr, "\t-F <n>     Sample the heap every <n> requests of the util\n");
+    fprintf(stderr, "\t           runs, into frag.csv, and report the worst point.\n");
+    fprintf(stderr, "\t--frag=<file>\n");
+    fprintf(stderr, "\t           Write the -F samples to <file> instead.\n");
+    fprintf(stderr, "\t-O         Break down the heap at each trace's peak live\n");
+    fprintf(stderr, "\t           payload into payload, headers, padding, free\n");
+    fprintf(stderr, "\t           blocks and the rest.\n");
+    fprintf(stderr, "\t-R <n>     Time each trace <n> times, for --save and --baseline.\n");
+    fprintf(stderr, "\t--save=<file>\n");
+    fprintf(stderr, "\t           Save the timing samples to <file>.\n");
+    fprintf(stderr, "\t--baseline=<file>\n");
+    fprintf(stderr, "\t           Compare the samples with those saved in <file>,\n");
+    fprintf(stderr, "\t           and exit with 2 if a trace got significantly slower.\n");
+    fprintf(stderr, "\t--touch[=<f>]\n");
+    fprintf(stderr, "\t           Write each payload in the timed runs, and read a\n");
+    fprintf(stderr, "\t           fraction <f> (default 0.01) of the live blocks\n");
+    fprintf(stderr, "\t           after each request.\n");
+    fprintf(stderr, "\t-H         Report latency percentiles of each request\n");
+    fprintf(stderr, "\t           type, in cycles.\n");
+    fprintf(stderr, "\t-P         Count cache misses and other hardware events\n");
+    fprintf(stderr, "\t           during a timed run.\n");
+    fprintf(stderr, "\t-S         Stream traces from disk, for traces too big\n");
+    fprintf(stderr, "\t           to hold in memory.\n");
     fprintf(stderr, "\t-V         Print diagnostics as each trace is run.\n");
     fprintf(stderr, "\t-v <i>     Set Verbosity Level to <i>\n");
     fprintf(stderr, "\t-s <s>     Timeout after s secs (default no timeout)\n");
     fprintf(stderr, "\t-f <file>  Use <file> as the trace file.\n");
+    fprintf(stderr, "\t--json[=<file>], --csv[=<file>]\n");
+    fprintf(stderr, "\t           Also write the results as JSON or CSV to <file>,\n");
+    fprintf(stderr, "\t           by default to stdout and the tables to stderr.\n");
 }
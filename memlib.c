@@ -2,7 +2,35 @@
  * memlib.c - a module that simulates the memory system.	Needed because it
  *						allows us to interleave calls from the student's malloc package
  *						with the system's malloc package in libc.
+ *
+ * The heap itself comes from one of several backends, picked with
+ * mem_set_backend() before mem_init():
+ *
+ *	sim		the original model: /dev/zero mapped at 0x800000000, with a
+ *			real sbrk() call whenever the heap grows into a new page
+ *	mmap	anonymous PROT_NONE reservation, committed page by page with
+ *			mprotect() as the brk moves up
+ *	thp		like mmap, but 2 MB aligned, advised with MADV_HUGEPAGE and
+ *			committed a whole huge page at a time so that transparent
+ *			huge pages can back it from the first fault
+ *	huge	backed by explicit huge pages (MAP_HUGETLB); needs pages in
+ *			/proc/sys/vm/nr_hugepages
+ *	file	shared mapping of a file that is grown with ftruncate();
+ *			"file:<path>" names the file, otherwise an unlinked temp file.
+ *			A named file keeps its contents, so that the allocator can
+ *			attach to the heap a previous process left in it. It is
+ *			locked while in use; the library falls back to mmap when it
+ *			finds it locked, and forked children get a private copy
+ *	shm		shared memory that several processes map at once, wherever
+ *			it fits in each; "shm:<name>" is a shm_open() object anyone
+ *			can attach to, otherwise a memfd shared with forked children
+ *
+ * Besides the brk heap, the allocator can map extra segments with
+ * mem_map_segment() once mem_sbrk() runs out. Segments are separate
+ * mappings placed above the brk heap, within MAX_SPAN of its base, and
+ * can be handed back to the OS one by one.
  */
+#define _GNU_SOURCE	/* memfd_create */
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
@@ -12,43 +40,411 @@
 #include <string.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <pthread.h>
 #include <unistd.h>
 
 #include "memlib.h"
 #include "config.h"
 
+#ifdef DRIVER
+#define HEAP_RESERVE MAX_HEAP
+#else
+#define HEAP_RESERVE LIB_MAX_HEAP
+#endif
+
+#define HUGE_PAGE (1UL<<21)	/* 2 MB */
+#define MAX_SEGMENTS 256		/* extra segments besides the brk heap */
+#define HEAP_FD_MIN 256			/* lowest descriptor for the heap file */
+#define FILE_HEAP_BASE ((void *)0x600000000000)	/* suggested start */
+
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE 0x100000	/* Linux 4.17; older kernels treat
+										   the address as a hint */
+#endif
+
+/*
+ * A backend reserves the address range for the heap, commits pieces of it
+ * as the brk moves up, and releases the whole range again.
+ */
+typedef struct {
+	const char *name;
+	size_t granule;							/* commit unit, 0 for a page */
+	int seg_flags;							/* extra mmap flags for segments,
+											   -1 if they are not supported */
+	int shared;								/* other processes use the heap */
+	char *(*reserve)(size_t len);			/* NULL on failure */
+	int (*commit)(char *lo, size_t len);	/* -1 on failure */
+	void (*release)(char *base, size_t len);
+} mem_backend_t;
+
 /* private variables */
 static char *heap;
 static char *mem_brk;
 static char *mem_max_addr;
+static char *mem_committed;		/* end of the committed part of the heap */
+
+/* extra heap segments, in no particular order */
+typedef struct {
+	char *lo;
+	size_t size;
+} mem_segment_t;
+
+static mem_segment_t segments[MAX_SEGMENTS];
+static int num_segments;
+static size_t peak_heapsize;	/* segments can go away again */
+
+static const mem_backend_t *backend;
+static char backend_arg[256];	/* text after the ':' in the backend name */
+static int heap_fd = -1;		/* file behind the heap, for file and shm */
+static size_t persisted_size;	/* size of that file when it was opened */
 
 /*
- * mem_init - initialize the memory system model
+ * Backends
  */
-void mem_init(void){
+
+static char *sim_reserve(size_t len) {
 	int dev_zero = open("/dev/zero", O_RDWR);
-	heap = mmap((void *)0x800000000, /* suggested start*/
-			MAX_HEAP,				/* length */
+	char *p = mmap((void *)0x800000000, /* suggested start*/
+			len,					/* length */
 			PROT_WRITE,				/* permissions */
 			MAP_PRIVATE,			/* private or shared? */
 			dev_zero,				/* fd */
 			0);						/* offset (dunno) */
-	mem_max_addr = heap + MAX_HEAP;
+	close(dev_zero);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static int sim_commit(char *lo __attribute__((unused)), size_t len) {
+	// call sbrk() in an attempt to have similar semantics as a real allocator.
+	return sbrk(len) == (void *) -1 ? -1 : 0;
+}
+
+static void unmap_release(char *base, size_t len) {
+	munmap(base, len);
+}
+
+static char *mmap_reserve(size_t len) {
+	char *p = mmap(NULL, len, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static int mprotect_commit(char *lo, size_t len) {
+	return mprotect(lo, len, PROT_READ | PROT_WRITE);
+}
+
+static char *thp_reserve(size_t len) {
+	/* over-reserve, then trim down to a 2 MB aligned range */
+	size_t span;
+	char *p, *base;
+
+	len = (len + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+	span = len + HUGE_PAGE;
+	p = mmap(NULL, span, PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+	if (p == MAP_FAILED)
+		return NULL;
+	base = (char *)(((uintptr_t)p + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+	if (base > p)
+		munmap(p, base - p);
+	munmap(base + len, (p + span) - (base + len));
+
+	/* not fatal: without THP this is just the mmap backend */
+	madvise(base, len, MADV_HUGEPAGE);
+	return base;
+}
+
+static char *huge_reserve(size_t len) {
+	/* hugetlb pages are reserved up front, so this fails cleanly when the
+	 * pool is too small instead of faulting later */
+	len = (len + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1);
+	char *p = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+	return p == MAP_FAILED ? NULL : p;
+}
+
+static int noop_commit(char *lo __attribute__((unused)),
+		size_t len __attribute__((unused))) {
+	return 0;
+}
+
+/* thp and huge round the reservation up to whole huge pages */
+static void huge_release(char *base, size_t len) {
+	munmap(base, (len + HUGE_PAGE - 1) & ~(HUGE_PAGE - 1));
+}
+
+/* keep clear of programs that pick low descriptors for themselves */
+static void move_heap_fd(void) {
+	int fd = fcntl(heap_fd, F_DUPFD_CLOEXEC, HEAP_FD_MIN);
+
+	if (fd >= 0) {
+		close(heap_fd);
+		heap_fd = fd;
+	}
+}
+
+static char *file_reserve(size_t len) {
+	char *p;
+
+	if (backend_arg[0] != '\0') {
+		struct stat st;
+		heap_fd = open(backend_arg, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+		/* one process per heap file */
+		if (heap_fd >= 0 && flock(heap_fd, LOCK_EX | LOCK_NB) < 0) {
+			close(heap_fd);
+			errno = EWOULDBLOCK;
+			return NULL;
+		}
+		if (heap_fd >= 0 && fstat(heap_fd, &st) == 0)
+			persisted_size = (size_t)st.st_size;
+	}
+	else {
+		char name[] = "/tmp/mm-heap.XXXXXX";
+		if ((heap_fd = mkstemp(name)) >= 0)
+			unlink(name);
+	}
+	if (heap_fd < 0)
+		return NULL;
+
+	move_heap_fd();
+
+	/* mapping past EOF is fine as long as nobody touches it. A named file
+	   goes at the same address every time, which keeps pointers stored
+	   in the heap valid, or not at all */
+	p = mmap(FILE_HEAP_BASE, len, PROT_READ | PROT_WRITE,
+			MAP_SHARED | (backend_arg[0] != '\0' ? MAP_FIXED_NOREPLACE : 0),
+			heap_fd, 0);
+	if (p != MAP_FAILED && p != FILE_HEAP_BASE && backend_arg[0] != '\0') {
+		munmap(p, len);		/* old kernel ignored the flag */
+		p = MAP_FAILED;
+		errno = EEXIST;
+	}
+	if (p == MAP_FAILED) {
+		close(heap_fd);
+		heap_fd = -1;
+		return NULL;
+	}
+	return p;
+}
+
+static int file_commit(char *lo, size_t len) {
+	return ftruncate(heap_fd, (off_t)(lo + len - heap));
+}
+
+static void file_release(char *base, size_t len) {
+	munmap(base, len);
+	close(heap_fd);
+	heap_fd = -1;
+}
+
+/*
+ * Until mem_init_done(), the shm object stays flocked, so that only one
+ * process at a time sets up or attaches to the heap in it.
+ */
+static char *shm_reserve(size_t len) {
+	struct stat st;
+	char *p;
+
+	if (backend_arg[0] != '\0')
+		heap_fd = shm_open(backend_arg, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	else
+		heap_fd = memfd_create("mm-heap", MFD_CLOEXEC);
+	if (heap_fd < 0)
+		return NULL;
+	move_heap_fd();
+
+	if (flock(heap_fd, LOCK_EX) < 0 || fstat(heap_fd, &st) < 0 ||
+			(p = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED,
+					  heap_fd, 0)) == MAP_FAILED) {
+		close(heap_fd);
+		heap_fd = -1;
+		return NULL;
+	}
+	persisted_size = (size_t)st.st_size;
+	return p;
+}
+
+/* another process may have grown the object further already */
+static int shm_commit(char *lo, size_t len) {
+	struct stat st;
+
+	if (fstat(heap_fd, &st) < 0)
+		return -1;
+	if ((size_t)st.st_size >= (size_t)(lo + len - heap))
+		return 0;
+	return ftruncate(heap_fd, (off_t)(lo + len - heap));
+}
+
+static const mem_backend_t backends[] = {
+	{ "sim",	0,			0,				0,	sim_reserve,	sim_commit,			unmap_release },
+	{ "mmap",	0,			0,				0,	mmap_reserve,	mprotect_commit,	unmap_release },
+	{ "thp",	HUGE_PAGE,	0,				0,	thp_reserve,	mprotect_commit,	huge_release },
+	{ "huge",	HUGE_PAGE,	MAP_HUGETLB,	0,	huge_reserve,	noop_commit,		huge_release },
+	{ "file",	0,			-1,				0,	file_reserve,	file_commit,		file_release },
+	{ "shm",	0,			-1,				1,	shm_reserve,	shm_commit,			file_release },
+	{ NULL,		0,			0,				0,	NULL,			NULL,				NULL }
+};
+
+/*
+ * mem_set_backend - select the backend used by the next mem_init(). The
+ *		name may carry an argument after a ':'. Returns -1 if unknown.
+ */
+int mem_set_backend(const char *name) {
+	const char *colon = strchr(name, ':');
+	size_t len = colon ? (size_t)(colon - name) : strlen(name);
+	int i;
+
+	for (i = 0; backends[i].name != NULL; i++) {
+		if (strlen(backends[i].name) == len &&
+				strncmp(backends[i].name, name, len) == 0) {
+			backend = &backends[i];
+			backend_arg[0] = '\0';
+			if (colon) {
+				strncpy(backend_arg, colon + 1, sizeof(backend_arg) - 1);
+				backend_arg[sizeof(backend_arg) - 1] = '\0';
+			}
+			return 0;
+		}
+	}
+	return -1;
+}
+
+/*
+ * default_backend - sim for the driver; for the library, whatever
+ *		MM_BACKEND names, falling back to mmap
+ */
+static const mem_backend_t *default_backend(void) {
+#ifdef DRIVER
+	return &backends[0];
+#else
+	/* no stdio or malloc here, getenv is safe */
+	const char *name = getenv("MM_BACKEND");
+	if (name == NULL || mem_set_backend(name) < 0)
+		return &backends[1];
+	return backend;
+#endif
+}
+
+/*
+ * mem_backend_name - name of the selected backend
+ */
+const char *mem_backend_name(void) {
+	if (backend == NULL)
+		backend = default_backend();
+	return backend->name;
+}
+
+/*
+ * mem_backend_names - name of backend i, NULL past the last one
+ */
+const char *mem_backend_names(int i) {
+	return backends[i].name;
+}
+
+/*
+ * A forked child would share a file-backed heap with its parent, and the
+ * two would allocate the same blocks. Around fork(), the parent takes a
+ * private copy of the committed heap, and the child swaps its mapping for
+ * an anonymous one holding that copy and carries on with the mmap backend.
+ * The file and its lock stay with the parent.
+ */
+static char *fork_copy;
+
+static void file_fork_prepare(void) {
+	size_t len = (size_t)(mem_committed - heap);
+
+	fork_copy = NULL;
+	if (heap_fd < 0 || backend->shared || len == 0)
+		return;
+	fork_copy = mmap(NULL, len, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (fork_copy == MAP_FAILED)
+		fork_copy = NULL;
+	else
+		memcpy(fork_copy, heap, len);
+}
+
+static void file_fork_parent(void) {
+	if (fork_copy != NULL)
+		munmap(fork_copy, (size_t)(mem_committed - heap));
+	fork_copy = NULL;
+}
+
+static void file_fork_child(void) {
+	size_t len = (size_t)(mem_committed - heap);
+
+	if (heap_fd < 0 || backend->shared)
+		return;
+	mmap(heap, (size_t)(mem_max_addr - heap), PROT_NONE,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE | MAP_FIXED, -1, 0);
+	if (len > 0) {
+		mprotect(heap, len, PROT_READ | PROT_WRITE);
+		if (fork_copy != NULL) {
+			memcpy(heap, fork_copy, len);
+			munmap(fork_copy, len);
+		}
+	}
+	fork_copy = NULL;
+	/* the flock is on the open file, which the parent still has open, so
+	   closing our copy keeps it with the parent and lets it go with the
+	   parent even if we never exec */
+	close(heap_fd);
+	heap_fd = -1;
+	backend = &backends[1];
+}
+
+/*
+ * mem_init - initialize the memory system model
+ */
+int mem_init(void){
+	if (backend == NULL)
+		backend = default_backend();
+
+	persisted_size = 0;
+	heap = backend->reserve(HEAP_RESERVE);
+#ifndef DRIVER
+	/* the heap file belongs to another process, use a private heap */
+	if (heap == NULL && errno == EWOULDBLOCK) {
+		backend = &backends[1];
+		heap = backend->reserve(HEAP_RESERVE);
+	}
+#endif
+	if (heap == NULL) {
+		mem_max_addr = NULL;
+		mem_brk = mem_committed = NULL;
+		return -1;
+	}
+	mem_max_addr = heap + HEAP_RESERVE;
 	mem_brk = heap;					/* heap is empty initially */
+	mem_committed = heap;
+
+	if (heap_fd >= 0) {
+		static int atfork_done;
+		if (!atfork_done && pthread_atfork(file_fork_prepare,
+				file_fork_parent, file_fork_child) == 0)
+			atfork_done = 1;
+	}
+	return 0;
 }
 
 /*
  * mem_deinit - free the storage used by the memory system model
  */
 void mem_deinit(void){
-	munmap(heap, MAX_HEAP);
+	mem_reset_brk();
+	backend->release(heap, (size_t)(mem_max_addr - heap));
 }
 
 /*
  * mem_reset_brk - reset the simulated brk pointer to make an empty heap
  */
 void mem_reset_brk(){
+	while (num_segments > 0)
+		mem_unmap_segment(segments[0].lo);
 	mem_brk = heap;
+	peak_heapsize = 0;
 }
 
 /*
@@ -59,18 +455,141 @@ void mem_reset_brk(){
 void *mem_sbrk(int incr) {
 	char *old_brk = mem_brk;
 
-    // call sbrk() in an attempt to have similar semantics as a real allocator.
-	if ( (incr < 0) || ((mem_brk + incr) > mem_max_addr) ||
-            sbrk(incr) == (void *) -1) {
+	/* no message: running out here is how an allocator learns to map a
+	   segment, and the driver reports a malloc that fails for good */
+	if ( (heap == NULL) || (incr < 0) || ((mem_brk + incr) > mem_max_addr)) {
 		errno = ENOMEM;
-		fprintf(stderr, "ERROR: mem_sbrk failed. Ran out of memory...\n");
 		return (void *)-1;
 	}
 
+	/* commit whole pages the first time the brk reaches them */
+	if (mem_brk + incr > mem_committed) {
+		size_t unit = backend->granule ? backend->granule : mem_pagesize();
+		char *end = heap + (((mem_brk + incr - heap) + unit - 1)
+				& ~(unit - 1));
+		if (end > mem_max_addr)
+			end = mem_max_addr;
+		if (backend->commit(mem_committed, end - mem_committed) < 0) {
+			errno = ENOMEM;
+#ifdef DRIVER
+			fprintf(stderr, "ERROR: mem_sbrk failed. Could not commit memory...\n");
+#endif
+			return (void *)-1;
+		}
+		mem_committed = end;
+	}
+
 	mem_brk += incr;
+	if (mem_heapsize() > peak_heapsize)
+		peak_heapsize = mem_heapsize();
 	return (void *)old_brk;
 }
 
+/*
+ * mem_map_segment - map a new heap segment of at least size bytes above
+ *		the brk heap. Returns its start, or (void *)-1 if the backend has
+ *		no segments or the span is used up.
+ */
+void *mem_map_segment(size_t size) {
+	size_t unit = backend->granule ? backend->granule : mem_pagesize();
+	char *limit = heap + MAX_SPAN;
+	char *lo = mem_max_addr;
+	int i, tries;
+
+	if (heap == NULL || backend->seg_flags < 0 ||
+			num_segments == MAX_SEGMENTS) {
+		errno = ENOMEM;
+		return (void *)-1;
+	}
+	size = (size + unit - 1) & ~(unit - 1);
+
+	for (tries = 0; tries < MAX_SEGMENTS; tries++) {
+		char *p;
+
+		/* lowest gap above the brk heap that none of our segments use */
+		lo = heap + (((lo - heap) + unit - 1) & ~(unit - 1));
+		for (i = 0; i < num_segments; i++) {
+			if (lo < segments[i].lo + segments[i].size &&
+					segments[i].lo < lo + size) {
+				lo = segments[i].lo + segments[i].size;
+				i = -1;
+			}
+		}
+		if (lo + size > limit)
+			break;
+
+		p = mmap(lo, size, PROT_READ | PROT_WRITE,
+				MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE |
+				backend->seg_flags, -1, 0);
+		if (p == lo) {
+			if (backend->granule)
+				madvise(p, size, MADV_HUGEPAGE);
+			segments[num_segments].lo = p;
+			segments[num_segments].size = size;
+			num_segments++;
+			if (mem_heapsize() > peak_heapsize)
+				peak_heapsize = mem_heapsize();
+			return p;
+		}
+		if (p != MAP_FAILED)		/* old kernel ignored the flag */
+			munmap(p, size);
+		else if (errno != EEXIST)
+			break;
+		lo += size;					/* somebody else lives there */
+	}
+
+	errno = ENOMEM;
+	return (void *)-1;
+}
+
+/*
+ * mem_unmap_segment - give a segment from mem_map_segment back to the OS
+ */
+void mem_unmap_segment(void *lo) {
+	int i;
+
+	for (i = 0; i < num_segments; i++) {
+		if (segments[i].lo == lo) {
+			munmap(segments[i].lo, segments[i].size);
+			segments[i] = segments[--num_segments];
+			return;
+		}
+	}
+}
+
+/*
+ * mem_persisted_size - bytes that were already in the heap file when
+ *		mem_init() opened it; 0 for a new file or any other backend
+ */
+size_t mem_persisted_size(void) {
+	return persisted_size;
+}
+
+/*
+ * mem_init_done - let other processes set up or attach to a shared heap
+ */
+void mem_init_done(void) {
+	if (heap_fd >= 0 && backend->shared)
+		flock(heap_fd, LOCK_UN);
+}
+
+/*
+ * mem_shared - whether other processes can use the heap at the same time
+ */
+int mem_shared(void) {
+	return backend != NULL && backend->shared;
+}
+
+/*
+ * mem_sync - write the brk heap back to its file and wait for it
+ */
+void mem_sync(void) {
+	if (heap_fd < 0)
+		return;
+	msync(heap, (size_t)(mem_brk - heap), MS_SYNC);
+	fsync(heap_fd);
+}
+
 /*
  * mem_heap_lo - return address of the first heap byte
  */
@@ -82,14 +601,76 @@ void *mem_heap_lo(){
  * mem_heap_hi - return address of last heap byte
  */
 void *mem_heap_hi(){
-	return (void *)(mem_brk - 1);
+	char *hi = mem_brk;
+	int i;
+
+	for (i = 0; i < num_segments; i++)
+		if (segments[i].lo + segments[i].size > hi)
+			hi = segments[i].lo + segments[i].size;
+	return (void *)(hi - 1);
 }
 
 /*
  * mem_heapsize() - returns the heap size in bytes
  */
 size_t mem_heapsize() {
-	return (size_t)((uintptr_t)mem_brk - (uintptr_t)heap);
+	size_t size = (size_t)((uintptr_t)mem_brk - (uintptr_t)heap);
+	int i;
+
+	for (i = 0; i < num_segments; i++)
+		size += segments[i].size;
+	return size;
+}
+
+/*
+ * mem_peak_heapsize() - returns the largest the heap has been since the
+ *		last mem_reset_brk(), counting segments that were unmapped since
+ */
+size_t mem_peak_heapsize() {
+	return peak_heapsize;
+}
+
+/*
+ * resident_bytes - bytes of [lo, lo + len) that are in memory; lo is
+ *		page aligned
+ */
+static size_t resident_bytes(char *lo, size_t len) {
+	size_t page = (size_t)getpagesize();
+	size_t pages = (len + page - 1) / page, i, n = 0;
+	unsigned char *vec;
+
+	if (pages == 0 || (vec = malloc(pages)) == NULL)
+		return 0;
+	if (mincore(lo, pages * page, vec) == 0)
+		for (i = 0; i < pages; i++)
+			n += vec[i] & 1;
+	free(vec);
+	return n * page;
+}
+
+/*
+ * mem_resident() - returns how many bytes of the heap, segments
+ *		included, are resident in memory, which is what the heap costs
+ *		the machine however big mem_heapsize() says it is
+ */
+size_t mem_resident() {
+	size_t size;
+	int i;
+
+	if (heap == NULL)
+		return 0;
+	size = resident_bytes(heap, (size_t)(mem_brk - heap));
+	for (i = 0; i < num_segments; i++)
+		size += resident_bytes(segments[i].lo, segments[i].size);
+	return size;
+}
+
+/*
+ * mem_hugepagesize() - returns the huge page size backing the heap, or 0
+ *		if the backend uses normal pages
+ */
+size_t mem_hugepagesize() {
+	return backend != NULL ? backend->granule : 0;
 }
 
 /*
@@ -1,11 +1,24 @@
 #include <unistd.h>
 
-void mem_init(void);               
+int mem_init(void);
 void mem_deinit(void);
 void *mem_sbrk(int incr);
 void mem_reset_brk(void); 
 void *mem_heap_lo(void);
 void *mem_heap_hi(void);
 size_t mem_heapsize(void);
+size_t mem_peak_heapsize(void);
+size_t mem_resident(void);
 size_t mem_pagesize(void);
+size_t mem_hugepagesize(void);
+void *mem_map_segment(size_t size);
+void mem_unmap_segment(void *lo);
+size_t mem_persisted_size(void);
+void mem_sync(void);
+void mem_init_done(void);
+int mem_shared(void);
 
+/* Heap backends (sim, mmap, thp, huge, file, shm), see memlib.c */
+int mem_set_backend(const char *name);
+const char *mem_backend_name(void);
+const char *mem_backend_names(int i);
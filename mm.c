@@ -10,12 +10,15 @@
  */
 
 #include <assert.h>
+#include <errno.h>
+#include <limits.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdint.h>
 #include <string.h>
 #include <unistd.h>
 #include <math.h>
+#include <pthread.h>
 #include "contracts.h"
 
 #include "mm.h"
@@ -56,11 +59,59 @@
 #define CHUNKSIZE (int) 528 //for extend_heap() (in bytes) 
 #define OVERHEAD (int) 16 //Header, footer, prev_free and next_free addresses 
 #define BUCKETS (int) 16 //Number of buckets for seg_list      
+#define LARGE_BLOCK (int) 4096 //Split from the top of a free block on huge pages
+#define SEGSIZE (int) (1<<24) //Minimum size of an extra heap segment (in bytes)
+#define MAX_SEGMENTS (int) 256 //Extra segments besides the brk heap
+#define ROOTSIZE (int) (32*WSIZE) //Space for the heap root (in bytes)
+#define HEAP_MAGIC 0x314d4d48 //"HMM1", marks a heap that mm_attach can use
+
+//Largest request that still fits the int block sizes, with room to round
+//a segment up to whole (huge) pages
+#define MAX_REQUEST (size_t) (INT_MAX - (1<<22))
+
+//Heap root, at the very start of the brk heap. It only holds offsets
+//from ref, so that a file-backed heap still makes sense when it is mapped
+//again at another address (see mm_attach), and a shared one in every
+//process that maps it
+typedef struct {
+    pthread_mutex_t lock; //Process-shared, only used on shared heaps
+    unsigned int magic;
+    unsigned int clean; //Set by mm_detach, cleared while the heap is in use
+    unsigned int heap_start; //Prologue block
+    unsigned int heap_size; //Size of the brk heap (in bytes)
+    unsigned int user_root; //Application's root object, see mm_set_root
+    unsigned int seg_list[BUCKETS]; //Free list heads
+} heap_root_t;
+typedef char root_fits[sizeof(heap_root_t) <= ROOTSIZE ? 1 : -1];
+typedef char buckets_fit[BUCKETS <= MM_STAT_BUCKETS ? 1 : -1];
+
+//Set when other processes use the heap too, see heap_lock()
+static int shared_heap = 0;
+
+//Threads of one process take thread_lock around every heap update. The
+//driver only turns this on for its multithreaded runs (-T)
+static pthread_mutex_t thread_lock = PTHREAD_MUTEX_INITIALIZER;
+#ifdef DRIVER
+static int thread_safe = 0;
+#else
+static int thread_safe = 1;
+#endif
 
 //Pointers to start of heap and start of explicit free list
 char *heap_start = NULL;
-char *ref = (char *) 0x800000000;
-char **seg_list = NULL;
+char *ref = (char *) 0x800000000; //Base for free list offsets, set in mm_init
+heap_root_t *root = NULL;
+unsigned int *seg_list = NULL;
+
+//Extra heap segments mapped once mem_sbrk() runs out, and their sizes
+static char *segments[MAX_SEGMENTS];
+static size_t segment_sizes[MAX_SEGMENTS];
+static int num_segments = 0;
+static int brk_full = 0; //Set once mem_sbrk() has failed
+static char *spare_segment = NULL; //An emptied segment kept mapped, if any
+
+//Set when the heap sits on huge pages, see place()
+static int split_high = 0;
 
 //Block level functions
 
@@ -111,38 +162,53 @@ static inline char* PREV_BLKP(char *bp) {
     return bp - GET_SIZE(HDRP(bp) - WSIZE);
 }
 
+//Free block links and the heap root are stored as unsigned ints counting
+//double words from ref, so every heap segment has to sit within 32 GB of it
+
+//Get address from offset
+static inline char* FROM_OFFSET(unsigned int val) {
+    if(val == (unsigned int) -1) return NULL;
+    return (char *) ref + (size_t) val * DSIZE;
+}
+
+//Get offset from address
+static inline unsigned int TO_OFFSET(char *addr) {
+    if(addr == NULL) return (unsigned int) -1;
+    return (unsigned int) ((addr - ref) / DSIZE);
+}
+
 //Get address of previous free block
 static inline char* GET_PREV_FREE(char *bp) {
-    unsigned int val = *(unsigned int *) bp;
-    if(val == (unsigned int) -1) return NULL;
-    return (char *) ref + val;
+    return FROM_OFFSET(*(unsigned int *) bp);
 }
 
 //Store address of previous free block - as an unsigned int
 static inline void PUT_PREV_FREE(char *bp, char *addr) {
-    unsigned int val;
-    if(addr == NULL) val = (unsigned int) -1;
-    else val = (unsigned int) (addr - ref);
-    * (unsigned int *) bp = val;
+    * (unsigned int *) bp = TO_OFFSET(addr);
     return;
 }
 
 //Get address of next free block
 static inline char* GET_NEXT_FREE(char *bp) {
-    unsigned int val = * (unsigned int *) (bp + WSIZE);
-    if(val == (unsigned int) -1) return NULL;
-    return (char *) ref + val;
+    return FROM_OFFSET(* (unsigned int *) (bp + WSIZE));
 }
 
 //Store address of next free block - as an unsigned int
 static inline void PUT_NEXT_FREE(char *bp, char *addr) {
-    unsigned int val;
-    if(addr == NULL) val = (unsigned int) -1;
-    else val = (unsigned int) (addr - ref);
-    * (unsigned int *) ((char *) bp + WSIZE) = val;
+    * (unsigned int *) ((char *) bp + WSIZE) = TO_OFFSET(addr);
     return;
 }
 
+//Get first block of free list i
+static inline char* GET_LIST(int i) {
+    return FROM_OFFSET(seg_list[i]);
+}
+
+//Store first block of free list i
+static inline void PUT_LIST(int i, char *bp) {
+    seg_list[i] = TO_OFFSET(bp);
+}
+
 //Pack the alloc bit of previous block given the address of the block
 static inline void PACK_PREV_ALLOC(char *p, int alloc) {
     int val;
@@ -164,27 +230,37 @@ static inline int GET_PREV_ALLOC(char *p) {
 
 // Return whether the pointer is in the heap.
 static int in_heap(const void* p) {
-    return p <= mem_heap_hi() && p >= mem_heap_lo();
+    if(p <= mem_heap_hi() && p >= mem_heap_lo()) return 1;
+    for(int i=0;i<num_segments;i++)
+        if((char *) p >= segments[i] && (char *) p < segments[i] + segment_sizes[i])
+            return 1;
+    return 0;
 }
 
 //Print the entire heap - for debug purposes
 void printheap() {
     char *ptr;
-    int i = 0;
+    int i = 0, s;
     ptr = heap_start;
     printf("\nPrinting heap:");
-    while(GET_SIZE(HDRP(ptr)) != 0) {
-        printf("\nBlock%d: \n", i);
-        printf("block address: %p\n", ptr);
-        printf("header address: %p\n", HDRP(ptr));
-        printf("footer address: %p\n", FTRP(ptr));
-        printf("contents of header: %d\n", (int)GET(HDRP(ptr)));
-        printf("contents of footer: %d\n", (int)GET(FTRP(ptr)));
-        printf("size: %d\n", (int)GET_SIZE(HDRP(ptr)));
-        printf("alloc: %d\n", (int)GET_ALLOC(HDRP(ptr)));
-        printf("address of next block: %p\n\n", NEXT_BLKP(ptr));
-        ptr = NEXT_BLKP(ptr);
-        i++;
+    for (s = 0; s <= num_segments; s++) {
+        if(s > 0) {
+            ptr = segments[s-1] + DSIZE;
+            printf("\nSegment %d at %p:", s, segments[s-1]);
+        }
+        while(GET_SIZE(HDRP(ptr)) != 0) {
+            printf("\nBlock%d: \n", i);
+            printf("block address: %p\n", ptr);
+            printf("header address: %p\n", HDRP(ptr));
+            printf("footer address: %p\n", FTRP(ptr));
+            printf("contents of header: %d\n", (int)GET(HDRP(ptr)));
+            printf("contents of footer: %d\n", (int)GET(FTRP(ptr)));
+            printf("size: %d\n", (int)GET_SIZE(HDRP(ptr)));
+            printf("alloc: %d\n", (int)GET_ALLOC(HDRP(ptr)));
+            printf("address of next block: %p\n\n", NEXT_BLKP(ptr));
+            ptr = NEXT_BLKP(ptr);
+            i++;
+        }
     }
 }
 
@@ -192,7 +268,7 @@ void printheap() {
 void printfree() {
     dbg_printf("\nPrinting free list:\n");
     for(int i=0;i<BUCKETS;i++) {
-        char *ptr = seg_list[i];
+        char *ptr = GET_LIST(i);
         if(ptr == NULL) printf("No free blocks in this list.\n");
         while(ptr != NULL) {
             printf("\nBlock: \n");
@@ -238,6 +314,14 @@ int find_index(int size) {
     return BUCKETS - 1;
 }
 
+//Block size that serves a request of size bytes (at most MAX_REQUEST)
+static int adjust_size(size_t size) {
+    int new_size = size + WSIZE; //Adding header overhead
+    new_size = ((new_size + DSIZE - 1) / DSIZE) * DSIZE; //Aligning to 8 bytes
+    if(new_size < OVERHEAD) new_size = OVERHEAD;
+    return new_size;
+}
+
 //Insert a free block at the start of the free list
 static void insert_free(void *bp) {
     dbg_printf("\nEntering insert_free()...\n");
@@ -248,13 +332,14 @@ static void insert_free(void *bp) {
     int seg_index = find_index(size);
     dbg_printf("seg_index: %d\n", seg_index);
 
-    dbg_printf("Address of list: %p\n", seg_list[seg_index]);
+    dbg_printf("Address of list: %p\n", GET_LIST(seg_index));
 
-    PUT_NEXT_FREE(bp, seg_list[seg_index]);
+    char *head = GET_LIST(seg_index);
+    PUT_NEXT_FREE(bp, head);
     PUT_PREV_FREE(bp, NULL);
     
-    if(seg_list[seg_index] != NULL) PUT_PREV_FREE(seg_list[seg_index], bp);
-    seg_list[seg_index] = bp;
+    if(head != NULL) PUT_PREV_FREE(head, bp);
+    PUT_LIST(seg_index, bp);
 
     PACK_PREV_ALLOC(NEXT_BLKP(bp), 0);
     dbg_printf("Updated prev_alloc bit in next block to 0 (free): %d\n", GET_PREV_ALLOC(NEXT_BLKP(bp)));
@@ -262,7 +347,7 @@ static void insert_free(void *bp) {
     PUT(FTRP(bp), GET(HDRP(bp)));
     dbg_printf("Updated footer to reflect new prev_alloc data");
 
-    dbg_printf("New address of list: %p\n", seg_list[seg_index]);    
+    dbg_printf("New address of list: %p\n", GET_LIST(seg_index));    
     dbg_printf("Added block.\n");
     dbg_printf("Exiting insert_free()...\n");
     return;
@@ -279,10 +364,10 @@ static void pop_free(void *bp) {
     int seg_index = find_index(size);
     dbg_printf("seg_index: %d\n", seg_index);
 
-    dbg_printf("Address of list: %p\n", seg_list[seg_index]);
+    dbg_printf("Address of list: %p\n", GET_LIST(seg_index));
     
     if(GET_PREV_FREE(bp) == NULL) {
-        seg_list[seg_index] = GET_NEXT_FREE(bp);
+        PUT_LIST(seg_index, GET_NEXT_FREE(bp));
         dbg_printf("First block. Changed seg_list[seg_index].\n");
     }
     
@@ -383,6 +468,77 @@ static void *coalesce(void *bp) {
     }
 }
 
+//Map an extra heap segment with room for a block of size bytes, once the
+//brk heap cannot grow any more. It is laid out like the brk heap (padding,
+//prologue, blocks, epilogue) and holds a single free block to begin with.
+static void *add_segment(int size) {
+    size_t unit = mem_hugepagesize() ? mem_hugepagesize() : mem_pagesize();
+    size_t segsize = (size_t) size + 4*WSIZE;
+    char *base, *bp;
+
+    dbg_printf("\nEntering add_segment()...\n");
+    if(num_segments == MAX_SEGMENTS) {
+        dbg_printf("Out of segments. Exiting add_segment()...\n");
+        return NULL;
+    }
+    //Grow geometrically so that MAX_SEGMENTS goes a long way
+    if(segsize < SEGSIZE) segsize = SEGSIZE;
+    if(segsize < mem_heapsize() / 4) segsize = mem_heapsize() / 4;
+    segsize = (segsize + unit - 1) & ~(unit - 1);
+
+    if((base = mem_map_segment(segsize)) == (void *)-1) {
+        dbg_printf("mem_map_segment failed. Exiting add_segment()...\n");
+        return NULL;
+    }
+    dbg_printf("Mapped %zu bytes at %p\n", segsize, base);
+
+    PUT(base, 0); //padding
+    PUT(base+WSIZE, PACK(DSIZE, 1)); //prologue header
+    PUT(base+DSIZE, PACK(DSIZE, 1)); //prologue footer
+
+    bp = base + DSIZE + DSIZE;
+    PUT(HDRP(bp), PACK(segsize - 4*WSIZE, 0));
+    PACK_PREV_ALLOC(bp, 1);
+    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1)); //epilogue
+
+    segments[num_segments] = base;
+    segment_sizes[num_segments] = segsize;
+    num_segments++;
+
+    insert_free(bp);
+    dbg_printf("Exiting add_segment()...\n");
+    return bp;
+}
+
+//Whether the segment at base is one free block, as release_segment found it
+static int segment_empty(char *base) {
+    char *bp = base + DSIZE + DSIZE;
+    return !GET_ALLOC(HDRP(bp)) && GET_SIZE(HDRP(NEXT_BLKP(bp))) == 0;
+}
+
+//Unmap an extra segment once a free block covers all of it, unless it is
+//the only empty one: that one is kept, so that a large block malloc'ed and
+//freed over and over doesn't map and unmap a segment every time
+static void release_segment(char *bp) {
+    for(int i=0;i<num_segments;i++) {
+        if(bp == segments[i] + DSIZE + DSIZE) {
+            if(spare_segment == NULL || spare_segment == segments[i] ||
+               !segment_empty(spare_segment)) {
+                dbg_printf("Segment at %p is empty, keeping it\n", segments[i]);
+                spare_segment = segments[i];
+                return;
+            }
+            dbg_printf("Segment at %p is empty, unmapping it\n", segments[i]);
+            pop_free(bp);
+            mem_unmap_segment(segments[i]);
+            num_segments--;
+            segments[i] = segments[num_segments];
+            segment_sizes[i] = segment_sizes[num_segments];
+            return;
+        }
+    }
+}
+
 //Request more heap space when process has run out of space
 static void *extend_heap(int words) {
     char *bp;
@@ -399,9 +555,10 @@ static void *extend_heap(int words) {
     dbg_printf("Rounded up for double-word alignment\n");
 
     dbg_printf("Requesting memory from mem_sbrk...\n");
-    if((bp = mem_sbrk(size)) == (void *)-1) {
-        dbg_printf("mem_sbrk failed. Exiting extend_heap()...\n");
-        return NULL;
+    if(brk_full || (bp = mem_sbrk(size)) == (void *)-1) {
+        dbg_printf("mem_sbrk failed. Adding a segment instead...\n");
+        brk_full = 1;
+        return add_segment(size);
     }
     dbg_printf("mem_sbrk ran well..\n");
     dbg_printf("Obtained new memory at location: %p\n", bp);
@@ -409,12 +566,16 @@ static void *extend_heap(int words) {
     alloc = GET_PREV_ALLOC(bp);
     dbg_printf("prev_alloc: %d\n", alloc);
 
+    //The new epilogue and heap size go in before the old epilogue becomes
+    //the new block's header, so that a file-backed heap that crashes in
+    //between can still be walked by mm_attach
+    PUT(bp + size - WSIZE, PACK(0, 1));
+    dbg_printf("Added epilogue block: %d\n", (int)GET(bp + size - WSIZE));
+    root->heap_size = (unsigned int) (bp + size - (char *) ref);
+
     PUT(HDRP(bp), PACK(size, 0));
     dbg_printf("Added header to new block: %d\n", (int)GET(HDRP(bp)));
     
-    PUT(HDRP(NEXT_BLKP(bp)), PACK(0, 1));
-    dbg_printf("Added epilogue block: %d\n", (int)GET(HDRP(NEXT_BLKP(bp))));
-    
     PACK_PREV_ALLOC(bp, alloc);
     dbg_printf("Restored alloc bit of previous block to %d\n", alloc);
 
@@ -433,7 +594,7 @@ static void *find_fit(int size) {
 
     for(int i=seg_index;i<BUCKETS;i++) {
         dbg_printf("seg_index: %d\n", i);        
-        char *ptr = seg_list[i];
+        char *ptr = GET_LIST(i);
         dbg_printf("Address of list: %p\n", ptr);
         while(ptr != NULL) {
             dbg_printf("\nAddress: %p\n", ptr);
@@ -452,22 +613,35 @@ static void *find_fit(int size) {
     return NULL;
 }
 
-//Allocate the candidate block 
-static void place(void *bp, int size) {
+//Allocate the candidate block, return the allocated block
+//With huge pages, large blocks are carved from the top of the free block so
+//small objects stay packed together in as few huge pages as possible
+static void *place(void *bp, int size) {
     dbg_printf("\nEntering place()...\n");
     dbg_printf("Allocating %d bytes\n", size);
     dbg_printf("Size at bp: %d bytes\n", GET_SIZE(HDRP(bp)));
     dbg_printf("Alloc at bp: %d\n", GET_ALLOC(HDRP(bp)));
     if(GET_ALLOC(HDRP(bp)) || (int)GET_SIZE(HDRP(bp)) < size) {
         dbg_printf("Invalid input. Exiting place()...\n");
-        return;
+        return NULL;
     }
 
     int alloc = GET_PREV_ALLOC(bp);
     dbg_printf("Obtained old prev_alloc of block: %d\n", alloc);
     
     int extra = GET_SIZE(HDRP(bp)) - size;
-    if(extra >= OVERHEAD) {
+    if(extra >= OVERHEAD && split_high && size >= LARGE_BLOCK) {
+        char *ap = (char *) bp + extra;
+        dbg_printf("Splitting block from the top at %p\n", ap);
+        PUT(HDRP(ap), PACK(size, 1));
+        pop_free(bp);
+        PUT(HDRP(bp), PACK(extra, 0));
+        PACK_PREV_ALLOC(bp, alloc);
+        insert_free(bp);
+        dbg_printf("Exiting place()...\n");
+        return ap;
+    }
+    else if(extra >= OVERHEAD) {
         pop_free(bp);
         PUT(HDRP(bp), PACK(size, 1));
         dbg_printf("Updated block header\n");
@@ -494,10 +668,34 @@ static void place(void *bp, int size) {
     }
 
     dbg_printf("Exiting place()...\n");
-    return;
+    return bp;
 }
 
 
+//Allocate a block of new_size bytes (header included), growing the heap
+//if no free block fits
+static void *alloc_block(int new_size) {
+    void *bp;
+    int extend_size;
+
+    if((bp = find_fit(new_size)) != NULL) {
+        bp = place(bp, new_size);
+        dbg_printf("Found new fit and allocated block. Exiting malloc()...\n");
+        return bp;
+    }
+
+    extend_size = (new_size > CHUNKSIZE) ? new_size : CHUNKSIZE;
+    dbg_printf("Extend size: %d\n", extend_size);
+    if((bp = extend_heap(extend_size/WSIZE)) == NULL)
+        return NULL;
+    dbg_printf("Extended heap to accommodate request\n");
+    bp = place(bp, new_size);
+    
+    dbg_printf("Allocated block.\n");
+    dbg_printf("Exiting MALLOC()...\n");
+    return bp;
+}
+
 /*
  *  Malloc Implementation
  *  ---------------------
@@ -511,17 +709,39 @@ int mm_init(void) {
     dbg_printf("\nEntering mm_init()...\n");
     
     seg_list = NULL;
-    //Allocating memory for seg_list
-    if((seg_list = mem_sbrk(32*WSIZE)) == NULL) {
+    ref = mem_heap_lo();
+    num_segments = 0;
+    brk_full = 0;
+    spare_segment = NULL;
+    split_high = mem_hugepagesize() != 0;
+    //Allocating memory for the heap root and seg_list
+    if((root = mem_sbrk(ROOTSIZE)) == (void *)-1) {
         dbg_printf("Error in mem_sbrk. Exiting mm_init...\n");
         return -1;
     }
+    root->magic = 0; //Not usable until it is all set up
+    root->clean = 0;
+    root->user_root = TO_OFFSET(NULL);
+    seg_list = root->seg_list;
+
+    //A robust mutex, so that a process dying with it held does not take
+    //the others down with it
+    shared_heap = mem_shared();
+    if(shared_heap) {
+        pthread_mutexattr_t attr;
+        pthread_mutexattr_init(&attr);
+        pthread_mutexattr_setpshared(&attr, PTHREAD_PROCESS_SHARED);
+        pthread_mutexattr_setrobust(&attr, PTHREAD_MUTEX_ROBUST);
+        pthread_mutex_init(&root->lock, &attr);
+        pthread_mutexattr_destroy(&attr);
+    }
 
     //Clearing BUCKETS elements for the seg_list
-    for(int i=0;i<BUCKETS;i++) seg_list[i] = NULL;
+    for(int i=0;i<BUCKETS;i++) PUT_LIST(i, NULL);
 
     //Allocating memory for heap
-    if((heap_start = mem_sbrk(4*WSIZE)) == NULL) {
+    if((heap_start = mem_sbrk(4*WSIZE)) == (void *)-1) {
+        heap_start = NULL;
         dbg_printf("Error in mem_sbrk. Exiting mm_init...\n");
         return -1;
     }
@@ -541,65 +761,374 @@ int mm_init(void) {
 
     heap_start += DSIZE;
     dbg_printf("Adjusted heap_start pointer\n");
+    root->heap_start = TO_OFFSET(heap_start);
+    root->heap_size = mem_heapsize();
 
     dbg_printf("Extending heap..\n");
     if(extend_heap(CHUNKSIZE/WSIZE) == NULL) {
         dbg_printf("Extending heap failed. Exiting mm_init()...\n");
         return -1;
     }
+    root->magic = HEAP_MAGIC;
+    mem_init_done();
     //checkheap(1);
     dbg_printf("Exiting mm_init() normally...\n");
     return 0;
 }
 
+//Rebuild the free lists from the block headers of a heap that was not
+//detached cleanly: the headers are the only thing we trust. Neighbouring
+//free blocks are merged and prev_alloc bits and footers fixed on the way.
+//Return -1 if the headers do not tile the heap.
+static int recover_heap(void) {
+    char *end = (char *) ref + root->heap_size;
+    char *bp, *run = NULL;
+
+    dbg_printf("\nEntering recover_heap()...\n");
+    if(GET_SIZE(HDRP(heap_start)) != DSIZE || !GET_ALLOC(HDRP(heap_start)))
+        return -1;
+    for(bp = NEXT_BLKP(heap_start); GET_SIZE(HDRP(bp)) != 0;
+        bp = NEXT_BLKP(bp)) {
+        if(GET_SIZE(HDRP(bp)) < OVERHEAD || NEXT_BLKP(bp) > end)
+            return -1;
+    }
+
+    //Died in extend_heap() before the old epilogue was overwritten: the
+    //rest of the heap becomes one free block
+    if(HDRP(bp) < end - WSIZE) {
+        dbg_printf("Reclaiming %d bytes past the old epilogue\n",
+                   (int) (end - WSIZE - HDRP(bp)));
+        PUT(HDRP(bp), PACK(end - WSIZE - HDRP(bp), 0));
+        PUT(end - WSIZE, PACK(0, 1));
+    }
+
+    for(int i=0;i<BUCKETS;i++) PUT_LIST(i, NULL);
+    for(bp = NEXT_BLKP(heap_start); ; bp = NEXT_BLKP(bp)) {
+        int size = GET_SIZE(HDRP(bp));
+        if(size != 0 && !GET_ALLOC(HDRP(bp))) {
+            if(run == NULL) run = bp;
+            continue;
+        }
+        if(run != NULL) {
+            PUT(HDRP(run), PACK(bp - run, 0));
+            PACK_PREV_ALLOC(run, 1);
+            insert_free(run);
+            run = NULL;
+        }
+        else PACK_PREV_ALLOC(bp, 1);
+        if(size == 0) break;
+    }
+    dbg_printf("Exiting recover_heap()...\n");
+    return 0;
+}
+
+//Catch up with the brk that another process has moved
+static void sync_brk(void) {
+    if(root->heap_size > mem_heapsize())
+        mem_sbrk(root->heap_size - mem_heapsize());
+}
+
+//Take the lock that processes sharing the heap use. If its last owner
+//died holding it, the heap may be half updated, so the free lists are
+//rebuilt first. Return -1 if the heap is beyond repair.
+static int heap_lock(void) {
+    if(!shared_heap) {
+        if(thread_safe) pthread_mutex_lock(&thread_lock);
+        //Anything done after mm_detach() makes the heap dirty again
+        if(root->clean) root->clean = 0;
+        return 0;
+    }
+    int rc = pthread_mutex_lock(&root->lock);
+    if(rc == EOWNERDEAD) {
+        dbg_printf("Lock owner died, recovering the heap\n");
+        sync_brk();
+        if(recover_heap() < 0) {
+            //Unlocking without pthread_mutex_consistent() marks the lock
+            //unrecoverable for everybody
+            pthread_mutex_unlock(&root->lock);
+            return -1;
+        }
+        pthread_mutex_consistent(&root->lock);
+    }
+    else if(rc != 0) return -1;
+    sync_brk();
+    return 0;
+}
+
+static void heap_unlock(void) {
+    if(shared_heap) pthread_mutex_unlock(&root->lock);
+    else if(thread_safe) pthread_mutex_unlock(&thread_lock);
+}
+
+/*
+ * mm_set_threadsafe - Turn locking between threads on or off. Only call
+ *                     it while no other thread is using the allocator.
+ */
+void mm_set_threadsafe(int on) {
+    thread_safe = on;
+}
+
+/*
+ * mm_attach - Pick up the heap that an earlier process left behind in a
+ *             file-backed heap, instead of starting a fresh one. If it was
+ *             not detached cleanly, the free lists are rebuilt first.
+ *             Return -1 if there is no usable heap, 0 on success.
+ */
+int mm_attach(void) {
+    dbg_printf("\nEntering mm_attach()...\n");
+    ref = mem_heap_lo();
+    root = (heap_root_t *) ref;
+    num_segments = 0;
+    brk_full = 0;
+    spare_segment = NULL;
+    split_high = mem_hugepagesize() != 0;
+
+    if(mem_persisted_size() < (size_t) ROOTSIZE || root->magic != HEAP_MAGIC ||
+       root->heap_size > mem_persisted_size() ||
+       root->heap_size < (unsigned int) (ROOTSIZE + 4*WSIZE)) {
+        dbg_printf("No heap to attach to. Exiting mm_attach()...\n");
+        return -1;
+    }
+    if(mem_sbrk(root->heap_size) == (void *)-1) return -1;
+
+    seg_list = root->seg_list;
+    heap_start = FROM_OFFSET(root->heap_start);
+    //Other processes may be using a shared heap right now, so it is only
+    //ever repaired under the lock
+    shared_heap = mem_shared();
+    if(shared_heap) {
+        if(heap_lock() < 0) {
+            heap_start = NULL;
+            mem_reset_brk();
+            return -1;
+        }
+        heap_unlock();
+        dbg_printf("Exiting mm_attach()...\n");
+        return 0;
+    }
+    if(!root->clean && recover_heap() < 0) {
+        dbg_printf("Heap is corrupt. Exiting mm_attach()...\n");
+        heap_start = NULL;
+        mem_reset_brk();
+        return -1;
+    }
+    root->clean = 0;
+    dbg_printf("Exiting mm_attach()...\n");
+    return 0;
+}
+
+/*
+ * mm_detach - Flush the heap to its backing file and mark it clean, so
+ *             that the next mm_attach() can trust the free lists. The
+ *             next heap update, if any, marks it dirty again.
+ */
+void mm_detach(void) {
+    if(shared_heap) return; //Others may still be using it
+    if(heap_lock() < 0) return; //Wait out threads still in malloc
+    root->clean = 1;
+    mem_sync();
+    heap_unlock();
+}
+
+#ifndef DRIVER
+/*
+ * lazy_init - Nobody calls mm_init() when we are preloaded into a real
+ *             program, so set up the heap on the first allocation instead.
+ *             heap_ready is only set once the heap is whole, with a
+ *             release store that the unlocked fast path pairs with.
+ */
+static int heap_ready = 0;
+
+//Keep fork() from copying the heap halfway through an update
+static void fork_lock(void) {
+    pthread_mutex_lock(&thread_lock);
+}
+
+static void fork_unlock(void) {
+    pthread_mutex_unlock(&thread_lock);
+}
+
+static int lazy_init(void) {
+    int rc = 0;
+    if(__atomic_load_n(&heap_ready, __ATOMIC_ACQUIRE)) return 0;
+
+    //Two threads can get here on their first malloc
+    pthread_mutex_lock(&thread_lock);
+    if(!heap_ready) {
+        rc = -1;
+        if(mem_init() == 0) {
+            //A heap file with something in it is never silently wiped
+            if(mem_persisted_size() > 0) rc = mm_attach();
+            else rc = mm_init();
+            mem_init_done();
+            if(rc == 0) {
+                pthread_atfork(fork_lock, fork_unlock, fork_unlock);
+                __atomic_store_n(&heap_ready, 1, __ATOMIC_RELEASE);
+            }
+            else {
+                //Start over on the next call, not on a half-built heap
+                heap_start = NULL;
+                mem_deinit();
+            }
+        }
+    }
+    pthread_mutex_unlock(&thread_lock);
+    return rc;
+}
+
+//Leave a file-backed heap clean for the next process
+static void __attribute__((destructor)) lazy_detach(void) {
+    if(heap_ready) mm_detach();
+}
+#endif
+
+/*
+ * mm_set_root/mm_get_root - One pointer that survives a restart, for the
+ *                           application to find its data again.
+ */
+void mm_set_root(void *ptr) {
+#ifndef DRIVER
+    if(lazy_init() < 0) return;
+#endif
+    root->user_root = TO_OFFSET(ptr);
+}
+
+void *mm_get_root(void) {
+#ifndef DRIVER
+    if(lazy_init() < 0) return NULL;
+#endif
+    return FROM_OFFSET(root->user_root);
+}
+
+/*
+ * mm_offset/mm_pointer - Translate between pointers and heap offsets,
+ *                        which mean the same in every process that maps
+ *                        a shared heap, wherever it is mapped.
+ */
+size_t mm_offset(void *ptr) {
+    if(ptr == NULL) return 0;
+    return (char *) ptr - ref;
+}
+
+void *mm_pointer(size_t offset) {
+#ifndef DRIVER
+    if(lazy_init() < 0) return NULL;
+#endif
+    if(offset == 0) return NULL;
+    return (char *) ref + offset;
+}
+
+/*
+ * mm_heapstats - Sum up the free lists, one bucket per list, for the
+ *                driver's fragmentation timeline.
+ */
+void mm_heapstats(mm_heapstats_t *stats) {
+    memset(stats, 0, sizeof(*stats));
+#ifndef DRIVER
+    if(lazy_init() < 0) return;
+#endif
+    if(heap_lock() < 0) return;
+    for(int i=0;i<BUCKETS;i++) {
+        for(char *bp = GET_LIST(i); bp != NULL; bp = GET_NEXT_FREE(bp)) {
+            size_t size = GET_SIZE(HDRP(bp));
+            stats->free_bytes[i] += size;
+            stats->free_blocks++;
+            if(size > stats->largest_free) stats->largest_free = size;
+        }
+    }
+    heap_unlock();
+}
+
+/*
+ * mm_spacestats - Walk the heap for the allocated blocks and the free
+ *                 ones at the top of the brk heap and of each segment,
+ *                 for the driver's space accounting.
+ */
+void mm_spacestats(mm_spacestats_t *stats) {
+    int s;
+
+    memset(stats, 0, sizeof(*stats));
+#ifndef DRIVER
+    if(lazy_init() < 0) return;
+#endif
+    if(heap_lock() < 0) return;
+    for (s = 0; s <= num_segments; s++) {
+        char *bp = s > 0 ? segments[s-1] + DSIZE : heap_start;
+        char *top = NULL; //First of the free blocks that end the area
+
+        for(bp = NEXT_BLKP(bp); GET_SIZE(HDRP(bp)) != 0; bp = NEXT_BLKP(bp)) {
+            if(GET_ALLOC(HDRP(bp))) {
+                stats->alloc_bytes += GET_SIZE(HDRP(bp));
+                stats->alloc_blocks++;
+                top = NULL;
+            }
+            else if(top == NULL) top = bp;
+        }
+        for(; top != NULL && top != bp; top = NEXT_BLKP(top))
+            stats->top_free[find_index(GET_SIZE(HDRP(top)))] +=
+                GET_SIZE(HDRP(top));
+    }
+    heap_unlock();
+}
+
+/*
+ * mm_layout - How malloc turns a request of size bytes into the size of
+ *             the block it looks for.
+ */
+void mm_layout(size_t size, mm_layout_t *layout) {
+    size_t aligned = ((size + WSIZE + DSIZE - 1) / DSIZE) * DSIZE;
+
+    layout->header = WSIZE;
+    layout->padding = aligned - size - WSIZE;
+    layout->bump = aligned < (size_t) OVERHEAD ? OVERHEAD - aligned : 0;
+}
+
+/*
+ * mm_size_class - The seg list a request of size bytes is looked up in,
+ *                 for tracestat.
+ */
+int mm_size_class(size_t size) {
+    if(size > MAX_REQUEST) return BUCKETS - 1;
+    return find_index(adjust_size(size));
+}
+
 /*
  * malloc
  */
 void *malloc (size_t size) {
     dbg_printf("\nEntering MALLOC()...\n");
     dbg_printf("Requested size: %d bytes\n", (int)size);
-    void *bp;
     //checkheap(1);  // Let's make sure the heap is ok!
-    int new_size,extend_size;
+    int new_size;
+
+#ifndef DRIVER
+    if(lazy_init() < 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+#endif
 
-    if((int)size < 0) {
+    if(size > MAX_REQUEST) {
         dbg_printf("Invalid size entered. Exiting malloc()...\n");
+        errno = ENOMEM;
         return NULL;
     }
 
-    new_size = size + WSIZE; //Adding header overhead
-    new_size = ((new_size + DSIZE - 1) / DSIZE) * DSIZE; //Aligning to 8 bytes
-    if(new_size < OVERHEAD) new_size = OVERHEAD;
+    new_size = adjust_size(size);
 
     dbg_printf("Adjusted size. New size: %d bytes\n", new_size);
 
-    if((bp = find_fit(new_size)) != NULL) {
-        place(bp, new_size);
-        dbg_printf("Found new fit and allocated block. Exiting malloc()...\n");
-        return bp;
-    }
-
-    extend_size = (new_size > CHUNKSIZE) ? new_size : CHUNKSIZE;
-    dbg_printf("Extend size: %d\n", extend_size);
-    if((bp = extend_heap(extend_size/WSIZE)) == NULL)
+    if(heap_lock() < 0) {
+        errno = ENOMEM;
         return NULL;
-    dbg_printf("Extended heap to accommodate request\n");
-    place(bp, new_size);
-    
-    dbg_printf("Allocated block.\n");
-    dbg_printf("Exiting MALLOC()...\n");
+    }
+    void *bp = alloc_block(new_size);
+    heap_unlock();
     return bp;
 }
 
-/*
- * free
- */
-void free (void *ptr) {
-    dbg_printf("\nEntering FREE()...\n");
-    if (ptr == NULL) {
-        dbg_printf("NULL ptr. Exiting free()...\n");
-        return;
-    }
+//Free a block, with the heap lock held
+static void free_block(void *ptr) {
     dbg_printf("Requesting to free %p\n", ptr);
     dbg_printf("Size of block: %d\n", GET_SIZE(HDRP(ptr)));
 
@@ -612,8 +1141,26 @@ void free (void *ptr) {
     PACK_PREV_ALLOC(ptr, alloc);
     dbg_printf("Restored old prev_alloc to block.\n");
 
-    coalesce(ptr);
+    ptr = coalesce(ptr);
     dbg_printf("Coalesced neighbouring free blocks\n");
+
+    //Only a block that runs into an epilogue can fill a whole segment
+    if(num_segments && GET_SIZE(HDRP(NEXT_BLKP(ptr))) == 0)
+        release_segment(ptr);
+}
+
+/*
+ * free
+ */
+void free (void *ptr) {
+    dbg_printf("\nEntering FREE()...\n");
+    if (ptr == NULL) {
+        dbg_printf("NULL ptr. Exiting free()...\n");
+        return;
+    }
+    if(heap_lock() < 0) return;
+    free_block(ptr);
+    heap_unlock();
     dbg_printf("Exiting FREE()...\n");
     return;
 }
@@ -646,11 +1193,113 @@ void *realloc(void *oldptr, size_t size) {
  */
 void *calloc (size_t nmemb, size_t size) {
     size_t total = nmemb*size;
+    if(nmemb != 0 && total / nmemb != size) {
+        errno = ENOMEM;
+        return NULL;
+    }
     void *ptr = malloc(total);
-    memset(ptr, 0, total);
+    if(ptr != NULL) memset(ptr, 0, total);
     return ptr;
 }
 
+#ifndef DRIVER
+/*
+ *  Library Shims
+ *  -------------
+ *  The rest of the glibc allocation API, so that nothing a preloaded
+ *  program calls ends up in the libc heap and then in our free().
+ */
+
+/*
+ * memalign - Over-allocate, then hand the misaligned front of the block
+ *            back to the free lists as a block of its own.
+ */
+void *memalign(size_t alignment, size_t size) {
+    if(alignment == 0 || (alignment & (alignment - 1))) {
+        errno = EINVAL;
+        return NULL;
+    }
+    if(alignment <= DSIZE) return malloc(size);
+    if(size > MAX_REQUEST - alignment - OVERHEAD) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    if(lazy_init() < 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+
+    //Header plus room to slide the payload up to the next boundary
+    int new_size = size + WSIZE + alignment + OVERHEAD;
+    new_size = ((new_size + DSIZE - 1) / DSIZE) * DSIZE;
+    if(heap_lock() < 0) {
+        errno = ENOMEM;
+        return NULL;
+    }
+    char *bp = alloc_block(new_size);
+    if(bp == NULL) {
+        heap_unlock();
+        return NULL;
+    }
+    char *ap = bp;
+    if((uintptr_t) bp % alignment) {
+        //Leave room for a minimum-sized free block in front
+        ap = (char *) (((uintptr_t) bp + OVERHEAD + alignment - 1) &
+                       ~(uintptr_t) (alignment - 1));
+        int lead = ap - bp;
+        int total = GET_SIZE(HDRP(bp));
+        int alloc = GET_PREV_ALLOC(bp);
+
+        PUT(HDRP(ap), PACK(total - lead, 1));
+        PACK_PREV_ALLOC(ap, 1);
+        PUT(HDRP(bp), PACK(lead, 1));
+        PACK_PREV_ALLOC(bp, alloc);
+        free_block(bp);
+    }
+
+    //Give back whatever is left past the payload as well
+    int asize = ((size + WSIZE + DSIZE - 1) / DSIZE) * DSIZE;
+    if(asize < OVERHEAD) asize = OVERHEAD;
+    int extra = GET_SIZE(HDRP(ap)) - asize;
+    if(extra >= OVERHEAD) {
+        int alloc = GET_PREV_ALLOC(ap);
+        PUT(HDRP(ap), PACK(asize, 1));
+        PACK_PREV_ALLOC(ap, alloc);
+        PUT(HDRP(NEXT_BLKP(ap)), PACK(extra, 1));
+        PACK_PREV_ALLOC(NEXT_BLKP(ap), 1);
+        free_block(NEXT_BLKP(ap));
+    }
+    heap_unlock();
+    return ap;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size) {
+    if(alignment % sizeof(void *)) return EINVAL;
+    void *ptr = memalign(alignment, size);
+    if(ptr == NULL) return errno;
+    *memptr = ptr;
+    return 0;
+}
+
+void *aligned_alloc(size_t alignment, size_t size) {
+    return memalign(alignment, size);
+}
+
+void *valloc(size_t size) {
+    return memalign(mem_pagesize(), size);
+}
+
+/*
+ * malloc_usable_size - Allocated blocks have no footer, so the payload
+ *                      runs up to the next block's header.
+ */
+size_t malloc_usable_size(void *ptr) {
+    if(ptr == NULL) return 0;
+    return GET_SIZE(HDRP(ptr)) - WSIZE;
+}
+#endif
+
 // Returns 0 if no errors were found, otherwise returns the error
 /* Checkheap() performs the following checks:
 1) Block level:
@@ -664,7 +1313,8 @@ void *calloc (size_t nmemb, size_t size) {
         5. Segregated list contains only blocks that belong to the size class
 3) Heap level:
         1. Prologue/Epilogue blocks are at specific locations (e.g. heap 
-           boundaries)and have special size/alloc fields
+           boundaries)and have special size/alloc fields, in the brk heap
+           and in every extra segment
         2. All blocks stay in between the heap boundaries
 
 Checkheap() does NOT do the following checks:
@@ -674,49 +1324,56 @@ Checkheap() does NOT do the following checks:
 */
 int mm_checkheap(int verbose) {
     char *bp = heap_start;
-    //Check consistency of prologue header.
-    if(GET_SIZE(HDRP(heap_start)) != 8 || !GET_ALLOC(HDRP(heap_start))) {
-        printf("Checkheap: Bad prologue header.\n");
-        printone(heap_start);
-        return(1);
-    }
+    int s;
 
-    //Running through the entire heap.
-    while(GET_SIZE(HDRP(bp)) != 0) {
-        if(verbose) printone(bp);
-        
-        //Check if block pointer is within memory bounds
-        if(!in_heap(bp)) {
-            printf("Checkheap: Block out of memory bounds.\n");
+    //The brk heap first, then every extra segment
+    for (s = 0; s <= num_segments; s++) {
+        if(s > 0) bp = segments[s-1] + DSIZE;
+
+        //Check consistency of prologue header.
+        if(GET_SIZE(HDRP(bp)) != 8 || !GET_ALLOC(HDRP(bp))) {
+            printf("Checkheap: Bad prologue header.\n");
             printone(bp);
             return(1);
         }
-        //Check if payload area is 8-byte aligned
-        if((size_t) bp % 8) {
-            printf("Checkheap: Payload area not double-word aligned.\n");
-            printone(bp);
-            return(1);
+
+        //Running through the entire heap.
+        while(GET_SIZE(HDRP(bp)) != 0) {
+            if(verbose) printone(bp);
+
+            //Check if block pointer is within memory bounds
+            if(!in_heap(bp)) {
+                printf("Checkheap: Block out of memory bounds.\n");
+                printone(bp);
+                return(1);
+            }
+            //Check if payload area is 8-byte aligned
+            if((size_t) bp % 8) {
+                printf("Checkheap: Payload area not double-word aligned.\n");
+                printone(bp);
+                return(1);
+            }
+            //Check if any free blocks are not in the free list
+            if(!GET_ALLOC(HDRP(bp)) && \
+                (!in_heap(GET_NEXT_FREE(bp)) || !in_heap(GET_PREV_FREE(bp)))) {
+                printf("Checkheap: Free block not in the free list.\n");
+                printone(bp);
+                return 1;
+            }
+            bp = NEXT_BLKP(bp);
         }
-        //Check if any free blocks are not in the free list
-        if(!GET_ALLOC(HDRP(bp)) && \
-            (!in_heap(GET_NEXT_FREE(bp)) || !in_heap(GET_PREV_FREE(bp)))) {
-            printf("Checkheap: Free block not in the free list.\n");
+
+        //Check consistency of epilogue header
+        if(GET_SIZE(HDRP(bp)) != 0 || !GET_ALLOC(HDRP(bp))) {
+            printf("Checkheap: Bad epilogue header.\n");
             printone(bp);
-            return 1;
+            return(1);
         }
-        bp = NEXT_BLKP(bp);
-    }
-
-    //Check consistency of epilogue header
-    if(GET_SIZE(HDRP(bp)) != 0 || !GET_ALLOC(HDRP(bp))) {
-        printf("Checkheap: Bad epilogue header.\n");
-        printone(bp);
-        return(1);
     }
 
     //Running through the entire free list.
     for(int i=0;i<BUCKETS;i++) {
-        char *ptr = seg_list[i];
+        char *ptr = GET_LIST(i);
         while(ptr != NULL) {
             //Check if headers and footers match
             if(GET(HDRP(bp)) != GET(FTRP(bp))) {
@@ -747,8 +1404,8 @@ int mm_checkheap(int verbose) {
 
     //Check for cycles in free lists (using hare and tortoise algorithm)
     for(int i=0;i<BUCKETS;i++) {
-        char *hare = GET_NEXT_FREE(seg_list[i]);
-        char *tortoise = seg_list[i];
+        char *tortoise = GET_LIST(i);
+        char *hare = tortoise ? GET_NEXT_FREE(tortoise) : NULL;
         while(tortoise != NULL) {
             if(tortoise == hare) {
                 printf("Found cycles in the free list\n");
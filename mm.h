@@ -16,10 +16,72 @@ extern void free (void *ptr);
 extern void *realloc(void *ptr, size_t size);
 extern void *calloc (size_t nmemb, size_t size);
 
+/* glibc extensions that real programs expect to find alongside malloc */
+extern void *memalign(size_t alignment, size_t size);
+extern int posix_memalign(void **memptr, size_t alignment, size_t size);
+extern void *aligned_alloc(size_t alignment, size_t size);
+extern void *valloc(size_t size);
+extern size_t malloc_usable_size(void *ptr);
+
 #endif
 
 extern int mm_init(void);
 
+/* lock around heap updates so that several threads can use the heap */
+extern void mm_set_threadsafe(int on);
+
+/* file-backed heaps: reopen a heap from an earlier run, mark it clean on
+   the way out, and keep one pointer for finding things in it again */
+extern int mm_attach(void);
+extern void mm_detach(void);
+extern void mm_set_root(void *ptr);
+extern void *mm_get_root(void);
+
+/* shared heaps: hand blocks to other processes as offsets into the heap */
+extern size_t mm_offset(void *ptr);
+extern void *mm_pointer(size_t offset);
+
+/* heap introspection, for the driver's fragmentation timeline (-F)
+   and space accounting (-O): free_bytes[i] counts the free blocks of
+   up to 2^i bytes that aren't in a lower bucket, and the last bucket
+   all bigger ones too */
+#define MM_STAT_BUCKETS 16
+
+typedef struct mm_heapstats {
+    size_t free_bytes[MM_STAT_BUCKETS];
+    size_t free_blocks;
+    size_t largest_free; /* size of the largest free block */
+} mm_heapstats_t;
+
+extern void mm_heapstats(mm_heapstats_t *stats);
+
+/* what only a walk of the whole heap finds, for -O alone: -F takes
+   mm_heapstats at every sample, and that only walks the free lists */
+typedef struct mm_spacestats {
+    size_t alloc_bytes;  /* allocated blocks, headers and all */
+    size_t alloc_blocks;
+    /* the free blocks ending the heap or a segment, by bucket as in
+       free_bytes: the wilderness, never used or given back since */
+    size_t top_free[MM_STAT_BUCKETS];
+} mm_spacestats_t;
+
+extern void mm_spacestats(mm_spacestats_t *stats);
+
+/* how malloc makes the block size it looks for out of a request: the
+   request, a header, padding up to the alignment, and a bump up to the
+   smallest block.  The block it finds can be bigger still. */
+typedef struct mm_layout {
+    size_t header;
+    size_t padding;
+    size_t bump;
+} mm_layout_t;
+
+extern void mm_layout(size_t size, mm_layout_t *layout);
+
+/* the bucket of the free lists (0 to MM_STAT_BUCKETS - 1) that a
+   request of size bytes is served from, for tracestat */
+extern int mm_size_class(size_t size);
+
 /* This is largely for debugging.  You can do what you want with the
    verbose flag; we don't care. */
 extern int mm_checkheap(int verbose);
@@ -65,12 +65,12 @@ char *heap_start;
  */
 
 // Align p to a multiple of w bytes
-static inline void* align(const void const* p, unsigned char w) {
+static inline void* align(const void* p, unsigned char w) {
     return (void*)(((uintptr_t)(p) + (w-1)) & ~(w-1));
 }
 
 // Check if the given pointer is 8-byte aligned
-static inline int aligned(const void const* p) {
+static inline int aligned(const void* p) {
     return align(p, 8) == p;
 }
 
@@ -0,0 +1,340 @@
+/*
+ * mmbench.c - time single paths through the malloc package
+ *
+ *   mmbench [-b <backend>] [-p <prefix>] [-R <n>]
+ *
+ * A trace replay mixes every path through mm.c, so a change to
+ * find_fit, place or coalesce shows only as a small shift in the Kops
+ * of a few traces.  mmbench instead times small fixed patterns, each
+ * of which leans on one path, on a fresh heap:
+ *
+ *   pair/<size>      malloc and free one block, over and over, with a
+ *                    size in each of the free list classes
+ *   lifo/<size>      malloc a batch of blocks, free them newest first
+ *   fifo/<size>      the same, freeing them oldest first
+ *   realloc/<step>   grow one block by step bytes at a time
+ *   realloc2/<step>  grow two blocks in turn, so that they get in
+ *                    each other's way
+ *   calloc/<size>    calloc and free large blocks
+ *   scan/<size>      malloc from a class whose free list is long and
+ *                    holds no block big enough, so find_fit walks it all
+ *   coalesce/<size>  free blocks whose neighbours are both free
+ *
+ * Each pattern runs once to warm up, then -R times (default 30).  What
+ * it needs on the heap beforehand isn't timed; the rest is, by the
+ * cycle counter, and each run gives one sample of cycles per request.
+ * The table has the median of the samples and a 95% bootstrap
+ * confidence interval for it: two builds differ on a pattern when
+ * their intervals don't overlap.  Its class is the free list
+ * (mm_size_class) of the size in the pattern's name.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "mm.h"
+#include "memlib.h"
+#include "clock.h"
+#include "regress.h"
+
+#define DEFAULT_SAMPLES 30
+#define CI_LEVEL        0.95
+
+#define PAIRS      10000   /* malloc/free pairs per pair run */
+#define BATCH      1000    /* blocks in a lifo or fifo batch */
+#define BATCHES    10      /* batches per lifo or fifo run */
+#define GROW_TO    65536   /* realloc grows blocks up to this size */
+#define CALLOCS    100     /* blocks per calloc run */
+#define MAX_BLOCKS 4096    /* blocks a pattern keeps at once */
+#define SCAN_FREE  2048    /* free blocks in front of each scan */
+#define SCANS      200     /* mallocs per scan run */
+
+/* One pattern, for requests of size bytes */
+typedef struct bench {
+    const char *name;
+    size_t size;
+    void (*setup)(const struct bench *b);  /* untimed; may be NULL */
+    long (*run)(const struct bench *b);    /* timed; returns requests */
+} bench_t;
+
+static void *blocks[MAX_BLOCKS];
+
+/* checked - A block the pattern asked for, or a way out if there's none */
+static void *checked(const bench_t *b, void *p)
+{
+    if (p == NULL) {
+        fprintf(stderr, "mmbench: %s/%zu: out of memory\n", b->name,
+                b->size);
+        exit(1);
+    }
+    return p;
+}
+
+static long run_pair(const bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < PAIRS; i++)
+        mm_free(checked(b, mm_malloc(b->size)));
+    return 2L * PAIRS;
+}
+
+static long run_lifo(const bench_t *b)
+{
+    int i, k;
+
+    for (k = 0; k < BATCHES; k++) {
+        for (i = 0; i < BATCH; i++)
+            blocks[i] = checked(b, mm_malloc(b->size));
+        for (i = BATCH - 1; i >= 0; i--)
+            mm_free(blocks[i]);
+    }
+    return 2L * BATCHES * BATCH;
+}
+
+static long run_fifo(const bench_t *b)
+{
+    int i, k;
+
+    for (k = 0; k < BATCHES; k++) {
+        for (i = 0; i < BATCH; i++)
+            blocks[i] = checked(b, mm_malloc(b->size));
+        for (i = 0; i < BATCH; i++)
+            mm_free(blocks[i]);
+    }
+    return 2L * BATCHES * BATCH;
+}
+
+static long run_realloc(const bench_t *b)
+{
+    void *p = checked(b, mm_malloc(b->size));
+    size_t size;
+    long ops = 2;
+
+    for (size = 2 * b->size; size <= GROW_TO; size += b->size, ops++)
+        p = checked(b, mm_realloc(p, size));
+    mm_free(p);
+    return ops;
+}
+
+static long run_realloc2(const bench_t *b)
+{
+    void *p = checked(b, mm_malloc(b->size));
+    void *q = checked(b, mm_malloc(b->size));
+    size_t size;
+    long ops = 4;
+
+    for (size = 2 * b->size; size <= GROW_TO; size += b->size, ops += 2) {
+        p = checked(b, mm_realloc(p, size));
+        q = checked(b, mm_realloc(q, size));
+    }
+    mm_free(p);
+    mm_free(q);
+    return ops;
+}
+
+static long run_calloc(const bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < CALLOCS; i++)
+        mm_free(checked(b, mm_calloc(1, b->size)));
+    return 2L * CALLOCS;
+}
+
+/*
+ * setup_scan - Fill b->size's free list with SCAN_FREE blocks a little
+ *     too small for it: a row of them, every other one freed.  The
+ *     chunks the heap grows by leave free gaps in the row, which would
+ *     merge with the freed blocks, so small blocks go into the gaps
+ *     first, until the only free block is the one ending the heap.
+ */
+static void setup_scan(const bench_t *b)
+{
+    size_t small = b->size - b->size / 8;
+    mm_heapstats_t heap;
+    size_t k;
+    int i;
+
+    for (i = 0; i < 2 * SCAN_FREE; i++)
+        blocks[i] = checked(b, mm_malloc(small));
+    for (mm_heapstats(&heap); heap.free_blocks > 1; mm_heapstats(&heap))
+        for (k = heap.free_blocks - 1; k > 0; k--)
+            checked(b, mm_malloc(1));
+    for (i = 0; i < 2 * SCAN_FREE; i += 2)
+        mm_free(blocks[i]);
+}
+
+/* run_scan - The blocks are kept, or the next malloc would find one */
+static long run_scan(const bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < SCANS; i++)
+        checked(b, mm_malloc(b->size));
+    return SCANS;
+}
+
+/* setup_coalesce - A row of blocks with every other one free */
+static void setup_coalesce(const bench_t *b)
+{
+    int i;
+
+    for (i = 0; i < MAX_BLOCKS; i++)
+        blocks[i] = checked(b, mm_malloc(b->size));
+    for (i = 0; i < MAX_BLOCKS - 1; i += 2)
+        mm_free(blocks[i]);
+}
+
+/* run_coalesce - Free the rest, but the last, which keeps the row off
+   the end of the heap */
+static long run_coalesce(const bench_t *b __attribute__((unused)))
+{
+    int i;
+
+    for (i = 1; i < MAX_BLOCKS - 1; i += 2)
+        mm_free(blocks[i]);
+    return MAX_BLOCKS / 2 - 1;
+}
+
+/* Sizes fill blocks of 2^k bytes, the largest of class k */
+static const bench_t benches[] = {
+    { "pair", 12, NULL, run_pair },
+    { "pair", 28, NULL, run_pair },
+    { "pair", 60, NULL, run_pair },
+    { "pair", 124, NULL, run_pair },
+    { "pair", 252, NULL, run_pair },
+    { "pair", 508, NULL, run_pair },
+    { "pair", 1020, NULL, run_pair },
+    { "pair", 2044, NULL, run_pair },
+    { "pair", 4092, NULL, run_pair },
+    { "pair", 8188, NULL, run_pair },
+    { "pair", 16380, NULL, run_pair },
+    { "pair", 32764, NULL, run_pair },
+    { "lifo", 28, NULL, run_lifo },
+    { "lifo", 252, NULL, run_lifo },
+    { "lifo", 4092, NULL, run_lifo },
+    { "fifo", 28, NULL, run_fifo },
+    { "fifo", 252, NULL, run_fifo },
+    { "fifo", 4092, NULL, run_fifo },
+    { "realloc", 16, NULL, run_realloc },
+    { "realloc", 256, NULL, run_realloc },
+    { "realloc2", 16, NULL, run_realloc2 },
+    { "realloc2", 256, NULL, run_realloc2 },
+    { "calloc", 65536, NULL, run_calloc },
+    { "calloc", 1 << 20, NULL, run_calloc },
+    { "scan", 252, setup_scan, run_scan },
+    { "scan", 4092, setup_scan, run_scan },
+    { "coalesce", 28, setup_coalesce, run_coalesce },
+    { "coalesce", 1020, setup_coalesce, run_coalesce },
+};
+
+#define NUM_BENCHES ((int)(sizeof(benches) / sizeof(*benches)))
+
+/*
+ * sample - Run b once on a fresh heap and return its cycles per request
+ */
+static double sample(const bench_t *b)
+{
+    unsigned long long start;
+    long ops;
+
+    mem_reset_brk();
+    if (mm_init() < 0) {
+        fprintf(stderr, "mmbench: mm_init failed\n");
+        exit(1);
+    }
+    if (b->setup != NULL)
+        b->setup(b);
+    start = read_counter();
+    ops = b->run(b);
+    return (double)(read_counter() - start) / ops;
+}
+
+static void usage(void)
+{
+    int i;
+
+    fprintf(stderr, "Usage: mmbench [-h] [-b <backend>] [-p <prefix>] [-R <n>]\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-b <name>  Heap backend:");
+    for (i = 0; mem_backend_names(i) != NULL; i++)
+        fprintf(stderr, " %s", mem_backend_names(i));
+    fprintf(stderr, " (default sim).\n");
+    fprintf(stderr, "\t-p <name>  Run only the patterns whose names start with <name>.\n");
+    fprintf(stderr, "\t-R <n>     Time each pattern <n> times (default %d).\n",
+            DEFAULT_SAMPLES);
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *prefix = "";
+    char name[64];
+    double *samples, lo, hi;
+    int c, i, k, num_samples = DEFAULT_SAMPLES;
+
+    while ((c = getopt(argc, argv, "b:p:R:h")) != EOF) {
+        switch (c) {
+        case 'b':
+            if (mem_set_backend(optarg) < 0) {
+                fprintf(stderr, "Unknown memory backend %s\n", optarg);
+                usage();
+                exit(1);
+            }
+            break;
+        case 'p':
+            prefix = optarg;
+            break;
+        case 'R':
+            if ((num_samples = atoi(optarg)) < 1) {
+                fprintf(stderr, "-R takes a number of runs above 0\n");
+                exit(1);
+            }
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind != argc) {
+        usage();
+        exit(1);
+    }
+
+    if (mem_init() < 0) {
+        fprintf(stderr, "mmbench: mem_init failed for the %s backend\n",
+                mem_backend_name());
+        exit(1);
+    }
+    if ((samples = malloc(num_samples * sizeof(*samples))) == NULL) {
+        fprintf(stderr, "mmbench: out of memory\n");
+        exit(1);
+    }
+    mhz(1);
+    printf("Cycles per request, median of %d runs and its %.0f%% interval\n",
+           num_samples, CI_LEVEL * 100);
+    printf("%-16s %5s %10s  %s\n", "pattern", "class", "cycles", "interval");
+
+    for (i = 0; i < NUM_BENCHES; i++) {
+        snprintf(name, sizeof(name), "%s/%zu", benches[i].name,
+                 benches[i].size);
+        if (strncmp(name, prefix, strlen(prefix)) != 0)
+            continue;
+        sample(&benches[i]);
+        for (k = 0; k < num_samples; k++)
+            samples[k] = sample(&benches[i]);
+        bootstrap_median(samples, num_samples, CI_LEVEL, &lo, &hi);
+        printf("%-16s %5d %10.1f  %.1f - %.1f\n", name,
+               mm_size_class(benches[i].size),
+               sample_median(samples, num_samples), lo, hi);
+        fflush(stdout);
+    }
+    free(samples);
+    mem_deinit();
+    return 0;
+}
@@ -0,0 +1,139 @@
+/*
+ * perfctr.c - hardware performance counters, through perf_event_open
+ */
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "perfctr.h"
+
+#ifdef __linux__
+#include <stdint.h>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+const char *perf_names[PERF_COUNTERS] = {
+    "cycles", "instrs", "L1D-miss", "LLC-miss", "dTLB-miss", "br-miss"
+};
+
+#ifdef __linux__
+
+#define CACHE_MISS(cache) ((cache) | (PERF_COUNT_HW_CACHE_OP_READ << 8) | \
+                           (PERF_COUNT_HW_CACHE_RESULT_MISS << 16))
+
+/* perf_event_attr type and config of each counter */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+} events[PERF_COUNTERS] = {
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_L1D) },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_LL) },
+    { PERF_TYPE_HW_CACHE, CACHE_MISS(PERF_COUNT_HW_CACHE_DTLB) },
+    { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+};
+
+int perf_open(perfctr_t *pc)
+{
+    struct perf_event_attr attr;
+    int i, n = 0, err = 0;
+
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED |
+            PERF_FORMAT_TOTAL_TIME_RUNNING;
+        pc->fd[i] = syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+        if (pc->fd[i] >= 0)
+            n++;
+        else if (err == 0)
+            err = errno;
+    }
+    if (n == 0) {
+        errno = err;
+        return -1;
+    }
+    return n;
+}
+
+void perf_close(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++)
+        if (pc->fd[i] >= 0)
+            close(pc->fd[i]);
+}
+
+void perf_start(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++)
+        if (pc->fd[i] >= 0) {
+            ioctl(pc->fd[i], PERF_EVENT_IOC_RESET, 0);
+            ioctl(pc->fd[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+}
+
+/*
+ * perf_stop - Read the counters.  When there are more counters than
+ *     the PMU has registers, the kernel takes turns with them; scale
+ *     each count up by the share of the time it was running.
+ */
+void perf_stop(perfctr_t *pc, double counts[PERF_COUNTERS])
+{
+    uint64_t val[3];    /* value, time enabled, time running */
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++)
+        if (pc->fd[i] >= 0)
+            ioctl(pc->fd[i], PERF_EVENT_IOC_DISABLE, 0);
+    for (i = 0; i < PERF_COUNTERS; i++) {
+        counts[i] = -1;
+        if (pc->fd[i] < 0 || read(pc->fd[i], val, sizeof(val)) != sizeof(val))
+            continue;
+        if (val[2] == 0)
+            continue;
+        counts[i] = val[2] < val[1] ? (double)val[0] * val[1] / val[2] : val[0];
+    }
+}
+
+#else /* !__linux__ */
+
+int perf_open(perfctr_t *pc)
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++)
+        pc->fd[i] = -1;
+    errno = ENOSYS;
+    return -1;
+}
+
+void perf_close(perfctr_t *pc __attribute__((unused)))
+{
+}
+
+void perf_start(perfctr_t *pc __attribute__((unused)))
+{
+}
+
+void perf_stop(perfctr_t *pc __attribute__((unused)),
+               double counts[PERF_COUNTERS])
+{
+    int i;
+
+    for (i = 0; i < PERF_COUNTERS; i++)
+        counts[i] = -1;
+}
+
+#endif /* __linux__ */
@@ -0,0 +1,33 @@
+#ifndef __PERFCTR_H_
+#define __PERFCTR_H_
+
+/*
+ * perfctr.h - hardware performance counters, through perf_event_open
+ *
+ * Counts the driver's own user-mode events between perf_start() and
+ * perf_stop().  Counters the CPU, kernel or VM doesn't offer are left
+ * out, and read back as -1.
+ */
+
+/* The counters, in the order perf_names lists them */
+enum {
+    PERF_CYCLES, PERF_INSTRUCTIONS, PERF_L1D_MISSES, PERF_LLC_MISSES,
+    PERF_DTLB_MISSES, PERF_BRANCH_MISSES, PERF_COUNTERS
+};
+
+extern const char *perf_names[PERF_COUNTERS];
+
+typedef struct {
+    int fd[PERF_COUNTERS];     /* -1 if the counter isn't available */
+} perfctr_t;
+
+/* Open the counters; returns how many could be, or -1 with errno set
+   if none could */
+int perf_open(perfctr_t *pc);
+void perf_close(perfctr_t *pc);
+
+/* Zero and start the counters, then stop and read them into counts */
+void perf_start(perfctr_t *pc);
+void perf_stop(perfctr_t *pc, double counts[PERF_COUNTERS]);
+
+#endif /* __PERFCTR_H_ */
@@ -0,0 +1,30 @@
+/*
+ * plugin.c - export an mm.c-style malloc package to the driver
+ *
+ * Built into a shared object along with the package, compiled with
+ * -DDRIVER and hidden visibility, this table is the only symbol the
+ * object exports.  The package's calls to mem_sbrk() and friends go to
+ * the driver's own memlib, so that it runs on the same heap as mm.c.
+ * mm_heapstats, mm_spacestats and mm_layout are optional: the weak,
+ * hidden references are NULL if the package doesn't define them, rather
+ * than binding to the driver's.
+ */
+#include "allocator.h"
+#include "mm.h"
+
+extern void mm_heapstats(mm_heapstats_t *stats)
+    __attribute__((weak, visibility("hidden")));
+extern void mm_spacestats(mm_spacestats_t *stats)
+    __attribute__((weak, visibility("hidden")));
+extern void mm_layout(size_t size, mm_layout_t *layout)
+    __attribute__((weak, visibility("hidden")));
+
+#ifndef PLUGIN_NAME
+#define PLUGIN_NAME "mm"
+#endif
+
+__attribute__((visibility("default")))
+const allocator_t mm_allocator_table = {
+    PLUGIN_NAME, mm_init, mm_malloc, mm_free, mm_realloc, mm_calloc,
+    mm_checkheap, mm_heapstats, mm_spacestats, mm_layout
+};
@@ -0,0 +1,688 @@
+/*
+ * recorder.c - record the allocations of a real program as a trace
+ *
+ *   unix> LD_PRELOAD=./librecord.so MM_RECORD=ls.rep ls -l
+ *
+ * Every malloc, free, realloc, calloc, memalign, posix_memalign,
+ * aligned_alloc and valloc call is passed on to the real allocator and
+ * logged.  When the program exits, the log is turned into a trace that
+ * mdriver can replay: block ids are handed out in allocation order, and
+ * the header gives their number and the number of requests.  A name
+ * ending in .bin (TRACE_CACHE) gets the binary form instead of text.
+ * The default name is mmrec.%p.rep; %p in the name becomes the pid, so
+ * that programs the recorded one execs write their own traces.
+ *
+ * Logging has to be cheap and can't take locks, so each thread appends
+ * events to a buffer of its own.  Full buffers are pushed onto a
+ * lock-free list that a flusher thread writes out to a scratch file
+ * every FLUSH_NSECS.  A global counter numbers the events, so that the
+ * scratch file can be put back in order at the end: a free is numbered
+ * before the block is handed back and an allocation after it returns,
+ * so a block is never reused before it is freed.  realloc logs both,
+ * as a REALLOC_START and a REALLOC_END event.
+ *
+ * Only the process that was started records; forked children don't,
+ * and alignments are not kept (memalign comes out as "a id size").
+ */
+#define _GNU_SOURCE
+#include <dlfcn.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "trace.h"
+
+#define BUF_EVENTS   (1 << 16)  /* events in one thread buffer */
+#define MAX_THREADS  1024       /* threads that can record at once */
+#define FLUSH_NSECS  10000000   /* how often the flusher looks for buffers */
+#define BOOT_SIZE    (1 << 16)  /* heap for dlsym() before we have malloc */
+#define DEFAULT_OUT  "mmrec.%p.rep"
+
+/* Event types */
+enum { EV_NONE, EV_ALLOC, EV_FREE, EV_REALLOC_START, EV_REALLOC_END };
+
+/* One logged call */
+typedef struct {
+    uint64_t seq;         /* place in the global order */
+    uint64_t ptr;         /* block allocated, freed or reallocated */
+    uint64_t size;        /* requested size */
+    uint64_t start;       /* REALLOC_END: seq of its REALLOC_START */
+    uint32_t type;
+    uint32_t pad;
+} event_t;
+
+/* A thread's log; events up to count are complete */
+typedef struct buf {
+    struct buf *next;     /* on the full list */
+    unsigned count;
+    event_t ev[BUF_EVENTS];
+} buf_t;
+
+/* A recording thread */
+typedef struct {
+    int used;
+    buf_t *cur;           /* buffer being filled */
+} thread_t;
+
+/* The real allocator */
+static void *(*real_malloc)(size_t);
+static void (*real_free)(void *);
+static void *(*real_realloc)(void *, size_t);
+static void *(*real_calloc)(size_t, size_t);
+static void *(*real_memalign)(size_t, size_t);
+static int (*real_posix_memalign)(void **, size_t, size_t);
+static void *(*real_aligned_alloc)(size_t, size_t);
+static void *(*real_valloc)(size_t);
+
+/* Allocations made while dlsym() looks up the functions above */
+static char boot_heap[BOOT_SIZE] __attribute__((aligned(16)));
+static size_t boot_used;
+
+static int recording;                  /* log calls */
+static uint64_t next_seq;              /* events numbered so far */
+static buf_t *full_bufs;               /* waiting for the flusher */
+static thread_t threads[MAX_THREADS];
+static uint64_t dropped;               /* events no thread slot could take */
+static int scratch_fd = -1;            /* the flushed events */
+static uint64_t scratch_events;
+static pthread_t flusher;
+static int stop_flusher;
+static pthread_key_t thread_key;
+static char out_name[TRACE_NAMELEN];
+
+static __thread int busy;              /* the recorder is allocating */
+static __thread thread_t *self;
+
+/*****************
+ * Logging
+ *****************/
+
+static buf_t *new_buf(void)
+{
+    buf_t *b = mmap(NULL, sizeof(buf_t), PROT_READ | PROT_WRITE,
+                    MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (b == MAP_FAILED)
+        return NULL;
+    b->count = 0;
+    return b;
+}
+
+/* Push a buffer onto the full list; only the flusher takes them off */
+static void push_full(buf_t *b)
+{
+    buf_t *head = __atomic_load_n(&full_bufs, __ATOMIC_RELAXED);
+
+    do {
+        b->next = head;
+    } while (!__atomic_compare_exchange_n(&full_bufs, &head, b, 1,
+                                          __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+/* Hand a thread's last buffer over when it exits */
+static void thread_exit(void *ptr)
+{
+    thread_t *t = ptr;
+    /* cur is emptied first, as in record, so that recorder_fini can't
+       find the buffer there once it is on the full list */
+    buf_t *b = __atomic_exchange_n(&t->cur, NULL, __ATOMIC_ACQ_REL);
+
+    if (b != NULL)
+        push_full(b);
+    self = NULL;
+    __atomic_store_n(&t->used, 0, __ATOMIC_RELEASE);
+}
+
+/* Find this thread a slot */
+static thread_t *get_self(void)
+{
+    int i;
+
+    if (self != NULL)
+        return self;
+    for (i = 0; i < MAX_THREADS; i++) {
+        int unused = 0;
+        if (__atomic_compare_exchange_n(&threads[i].used, &unused, 1, 0,
+                                        __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            self = &threads[i];
+            pthread_setspecific(thread_key, self);
+            return self;
+        }
+    }
+    return NULL;
+}
+
+static uint64_t take_seq(void)
+{
+    return __atomic_fetch_add(&next_seq, 1, __ATOMIC_RELAXED);
+}
+
+/*
+ * record - Log one event.  Only this thread writes to its buffer; the
+ *          count is published last, so that whoever reads the buffer
+ *          sees whole events.
+ */
+static void record(uint64_t seq, int type, void *ptr, size_t size,
+                   uint64_t start)
+{
+    thread_t *t;
+    buf_t *b;
+    event_t *e;
+
+    busy = 1;
+    if ((t = get_self()) == NULL) {
+        __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+        busy = 0;
+        return;
+    }
+    b = __atomic_load_n(&t->cur, __ATOMIC_ACQUIRE);
+    if (b == NULL || b->count == BUF_EVENTS) {
+        /* the new buffer goes in before the full one goes on the list,
+           so the two never hold the same buffer; if recorder_fini took
+           the full one meanwhile, it has written it already */
+        buf_t *full;
+
+        b = new_buf();
+        full = __atomic_exchange_n(&t->cur, b, __ATOMIC_ACQ_REL);
+        if (full != NULL)
+            push_full(full);
+        if (b == NULL) {
+            __atomic_fetch_add(&dropped, 1, __ATOMIC_RELAXED);
+            busy = 0;
+            return;
+        }
+    }
+    e = &b->ev[b->count];
+    e->seq = seq;
+    e->type = type;
+    e->ptr = (uintptr_t)ptr;
+    e->size = size;
+    e->start = start;
+    __atomic_store_n(&b->count, b->count + 1, __ATOMIC_RELEASE);
+    busy = 0;
+}
+
+static int logging(void)
+{
+    return !busy && __atomic_load_n(&recording, __ATOMIC_RELAXED);
+}
+
+/*****************
+ * Flushing
+ *****************/
+
+static void write_buf(buf_t *b)
+{
+    unsigned n = __atomic_load_n(&b->count, __ATOMIC_ACQUIRE);
+    size_t len = n * sizeof(event_t), done = 0;
+
+    while (done < len) {
+        ssize_t got = write(scratch_fd, (char *)b->ev + done, len - done);
+        if (got < 0 && errno == EINTR)
+            continue;
+        if (got <= 0)
+            return;
+        done += got;
+    }
+    scratch_events += n;
+}
+
+/* Write out and unmap everything on the full list */
+static void flush_full(void)
+{
+    buf_t *b = __atomic_exchange_n(&full_bufs, NULL, __ATOMIC_ACQUIRE);
+
+    while (b != NULL) {
+        buf_t *next = b->next;
+        write_buf(b);
+        munmap(b, sizeof(buf_t));
+        b = next;
+    }
+}
+
+static void *flush_thread(void *ptr __attribute__((unused)))
+{
+    struct timespec nap = { 0, FLUSH_NSECS };
+
+    busy = 1;
+    while (!__atomic_load_n(&stop_flusher, __ATOMIC_ACQUIRE)) {
+        flush_full();
+        nanosleep(&nap, NULL);
+    }
+    return NULL;
+}
+
+/*****************
+ * Writing the trace
+ *****************/
+
+/*
+ * A map from 64-bit keys (addresses, or seqs of open reallocs) to block
+ * ids, by open addressing with linear probing.  Key 0 marks an empty
+ * slot; neither NULL nor seq 0 is ever looked up.
+ */
+typedef struct {
+    uint64_t *keys;
+    int *ids;
+    size_t mask;
+    size_t n;
+} idmap_t;
+
+static size_t map_hash(const idmap_t *m, uint64_t key)
+{
+    return (key * 0x9e3779b97f4a7c15ULL >> 20) & m->mask;
+}
+
+static void map_init(idmap_t *m, size_t slots)
+{
+    m->keys = calloc(slots, sizeof(*m->keys));
+    m->ids = malloc(slots * sizeof(*m->ids));
+    if (m->keys == NULL || m->ids == NULL) {
+        fprintf(stderr, "recorder: out of memory\n");
+        exit(1);
+    }
+    m->mask = slots - 1;
+    m->n = 0;
+}
+
+static void map_put(idmap_t *m, uint64_t key, int id);
+
+static void map_grow(idmap_t *m)
+{
+    idmap_t old = *m;
+    size_t i;
+
+    map_init(m, 2 * (old.mask + 1));
+    for (i = 0; i <= old.mask; i++)
+        if (old.keys[i] != 0)
+            map_put(m, old.keys[i], old.ids[i]);
+    free(old.keys);
+    free(old.ids);
+}
+
+static void map_put(idmap_t *m, uint64_t key, int id)
+{
+    size_t i;
+
+    if (2 * (m->n + 1) > m->mask + 1)
+        map_grow(m);
+    for (i = map_hash(m, key); m->keys[i] != 0 && m->keys[i] != key;
+         i = (i + 1) & m->mask)
+        ;
+    if (m->keys[i] == 0)
+        m->n++;
+    m->keys[i] = key;
+    m->ids[i] = id;
+}
+
+/* Remove key and return its id, or -1 if it isn't there */
+static int map_take(idmap_t *m, uint64_t key)
+{
+    size_t hole, i, home;
+    int id;
+
+    for (hole = map_hash(m, key); m->keys[hole] != key;
+         hole = (hole + 1) & m->mask)
+        if (m->keys[hole] == 0)
+            return -1;
+    id = m->ids[hole];
+
+    /* Move back later keys of the run that the hole would hide */
+    for (i = (hole + 1) & m->mask; m->keys[i] != 0; i = (i + 1) & m->mask) {
+        home = map_hash(m, m->keys[i]);
+        if (((i - home) & m->mask) >= ((i - hole) & m->mask)) {
+            m->keys[hole] = m->keys[i];
+            m->ids[hole] = m->ids[i];
+            hole = i;
+        }
+    }
+    m->keys[hole] = 0;
+    m->n--;
+    return id;
+}
+
+/*
+ * write_ops - Turn the events, in order, into trace requests.  Blocks
+ *             the program had before recording started are left out.
+ */
+static void write_ops(FILE *out, const event_t *ev, uint64_t n,
+                      int *num_ids, int *num_ops)
+{
+    idmap_t live, open;
+    uint64_t i;
+    int id;
+
+    map_init(&live, 1024);
+    map_init(&open, 64);
+    *num_ids = *num_ops = 0;
+
+    for (i = 0; i < n; i++) {
+        const event_t *e = &ev[i];
+
+        switch (e->type) {
+        case EV_ALLOC:
+            if (e->ptr == 0)
+                break;
+            map_put(&live, e->ptr, *num_ids);
+            fprintf(out, "a %d %llu\n", (*num_ids)++,
+                    (unsigned long long)e->size);
+            (*num_ops)++;
+            break;
+
+        case EV_FREE:
+            if (e->ptr == 0)
+                id = -1;
+            else if ((id = map_take(&live, e->ptr)) < 0)
+                break;
+            fprintf(out, "f %d\n", id);
+            (*num_ops)++;
+            break;
+
+        case EV_REALLOC_START:
+            /* The old block is gone, until the realloc says otherwise */
+            if ((id = map_take(&live, e->ptr)) >= 0)
+                map_put(&open, e->seq + 1, id);
+            break;
+
+        case EV_REALLOC_END:
+            id = e->start != UINT64_MAX ? map_take(&open, e->start + 1) : -1;
+            if (e->ptr == 0) {
+                if (id >= 0 && e->size == 0) {        /* realloc(p, 0) */
+                    fprintf(out, "f %d\n", id);
+                    (*num_ops)++;
+                } else if (id >= 0) {                 /* failed */
+                    map_put(&live, ev[e->start].ptr, id);
+                }
+            } else if (id < 0) {                      /* realloc(NULL, n) */
+                map_put(&live, e->ptr, *num_ids);
+                fprintf(out, "a %d %llu\n", (*num_ids)++,
+                        (unsigned long long)e->size);
+                (*num_ops)++;
+            } else {
+                map_put(&live, e->ptr, id);
+                fprintf(out, "r %d %llu\n", id, (unsigned long long)e->size);
+                (*num_ops)++;
+            }
+            break;
+        }
+    }
+    free(live.keys);
+    free(live.ids);
+    free(open.keys);
+    free(open.ids);
+}
+
+/*
+ * write_trace - Sort the scratch file by seq and write the trace.  The
+ *               sorted copy goes after the events in the scratch file,
+ *               so that long recordings don't need the memory.
+ */
+static int write_trace(const char *name)
+{
+    char text[TRACE_NAMELEN + 8];
+    uint64_t n = next_seq, i;
+    size_t raw = scratch_events * sizeof(event_t);
+    size_t len = raw + n * sizeof(event_t);
+    event_t *map, *sorted;
+    int binary, num_ids, num_ops;
+    FILE *out;
+    size_t l = strlen(name), sl = strlen(TRACE_CACHE);
+
+    if (n == 0) {
+        fprintf(stderr, "recorder: no requests to write to %s\n", name);
+        return 0;
+    }
+    if (ftruncate(scratch_fd, len) < 0)
+        return -1;
+    map = mmap(NULL, len, PROT_READ | PROT_WRITE, MAP_SHARED, scratch_fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+    sorted = map + scratch_events;     /* zero filled, so all EV_NONE */
+    for (i = 0; i < scratch_events; i++)
+        if (map[i].seq < n)
+            sorted[map[i].seq] = map[i];
+
+    /* REALLOC_END finds its start by seq: make that an index in sorted */
+    for (i = 0; i < n; i++)
+        if (sorted[i].type == EV_REALLOC_END && sorted[i].start < n &&
+            sorted[sorted[i].start].type != EV_REALLOC_START)
+            sorted[i].start = UINT64_MAX;
+
+    binary = l > sl && strcmp(name + l - sl, TRACE_CACHE) == 0;
+    if (binary)
+        snprintf(text, sizeof(text), "%s.rep", name);
+    else
+        snprintf(text, sizeof(text), "%s", name);
+    if ((out = fopen(text, "w")) == NULL) {
+        munmap(map, len);
+        return -1;
+    }
+
+    /* The counts are only known at the end, so leave room for them */
+    fprintf(out, "%-12d\n%-12d\n%-12d\n%d\n", 1, 0, 0, 0);
+    write_ops(out, sorted, n, &num_ids, &num_ops);
+    rewind(out);
+    fprintf(out, "%-12d\n%-12d\n%-12d\n%d\n", 1, num_ids, num_ops, 0);
+    munmap(map, len);
+    if (fclose(out) != 0)
+        return -1;
+
+    fprintf(stderr, "recorder: %d requests on %d blocks in %s\n",
+            num_ops, num_ids, name);
+    if (binary) {
+        int rc = trace_convert(text, name);
+        unlink(text);
+        return rc;
+    }
+    return 0;
+}
+
+/*****************
+ * Setup
+ *****************/
+
+/* Stop recording in forked children: the flusher didn't come along */
+static void fork_child(void)
+{
+    recording = 0;
+}
+
+static void out_path(char *path, const char *pattern)
+{
+    char *p = path, *end = path + TRACE_NAMELEN - 1;
+
+    for (; *pattern && p < end; pattern++) {
+        if (pattern[0] == '%' && pattern[1] == 'p') {
+            p += snprintf(p, end - p, "%d", (int)getpid());
+            pattern++;
+        } else {
+            *p++ = *pattern;
+        }
+    }
+    *p = '\0';
+}
+
+static void __attribute__((constructor)) recorder_init(void)
+{
+    char scratch[TRACE_NAMELEN + 16];
+    const char *pattern = getenv("MM_RECORD");
+
+    busy = 1;
+    *(void **)&real_malloc = dlsym(RTLD_NEXT, "malloc");
+    *(void **)&real_free = dlsym(RTLD_NEXT, "free");
+    *(void **)&real_realloc = dlsym(RTLD_NEXT, "realloc");
+    *(void **)&real_calloc = dlsym(RTLD_NEXT, "calloc");
+    *(void **)&real_memalign = dlsym(RTLD_NEXT, "memalign");
+    *(void **)&real_posix_memalign = dlsym(RTLD_NEXT, "posix_memalign");
+    *(void **)&real_aligned_alloc = dlsym(RTLD_NEXT, "aligned_alloc");
+    *(void **)&real_valloc = dlsym(RTLD_NEXT, "valloc");
+
+    out_path(out_name, pattern != NULL && *pattern ? pattern : DEFAULT_OUT);
+    snprintf(scratch, sizeof(scratch), "%s.XXXXXX", out_name);
+    if ((scratch_fd = mkstemp(scratch)) < 0) {
+        fprintf(stderr, "recorder: can't write %s: %s\n", scratch,
+                strerror(errno));
+        busy = 0;
+        return;
+    }
+    unlink(scratch);
+
+    pthread_key_create(&thread_key, thread_exit);
+    pthread_atfork(NULL, NULL, fork_child);
+    if (pthread_create(&flusher, NULL, flush_thread, NULL) != 0) {
+        close(scratch_fd);
+        busy = 0;
+        return;
+    }
+    recording = 1;
+    busy = 0;
+}
+
+static void __attribute__((destructor)) recorder_fini(void)
+{
+    int i;
+
+    if (!recording)
+        return;
+    busy = 1;
+    __atomic_store_n(&recording, 0, __ATOMIC_RELEASE);
+    __atomic_store_n(&stop_flusher, 1, __ATOMIC_RELEASE);
+    pthread_join(flusher, NULL);
+
+    /* What's left: full buffers, then what each thread was filling */
+    flush_full();
+    for (i = 0; i < MAX_THREADS; i++) {
+        buf_t *b = __atomic_exchange_n(&threads[i].cur, NULL,
+                                       __ATOMIC_ACQ_REL);
+        if (b != NULL)
+            write_buf(b);    /* the thread may still have it; don't unmap */
+    }
+    if (dropped > 0)
+        fprintf(stderr, "recorder: lost %llu events\n",
+                (unsigned long long)dropped);
+
+    if (write_trace(out_name) < 0)
+        fprintf(stderr, "recorder: couldn't write %s: %s\n", out_name,
+                strerror(errno));
+    close(scratch_fd);
+}
+
+/*****************
+ * The allocator interface
+ *****************/
+
+static void *boot_alloc(size_t size)
+{
+    void *p;
+
+    size = (size + 15) & ~(size_t)15;
+    if (boot_used + size > BOOT_SIZE)
+        return NULL;
+    p = boot_heap + boot_used;
+    boot_used += size;
+    return p;
+}
+
+static int is_boot(void *ptr)
+{
+    return (char *)ptr >= boot_heap && (char *)ptr < boot_heap + BOOT_SIZE;
+}
+
+void *malloc(size_t size)
+{
+    void *p;
+
+    if (real_malloc == NULL)
+        return boot_alloc(size);
+    p = real_malloc(size);
+    if (logging())
+        record(take_seq(), EV_ALLOC, p, size, 0);
+    return p;
+}
+
+void free(void *ptr)
+{
+    if (is_boot(ptr))
+        return;
+    if (logging())
+        record(take_seq(), EV_FREE, ptr, 0, 0);
+    real_free(ptr);
+}
+
+void *realloc(void *ptr, size_t size)
+{
+    uint64_t start = 0;
+    void *p;
+
+    if (real_realloc == NULL || is_boot(ptr)) {
+        /* Boot blocks don't know their size: copy what could be in one */
+        if ((p = malloc(size)) != NULL && ptr != NULL) {
+            size_t left = boot_heap + BOOT_SIZE - (char *)ptr;
+            memcpy(p, ptr, size < left ? size : left);
+        }
+        return p;
+    }
+    if (ptr != NULL && logging()) {
+        start = take_seq();
+        record(start, EV_REALLOC_START, ptr, 0, 0);
+    }
+    p = real_realloc(ptr, size);
+    if (logging())
+        record(take_seq(), EV_REALLOC_END, p, size,
+               ptr != NULL ? start : UINT64_MAX);
+    return p;
+}
+
+void *calloc(size_t nmemb, size_t size)
+{
+    void *p;
+
+    if (real_calloc == NULL)
+        return boot_alloc(nmemb * size);   /* boot_heap is zero */
+    p = real_calloc(nmemb, size);
+    if (logging())
+        record(take_seq(), EV_ALLOC, p, nmemb * size, 0);
+    return p;
+}
+
+void *memalign(size_t alignment, size_t size)
+{
+    void *p = real_memalign(alignment, size);
+
+    if (logging())
+        record(take_seq(), EV_ALLOC, p, size, 0);
+    return p;
+}
+
+int posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+    int rc = real_posix_memalign(memptr, alignment, size);
+
+    if (rc == 0 && logging())
+        record(take_seq(), EV_ALLOC, *memptr, size, 0);
+    return rc;
+}
+
+void *aligned_alloc(size_t alignment, size_t size)
+{
+    void *p = real_aligned_alloc(alignment, size);
+
+    if (logging())
+        record(take_seq(), EV_ALLOC, p, size, 0);
+    return p;
+}
+
+void *valloc(size_t size)
+{
+    void *p = real_valloc(size);
+
+    if (logging())
+        record(take_seq(), EV_ALLOC, p, size, 0);
+    return p;
+}
@@ -0,0 +1,281 @@
+/*
+ * regress.c - telling real slowdowns from timing noise
+ */
+#define _GNU_SOURCE /* getline */
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "regress.h"
+
+#define BOOTSTRAP_RESAMPLES 2000
+
+/*****************
+ * Sample files
+ *****************/
+
+/*
+ * sampleset_save - One line per set: the number of samples, the samples,
+ *     and the trace name, which runs to the end of the line
+ */
+int sampleset_save(const char *path, const sampleset_t *sets, int n)
+{
+    FILE *f;
+    int i, k;
+
+    if ((f = fopen(path, "w")) == NULL)
+        return -1;
+    fprintf(f, "# mdriver timing samples: count, run times in secs, trace\n");
+    for (i = 0; i < n; i++) {
+        fprintf(f, "%d", sets[i].n);
+        for (k = 0; k < sets[i].n; k++)
+            fprintf(f, " %.9g", sets[i].secs[k]);
+        fprintf(f, " %s\n", sets[i].name);
+    }
+    return fclose(f) == 0 ? 0 : -1;
+}
+
+sampleset_t *sampleset_load(const char *path, int *n)
+{
+    sampleset_t *sets = NULL, *s;
+    char *line = NULL, *p, *end;
+    size_t cap = 0, len;
+    int max = 0, k;
+    FILE *f;
+
+    if ((f = fopen(path, "r")) == NULL)
+        return NULL;
+    *n = 0;
+    while (getline(&line, &cap, f) > 0) {
+        if (line[0] == '#' || line[0] == '\n')
+            continue;
+        if (*n == max) {
+            max = max ? 2 * max : 64;
+            if ((s = realloc(sets, max * sizeof(*sets))) == NULL)
+                goto fail;
+            sets = s;
+        }
+        s = &sets[*n];
+        s->n = strtol(line, &p, 10);
+        if (p == line || s->n <= 0 ||
+            (s->secs = malloc(s->n * sizeof(*s->secs))) == NULL)
+            goto bad;
+        (*n)++;
+        for (k = 0; k < s->n; k++) {
+            s->secs[k] = strtod(p, &end);
+            if (end == p)
+                goto bad;
+            p = end;
+        }
+        if (*p++ != ' ')
+            goto bad;
+        len = strcspn(p, "\n");
+        if (len == 0 || len >= sizeof(s->name))
+            goto bad;
+        memcpy(s->name, p, len);
+        s->name[len] = '\0';
+    }
+    free(line);
+    fclose(f);
+    return sets;
+
+bad:
+    errno = EINVAL;
+fail:
+    sampleset_free(sets, *n);
+    free(line);
+    fclose(f);
+    return NULL;
+}
+
+void sampleset_free(sampleset_t *sets, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        free(sets[i].secs);
+    free(sets);
+}
+
+/*****************
+ * Statistics
+ *****************/
+
+static int compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+
+    return x < y ? -1 : x > y;
+}
+
+/* median_sorted - The median of n sorted values */
+static double median_sorted(const double *x, int n)
+{
+    if (n == 0)
+        return 0;
+    return n % 2 ? x[n / 2] : (x[n / 2 - 1] + x[n / 2]) / 2;
+}
+
+double sample_median(const double *x, int n)
+{
+    double *sorted, m;
+
+    if ((sorted = malloc(n * sizeof(*sorted))) == NULL)
+        return 0;
+    memcpy(sorted, x, n * sizeof(*sorted));
+    qsort(sorted, n, sizeof(*sorted), compare_doubles);
+    m = median_sorted(sorted, n);
+    free(sorted);
+    return m;
+}
+
+/* A value of the pooled samples, and which set it came from */
+typedef struct {
+    double v;
+    int in_b;
+} pooled_t;
+
+static int compare_pooled(const void *a, const void *b)
+{
+    return compare_doubles(&((const pooled_t *)a)->v,
+                           &((const pooled_t *)b)->v);
+}
+
+/*
+ * mann_whitney - Rank the pooled samples, ties getting the average of
+ *     their ranks, and see how far the rank sum of b is above what it
+ *     would be if both sets came from the same distribution
+ */
+double mann_whitney(const double *a, int na, const double *b, int nb)
+{
+    pooled_t *all;
+    double rank_b = 0, ties = 0, u, mean, sd;
+    int n = na + nb, i, j, k;
+
+    if (na == 0 || nb == 0 || (all = malloc(n * sizeof(*all))) == NULL)
+        return 0.5;
+    for (i = 0; i < na; i++)
+        all[i] = (pooled_t){ a[i], 0 };
+    for (i = 0; i < nb; i++)
+        all[na + i] = (pooled_t){ b[i], 1 };
+    qsort(all, n, sizeof(*all), compare_pooled);
+
+    for (i = 0; i < n; i = j) {
+        for (j = i + 1; j < n && all[j].v == all[i].v; j++)
+            ;
+        /* ranks i + 1 to j are tied */
+        for (k = i; k < j; k++)
+            if (all[k].in_b)
+                rank_b += (i + 1 + j) / 2.0;
+        ties += (double)(j - i) * (j - i) * (j - i) - (j - i);
+    }
+    free(all);
+
+    u = rank_b - nb * (nb + 1) / 2.0;
+    mean = (double)na * nb / 2;
+    sd = sqrt((double)na * nb / 12 * ((n + 1) - ties / ((double)n * (n - 1))));
+    if (sd == 0)
+        return 0.5;
+    return 0.5 * erfc((u - mean - 0.5) / sd / sqrt(2));
+}
+
+/* splitmix64, the same generator as tracegen's */
+static uint64_t rng_next(uint64_t *state)
+{
+    uint64_t z = (*state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* resample_median - The median of n values drawn from x with replacement */
+static double resample_median(const double *x, int n, double *tmp,
+                              uint64_t *rng)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        tmp[i] = x[rng_next(rng) % n];
+    qsort(tmp, n, sizeof(*tmp), compare_doubles);
+    return median_sorted(tmp, n);
+}
+
+/* The samples a bootstrap draws from: b is unused by one-sample stats */
+typedef struct {
+    const double *a, *b;
+    int na, nb;
+} bootstrap_arg_t;
+
+/* stat_median - The median of a resample of a */
+static double stat_median(const bootstrap_arg_t *s, double *tmp,
+                          uint64_t *rng)
+{
+    return resample_median(s->a, s->na, tmp, rng);
+}
+
+/* stat_ratio - The ratio of the medians of resamples of b and a */
+static double stat_ratio(const bootstrap_arg_t *s, double *tmp,
+                         uint64_t *rng)
+{
+    double ma = resample_median(s->a, s->na, tmp, rng);
+
+    return ma > 0 ? resample_median(s->b, s->nb, tmp, rng) / ma : 0;
+}
+
+/*
+ * bootstrap - Compute stat on BOOTSTRAP_RESAMPLES resamples of s and set
+ *     [*lo, *hi] to the central level of its values.  tmpn is the most
+ *     values stat resamples at once.
+ */
+static void bootstrap(double (*stat)(const bootstrap_arg_t *, double *,
+                                     uint64_t *),
+                      const bootstrap_arg_t *s, int tmpn, double level,
+                      double *lo, double *hi)
+{
+    double *values, *tmp;
+    uint64_t rng = 1;
+    int i;
+
+    values = malloc(BOOTSTRAP_RESAMPLES * sizeof(*values));
+    tmp = malloc(tmpn * sizeof(*tmp));
+    if (values == NULL || tmp == NULL) {
+        free(values);
+        free(tmp);
+        return;
+    }
+
+    for (i = 0; i < BOOTSTRAP_RESAMPLES; i++)
+        values[i] = stat(s, tmp, &rng);
+    qsort(values, BOOTSTRAP_RESAMPLES, sizeof(*values), compare_doubles);
+    *lo = values[(int)((1 - level) / 2 * (BOOTSTRAP_RESAMPLES - 1))];
+    *hi = values[(int)((1 + level) / 2 * (BOOTSTRAP_RESAMPLES - 1))];
+
+    free(values);
+    free(tmp);
+}
+
+void bootstrap_ratio(const double *a, int na, const double *b, int nb,
+                     double level, double *lo, double *hi)
+{
+    bootstrap_arg_t s = { a, b, na, nb };
+
+    *lo = *hi = 0;
+    if (na == 0 || nb == 0)
+        return;
+    bootstrap(stat_ratio, &s, na > nb ? na : nb, level, lo, hi);
+}
+
+void bootstrap_median(const double *x, int n, double level,
+                      double *lo, double *hi)
+{
+    bootstrap_arg_t s = { x, NULL, n, 0 };
+
+    *lo = *hi = 0;
+    if (n == 0)
+        return;
+    bootstrap(stat_median, &s, n, level, lo, hi);
+}
@@ -0,0 +1,50 @@
+#ifndef __REGRESS_H_
+#define __REGRESS_H_
+
+/*
+ * regress.h - telling real slowdowns from timing noise
+ *
+ * A sample set holds the times of many runs of one trace.  Sets are
+ * saved to a text file, one trace to a line, and compared with those
+ * of a saved baseline: the Mann-Whitney U test says how likely the
+ * difference is to be noise, and a bootstrap gives a confidence
+ * interval for the ratio of the medians.  Neither assumes the times
+ * are normally distributed, which they aren't.
+ */
+#include "trace.h"
+
+typedef struct {
+    char name[TRACE_NAMELEN];  /* the trace */
+    int n;                     /* number of samples */
+    double *secs;              /* run times, malloc'ed */
+} sampleset_t;
+
+/* Write sets to path, or read them back; -1 or NULL on error, with
+   errno set.  sampleset_load returns the number of sets in *n. */
+int sampleset_save(const char *path, const sampleset_t *sets, int n);
+sampleset_t *sampleset_load(const char *path, int *n);
+void sampleset_free(sampleset_t *sets, int n);
+
+double sample_median(const double *x, int n);
+
+/*
+ * The one-sided p-value of the Mann-Whitney U test that the values of b
+ * tend to be larger than those of a, from the normal approximation with
+ * a correction for ties.  1 - mann_whitney(a, b) is near the p-value
+ * for b being smaller.
+ */
+double mann_whitney(const double *a, int na, const double *b, int nb);
+
+/*
+ * A level (e.g. 0.95) confidence interval for median(b) / median(a),
+ * from resampling both sets with replacement.  The resampling is
+ * seeded, so the same samples always give the same interval.
+ */
+void bootstrap_ratio(const double *a, int na, const double *b, int nb,
+                     double level, double *lo, double *hi);
+
+/* The same for median(x) alone, for mmbench */
+void bootstrap_median(const double *x, int n, double level,
+                      double *lo, double *hi);
+
+#endif /* __REGRESS_H_ */
@@ -0,0 +1,681 @@
+/*
+ * trace.c - load malloc lab traces, and convert them to the binary
+ *           format described in trace.h
+ *
+ * Parsing a large .rep file with fscanf() takes longer than replaying
+ * it, so text traces are parsed only once: the result is cached as a
+ * binary trace next to the text file, and later runs map the cache
+ * (read only, and prefaulted so that replays don't take page faults
+ * on the ops) instead.
+ *
+ * Traces too big to hold in memory can be streamed instead.  A reader
+ * thread fills two TRACE_WINDOW buffers in turn, so that the next
+ * window is read while the current one is replayed.  Text traces are
+ * converted first, a window at a time, and only parsed on the fly if
+ * the conversion can't be written.
+ */
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "trace.h"
+
+#define MAXLINE 1024 /* max token size in a text trace */
+
+/* A trace being read a window at a time */
+struct trace_stream {
+    const char *filename;      /* for error messages */
+    int fd;                    /* binary source, or -1 */
+    FILE *text;                /* text source, or NULL */
+    long start;                /* offset of the first op in the source */
+    int num_ops;
+    int num_ids;
+    int next_op;               /* first op the reader hasn't read */
+    int index, size;           /* last numbers read from a text trace */
+
+    traceop_t *buf[2];         /* the two windows... */
+    int count[2];              /* ... how many ops each holds, 0 at the end */
+    int full[2];               /* ... and whether the reader filled it */
+    int cur;                   /* window the replay has, -1 for none */
+    int eof;                   /* the replay has seen the end */
+
+    pthread_t reader;
+    pthread_mutex_t lock;
+    pthread_cond_t cond;
+    int stop;                  /* tells the reader to quit */
+};
+
+/*
+ * trace_error - Report a bad trace file and exit
+ */
+static void trace_error(const char *fmt, ...)
+{
+    va_list ap;
+    va_start(ap, fmt);
+    vprintf(fmt, ap);
+    va_end(ap);
+    exit(1);
+}
+
+/*
+ * check_ops - Make sure every request is one we can replay, since a
+ *             binary trace isn't parsed before it's used.
+ */
+static int check_ops(const traceop_t *ops, int num_ops, int num_ids)
+{
+    int i;
+
+    for (i = 0; i < num_ops; i++) {
+        const traceop_t *op = &ops[i];
+        if (op->type > REALLOC || op->index >= num_ids ||
+            op->index < (op->type == FREE ? -1 : 0)) /* free(NULL) is -1 */
+            return -1;
+    }
+    return 0;
+}
+
+/*
+ * read_header - Read the four header lines of a text trace
+ */
+static void read_header(trace_t *trace, FILE *tracefile)
+{
+    if (fscanf(tracefile, "%d %d %d %d", &trace->weight, &trace->num_ids,
+               &trace->num_ops, &trace->ignore_ranges) != 4 ||
+        trace->num_ids < 0 || trace->num_ops < 0) {
+        trace_error("%s: bad trace header\n", trace->filename);
+    }
+
+    if(trace->weight < 0 || trace->weight > 3) {
+        trace_error("%s: weight can only be in {0, 1, 2 3}\n",
+                    trace->filename);
+    }
+    if(trace->ignore_ranges != 0 && trace->ignore_ranges != 1) {
+        trace_error("%s: ignore-ranges can only be zero or one\n",
+                    trace->filename);
+    }
+}
+
+/*
+ * read_op - Parse the next request line of a text trace into op.
+ *           Returns 0 at the end of the file.  *index and *size hold
+ *           the numbers of the previous line, which a line missing
+ *           them repeats (some traces have "a 7" lines).
+ */
+static int read_op(FILE *tracefile, traceop_t *op, int *index, int *size,
+                   const char *filename)
+{
+    char type[MAXLINE];
+
+    if (fscanf(tracefile, "%s", type) == EOF)
+        return 0;
+
+    switch(type[0]) {
+    case 'a':
+        fscanf(tracefile, "%d %d", index, size);
+        op->type = ALLOC;
+        op->size = *size;
+        break;
+    case 'r':
+        fscanf(tracefile, "%d %d", index, size);
+        op->type = REALLOC;
+        op->size = *size;
+        break;
+    case 'f':
+        fscanf(tracefile, "%d", index);
+        op->type = FREE;
+        op->size = 0;
+        break;
+    default:
+        trace_error("Bogus type character (%c) in tracefile %s\n",
+                    type[0], filename);
+    }
+    op->index = *index;
+    return 1;
+}
+
+/*
+ * read_text - Parse a text trace into malloc'ed ops
+ */
+static void read_text(trace_t *trace, FILE *tracefile)
+{
+    int index = 0, size = 0;
+    int max_index = 0;
+    int op_index;
+
+    read_header(trace, tracefile);
+
+    /* We'll store each request line in the trace in this array */
+    if ((trace->ops = malloc(trace->num_ops * sizeof(traceop_t))) == NULL &&
+        trace->num_ops > 0)
+        trace_error("malloc failed in read_text\n");
+
+    /* read every request line in the trace file */
+    op_index = 0;
+    while (op_index < trace->num_ops &&
+           read_op(tracefile, &trace->ops[op_index], &index, &size,
+                   trace->filename)) {
+        if (trace->ops[op_index].type != FREE)
+            max_index = (index > max_index) ? index : max_index;
+        op_index++;
+    }
+    assert(max_index == trace->num_ids - 1);
+    assert(trace->num_ops == op_index);
+    if (check_ops(trace->ops, trace->num_ops, trace->num_ids) < 0)
+        trace_error("%s: request for a bad block index\n", trace->filename);
+}
+
+/*
+ * check_header - Is hdr the header of a well formed binary trace of
+ *                file_size bytes, and if src is given, the current
+ *                conversion of that file?
+ */
+static int check_header(const trace_header_t *hdr, off_t file_size,
+                        const struct stat *src)
+{
+    return memcmp(hdr->magic, TRACE_MAGIC, sizeof(hdr->magic)) == 0 &&
+        hdr->version == TRACE_VERSION && hdr->num_ops >= 0 &&
+        hdr->num_ids >= 0 &&
+        (size_t)file_size == sizeof(trace_header_t) +
+                             (size_t)hdr->num_ops * sizeof(traceop_t) &&
+        (src == NULL || (hdr->src_size == (uint64_t)src->st_size &&
+                         hdr->src_sec == src->st_mtim.tv_sec &&
+                         hdr->src_nsec == src->st_mtim.tv_nsec));
+}
+
+/*
+ * set_header - Copy the fields of a binary trace header into trace
+ */
+static void set_header(trace_t *trace, const trace_header_t *hdr)
+{
+    trace->weight = hdr->weight;
+    trace->num_ids = hdr->num_ids;
+    trace->num_ops = hdr->num_ops;
+    trace->ignore_ranges = hdr->ignore_ranges;
+}
+
+/*
+ * map_binary - Map the binary trace open on fd.  If src is given, the
+ *              trace has to be the current conversion of that file.
+ *              Returns -1 if it isn't, or isn't a binary trace at all.
+ */
+static int map_binary(trace_t *trace, int fd, const struct stat *src)
+{
+    struct stat st;
+    const trace_header_t *hdr;
+    void *map;
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(trace_header_t))
+        return -1;
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE | MAP_POPULATE, fd, 0);
+    if (map == MAP_FAILED)
+        return -1;
+
+    hdr = map;
+    if (!check_header(hdr, st.st_size, src) ||
+        check_ops((const traceop_t *)(hdr + 1), hdr->num_ops,
+                  hdr->num_ids) < 0) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+
+    set_header(trace, hdr);
+    trace->ops = (traceop_t *)(hdr + 1);
+    trace->map = map;
+    trace->map_len = st.st_size;
+    return 0;
+}
+
+/*
+ * read_binary_header - Read and check the header of the binary trace
+ *                      open on fd, as map_binary() does
+ */
+static int read_binary_header(trace_t *trace, int fd, const struct stat *src)
+{
+    trace_header_t hdr;
+    struct stat st;
+
+    if (fstat(fd, &st) < 0 ||
+        pread(fd, &hdr, sizeof(hdr), 0) != sizeof(hdr) ||
+        !check_header(&hdr, st.st_size, src))
+        return -1;
+    set_header(trace, &hdr);
+    return 0;
+}
+
+/*
+ * write_all - write(), retried until all of buf is out
+ */
+static int write_all(int fd, const void *buf, size_t len)
+{
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+    return 0;
+}
+
+/*
+ * write_header - Start the binary form of trace, converted from src,
+ *                in the temporary file tmp.  A binary trace is always
+ *                written under a temporary name and renamed into place
+ *                by finish_binary(), so that another driver loading the
+ *                same trace never sees half a file.
+ */
+static int write_header(char *tmp, const char *dst, const trace_t *trace,
+                        const struct stat *src)
+{
+    trace_header_t hdr;
+    int fd;
+
+    if (snprintf(tmp, TRACE_NAMELEN + 8, "%s.XXXXXX", dst) >=
+        TRACE_NAMELEN + 8)
+        return -1;
+    if ((fd = mkstemp(tmp)) < 0)
+        return -1;
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, TRACE_MAGIC, sizeof(hdr.magic));
+    hdr.version = TRACE_VERSION;
+    hdr.weight = trace->weight;
+    hdr.num_ids = trace->num_ids;
+    hdr.num_ops = trace->num_ops;
+    hdr.ignore_ranges = trace->ignore_ranges;
+    hdr.src_size = src->st_size;
+    hdr.src_sec = src->st_mtim.tv_sec;
+    hdr.src_nsec = src->st_mtim.tv_nsec;
+
+    if (write_all(fd, &hdr, sizeof(hdr)) < 0) {
+        close(fd);
+        unlink(tmp);
+        return -1;
+    }
+    return fd;
+}
+
+/*
+ * finish_binary - Close the binary trace written to tmp on fd, and
+ *                 move it to dst if ok is set and everything worked
+ */
+static int finish_binary(int fd, int ok, const char *tmp, const char *dst)
+{
+    ok = ok && fchmod(fd, 0644) == 0;
+    if (close(fd) < 0 || !ok || rename(tmp, dst) < 0) {
+        unlink(tmp);
+        return -1;
+    }
+    return 0;
+}
+
+/*
+ * write_binary - Write trace to dst as a binary trace converted from src
+ */
+static int write_binary(const trace_t *trace, const char *dst,
+                        const struct stat *src)
+{
+    char tmp[TRACE_NAMELEN + 8];
+    int fd;
+
+    if ((fd = write_header(tmp, dst, trace, src)) < 0)
+        return -1;
+    return finish_binary(fd, write_all(fd, trace->ops, trace->num_ops *
+                                       sizeof(traceop_t)) == 0, tmp, dst);
+}
+
+/*
+ * is_binary - Does the file open on fd start like a binary trace?
+ */
+static int is_binary(int fd)
+{
+    char magic[sizeof(((trace_header_t *)0)->magic)];
+
+    return pread(fd, magic, sizeof(magic), 0) == sizeof(magic) &&
+           memcmp(magic, TRACE_MAGIC, sizeof(magic)) == 0;
+}
+
+/*
+ * open_text - Open a stdio stream on the text trace open on fd
+ */
+static FILE *open_text(const trace_t *trace, int fd)
+{
+    FILE *tracefile;
+
+    if ((tracefile = fdopen(fd, "r")) == NULL)
+        trace_error("Could not read %s: %s\n", trace->filename,
+                    strerror(errno));
+    return tracefile;
+}
+
+/*
+ * open_trace - Open the trace path names for trace_load() or
+ *              trace_stream_open().  A binary trace comes back as the
+ *              result, with -1 in *text_fd.  For a text trace, *text_fd
+ *              is the text and the result is its cached conversion, or
+ *              -1; the caller checks that the cache is up to date.
+ */
+static int open_trace(trace_t *trace, const char *path, int *text_fd,
+                      struct stat *st)
+{
+    char cache[TRACE_NAMELEN + sizeof(TRACE_CACHE)];
+    int fd;
+
+    if (strlen(path) >= sizeof(trace->filename))
+        trace_error("Trace name too long: %s\n", path);
+    strcpy(trace->filename, path);
+    trace->ops = NULL;
+    trace->map = NULL;
+    trace->map_len = 0;
+
+    if ((fd = open(path, O_RDONLY)) < 0 || fstat(fd, st) < 0)
+        trace_error("Could not open %s in read_trace: %s\n", path,
+                    strerror(errno));
+
+    if (is_binary(fd)) {
+        *text_fd = -1;
+        return fd;
+    }
+    *text_fd = fd;
+    sprintf(cache, "%s%s", path, TRACE_CACHE);
+    return open(cache, O_RDONLY);
+}
+
+void trace_load(trace_t *trace, const char *path)
+{
+    char cache[TRACE_NAMELEN + sizeof(TRACE_CACHE)];
+    struct stat st;
+    int fd, text_fd;
+    FILE *tracefile;
+
+    /* A binary trace given directly */
+    fd = open_trace(trace, path, &text_fd, &st);
+    if (text_fd < 0) {
+        if (map_binary(trace, fd, NULL) < 0)
+            trace_error("%s: malformed binary trace\n", path);
+        close(fd);
+        return;
+    }
+
+    /* A text trace with an up to date conversion */
+    if (fd >= 0) {
+        int mapped = map_binary(trace, fd, &st) == 0;
+        close(fd);
+        if (mapped) {
+            close(text_fd);
+            return;
+        }
+    }
+
+    /* Otherwise parse it, and cache it if we can write next to it */
+    tracefile = open_text(trace, text_fd);
+    read_text(trace, tracefile);
+    fclose(tracefile);
+    sprintf(cache, "%s%s", path, TRACE_CACHE);
+    write_binary(trace, cache, &st);
+}
+
+void trace_unload(trace_t *trace)
+{
+    if (trace->map != NULL)
+        munmap(trace->map, trace->map_len);
+    else
+        free(trace->ops);
+    trace->ops = NULL;
+    trace->map = NULL;
+    trace->map_len = 0;
+}
+
+/*
+ * fill_window - Read the next n ops of stream into buf
+ */
+static void fill_window(trace_stream_t *stream, traceop_t *buf, int n)
+{
+    int i;
+
+    if (stream->text == NULL) {
+        size_t len = n * sizeof(traceop_t), done = 0;
+        off_t offset = stream->start +
+                       (off_t)stream->next_op * sizeof(traceop_t);
+        while (done < len) {
+            ssize_t got = pread(stream->fd, (char *)buf + done, len - done,
+                                offset + done);
+            if (got <= 0) {
+                if (got < 0 && errno == EINTR)
+                    continue;
+                trace_error("%s: trace ends early\n", stream->filename);
+            }
+            done += got;
+        }
+    } else {
+        for (i = 0; i < n; i++)
+            if (!read_op(stream->text, &buf[i], &stream->index,
+                         &stream->size, stream->filename))
+                trace_error("%s: trace ends early\n", stream->filename);
+    }
+    if (check_ops(buf, n, stream->num_ids) < 0)
+        trace_error("%s: request for a bad block index\n", stream->filename);
+    stream->next_op += n;
+}
+
+/*
+ * stream_reader - The reader thread: fill whichever window the replay
+ *                 doesn't have, until the trace runs out
+ */
+static void *stream_reader(void *ptr)
+{
+    trace_stream_t *stream = ptr;
+    int k = 0, n, stop;
+
+    do {
+        pthread_mutex_lock(&stream->lock);
+        while (stream->full[k] && !stream->stop)
+            pthread_cond_wait(&stream->cond, &stream->lock);
+        stop = stream->stop;
+        pthread_mutex_unlock(&stream->lock);
+        if (stop)
+            break;
+
+        n = stream->num_ops - stream->next_op;
+        if (n > TRACE_WINDOW)
+            n = TRACE_WINDOW;
+        fill_window(stream, stream->buf[k], n);
+
+        pthread_mutex_lock(&stream->lock);
+        stream->count[k] = n;
+        stream->full[k] = 1;
+        pthread_cond_broadcast(&stream->cond);
+        pthread_mutex_unlock(&stream->lock);
+        k ^= 1;
+    } while (n > 0);
+
+    return NULL;
+}
+
+/*
+ * start_reader - Start reading stream from its first op
+ */
+static void start_reader(trace_stream_t *stream)
+{
+    if (stream->text != NULL && fseek(stream->text, stream->start, SEEK_SET))
+        trace_error("%s: can't rewind\n", stream->filename);
+    stream->next_op = 0;
+    stream->index = stream->size = 0;
+    stream->full[0] = stream->full[1] = 0;
+    stream->cur = -1;
+    stream->eof = 0;
+    stream->stop = 0;
+    if ((errno = pthread_create(&stream->reader, NULL, stream_reader,
+                                stream)) != 0)
+        trace_error("Could not start the reader for %s: %s\n",
+                    stream->filename, strerror(errno));
+}
+
+/*
+ * stop_reader - Stop the reader thread, wherever it has got to
+ */
+static void stop_reader(trace_stream_t *stream)
+{
+    pthread_mutex_lock(&stream->lock);
+    stream->stop = 1;
+    pthread_cond_broadcast(&stream->cond);
+    pthread_mutex_unlock(&stream->lock);
+    pthread_join(stream->reader, NULL);
+}
+
+/*
+ * stream_open - trace_stream_open(), which first brings the cached
+ *               conversion of a text trace up to date if convert is set
+ */
+static trace_stream_t *stream_open(trace_t *trace, const char *path,
+                                   int convert)
+{
+    char cache[TRACE_NAMELEN + sizeof(TRACE_CACHE)];
+    trace_stream_t *stream;
+    struct stat st;
+    int fd, text_fd;
+
+    fd = open_trace(trace, path, &text_fd, &st);
+    if (text_fd >= 0 && (fd < 0 || read_binary_header(trace, fd, &st) < 0)) {
+        /* Stale or no conversion: make one, a window at a time, since
+           replaying the binary form is much faster than parsing */
+        sprintf(cache, "%s%s", path, TRACE_CACHE);
+        if (convert && trace_convert(path, cache) == 0) {
+            if (fd >= 0)
+                close(fd);
+            close(text_fd);
+            return stream_open(trace, path, 0);
+        }
+    }
+
+    if ((stream = calloc(1, sizeof(*stream))) == NULL)
+        trace_error("malloc failed in trace_stream_open\n");
+    stream->filename = trace->filename;
+    stream->fd = -1;
+
+    if (text_fd < 0) {
+        if (read_binary_header(trace, fd, NULL) < 0)
+            trace_error("%s: malformed binary trace\n", path);
+        stream->fd = fd;
+    } else if (fd >= 0 && read_binary_header(trace, fd, &st) == 0) {
+        stream->fd = fd;         /* the cached conversion */
+        close(text_fd);
+    } else {
+        if (fd >= 0)
+            close(fd);
+        stream->text = open_text(trace, text_fd);
+        read_header(trace, stream->text);
+        stream->start = ftell(stream->text);
+    }
+    if (stream->fd >= 0) {
+        stream->start = sizeof(trace_header_t);
+        posix_fadvise(stream->fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+    stream->num_ops = trace->num_ops;
+    stream->num_ids = trace->num_ids;
+
+    if ((stream->buf[0] = malloc(TRACE_WINDOW * sizeof(traceop_t))) == NULL ||
+        (stream->buf[1] = malloc(TRACE_WINDOW * sizeof(traceop_t))) == NULL)
+        trace_error("malloc failed in trace_stream_open\n");
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->cond, NULL);
+    start_reader(stream);
+    return stream;
+}
+
+trace_stream_t *trace_stream_open(trace_t *trace, const char *path)
+{
+    return stream_open(trace, path, 1);
+}
+
+const traceop_t *trace_stream_next(trace_stream_t *stream, int *n)
+{
+    int k;
+
+    if (stream->eof) {
+        *n = 0;
+        return NULL;
+    }
+
+    /* Hand the window we had back to the reader, and wait for the next */
+    pthread_mutex_lock(&stream->lock);
+    if (stream->cur >= 0) {
+        stream->full[stream->cur] = 0;
+        pthread_cond_broadcast(&stream->cond);
+    }
+    k = stream->cur < 0 ? 0 : stream->cur ^ 1;
+    while (!stream->full[k])
+        pthread_cond_wait(&stream->cond, &stream->lock);
+    stream->cur = k;
+    *n = stream->count[k];
+    pthread_mutex_unlock(&stream->lock);
+
+    if (*n == 0) {
+        stream->eof = 1;
+        return NULL;
+    }
+    return stream->buf[k];
+}
+
+void trace_stream_rewind(trace_stream_t *stream)
+{
+    stop_reader(stream);
+    start_reader(stream);
+}
+
+void trace_stream_close(trace_stream_t *stream)
+{
+    stop_reader(stream);
+    if (stream->text != NULL)
+        fclose(stream->text);
+    else
+        close(stream->fd);
+    pthread_mutex_destroy(&stream->lock);
+    pthread_cond_destroy(&stream->cond);
+    free(stream->buf[0]);
+    free(stream->buf[1]);
+    free(stream);
+}
+
+int trace_convert(const char *src, const char *dst)
+{
+    char tmp[TRACE_NAMELEN + 8];
+    trace_t trace;
+    trace_stream_t *stream;
+    const traceop_t *ops;
+    struct stat st;
+    int fd, n, ok = 1;
+
+    if ((fd = open(src, O_RDONLY)) < 0 || fstat(fd, &st) < 0)
+        return -1;
+    n = is_binary(fd);
+    close(fd);
+    if (n) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    /* Stream it through, so that traces of any size can be converted */
+    stream = stream_open(&trace, src, 0);
+    if ((fd = write_header(tmp, dst, &trace, &st)) < 0) {
+        trace_stream_close(stream);
+        return -1;
+    }
+    while (ok && (ops = trace_stream_next(stream, &n)) != NULL)
+        ok = write_all(fd, ops, n * sizeof(traceop_t)) == 0;
+    trace_stream_close(stream);
+    return finish_binary(fd, ok, tmp, dst);
+}
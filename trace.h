@@ -0,0 +1,95 @@
+#ifndef __TRACE_H_
+#define __TRACE_H_
+
+/*
+ * trace.h - loading malloc lab trace files
+ *
+ * A trace is either the text .rep format (four header lines, then one
+ * "a id size", "r id size" or "f id" request per line) or the binary
+ * format below, which is a fixed header followed by the requests as
+ * packed traceop_t records, in host byte order.  Binary traces are
+ * mapped straight into memory instead of being parsed.
+ *
+ * The first time a text trace is loaded, trace_load() converts it and
+ * caches the result next to it as <file>.bin.  The cache remembers
+ * the size and modification time of its source and is regenerated
+ * whenever they change.
+ *
+ * Traces too big for memory can be read a window at a time instead,
+ * with the trace_stream functions.
+ */
+#include <stddef.h>
+#include <stdint.h>
+
+#define TRACE_NAMELEN 1024       /* max trace path length */
+#define TRACE_MAGIC   "MMTB"     /* first bytes of a binary trace */
+#define TRACE_VERSION 1
+#define TRACE_CACHE   ".bin"     /* suffix of cached conversions */
+#define TRACE_WINDOW  65536      /* ops read at a time when streaming */
+
+/* Request types */
+enum { ALLOC, FREE, REALLOC };
+
+/* Characterizes a single trace operation (allocator request) */
+typedef struct {
+    uint32_t type;        /* type of request */
+    int32_t index;        /* index for free() to use later */
+    uint32_t size;        /* byte size of alloc/realloc request */
+} traceop_t;
+
+/* Header of a binary trace; the ops follow it directly */
+typedef struct {
+    char magic[4];        /* TRACE_MAGIC */
+    uint32_t version;     /* TRACE_VERSION */
+    int32_t weight;
+    int32_t num_ids;
+    int32_t num_ops;
+    int32_t ignore_ranges;
+    uint64_t src_size;    /* size and mtime of the text trace this */
+    int64_t src_sec;      /* was converted from, to tell when a */
+    int64_t src_nsec;     /* cached conversion is stale */
+} trace_header_t;
+
+/* Holds the information for one trace file*/
+typedef struct {
+    char filename[TRACE_NAMELEN];
+    int ignore_ranges;   /* parsed for format compatibility only */
+    int num_ids;         /* number of alloc/realloc ids */
+    int num_ops;         /* number of distinct requests */
+    int weight;          /* weight for this trace (unused) */
+    traceop_t *ops;      /* array of requests */
+    char **blocks;       /* array of ptrs returned by malloc/realloc... */
+    size_t *block_sizes; /* ... and a corresponding array of payload sizes */
+    int *block_rand_base;/* index into random_data, if debug is on */
+    void *map;           /* binary trace ops points into, if mapped */
+    size_t map_len;
+} trace_t;
+
+/*
+ * trace_load fills in the name, header fields and ops of a trace, and
+ * exits with a message if the file can't be read or is malformed.
+ * The blocks arrays are left to the caller.  trace_unload releases
+ * the ops again.
+ */
+void trace_load(trace_t *trace, const char *path);
+void trace_unload(trace_t *trace);
+
+/*
+ * Streaming: trace_stream_open fills in the name and header fields of
+ * trace like trace_load, but leaves its ops NULL.  Each call of
+ * trace_stream_next then returns the next window of at most
+ * TRACE_WINDOW ops and their number in *n, or NULL at the end of the
+ * trace.  A window stays valid until the next call, while the one
+ * after it is read in the background.
+ */
+typedef struct trace_stream trace_stream_t;
+
+trace_stream_t *trace_stream_open(trace_t *trace, const char *path);
+const traceop_t *trace_stream_next(trace_stream_t *stream, int *n);
+void trace_stream_rewind(trace_stream_t *stream);
+void trace_stream_close(trace_stream_t *stream);
+
+/* Write the binary form of text trace src to dst, -1 on error */
+int trace_convert(const char *src, const char *dst);
+
+#endif /* __TRACE_H_ */
@@ -0,0 +1,66 @@
+/*
+ * traceconv.c - convert text .rep traces to the binary trace format
+ *
+ *   traceconv <trace.rep>...          writes each to <trace.rep>.bin, the
+ *                                     cache the driver looks for
+ *   traceconv -o <out> <trace.rep>    writes one trace to <out>
+ *
+ * The driver does this by itself the first time it loads a trace, so
+ * this is only needed for trace directories it can't write to, or to
+ * hand binary traces to the driver directly (-f <out>).
+ */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: traceconv <trace.rep>...\n");
+    fprintf(stderr, "       traceconv -o <out> <trace.rep>\n");
+}
+
+int main(int argc, char **argv)
+{
+    char dst[TRACE_NAMELEN + sizeof(TRACE_CACHE)];
+    const char *out = NULL;
+    int c, i, status = 0;
+
+    while ((c = getopt(argc, argv, "o:h")) != EOF) {
+        switch (c) {
+        case 'o':
+            out = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind == argc || (out != NULL && argc - optind != 1)) {
+        usage();
+        exit(1);
+    }
+
+    for (i = optind; i < argc; i++) {
+        if (out == NULL) {
+            if (strlen(argv[i]) >= TRACE_NAMELEN) {
+                fprintf(stderr, "%s: name too long\n", argv[i]);
+                status = 1;
+                continue;
+            }
+            sprintf(dst, "%s%s", argv[i], TRACE_CACHE);
+        }
+        if (trace_convert(argv[i], out != NULL ? out : dst) < 0) {
+            fprintf(stderr, "%s: %s\n", argv[i], errno == EINVAL ?
+                    "already a binary trace" : strerror(errno));
+            status = 1;
+        }
+    }
+    return status;
+}
@@ -0,0 +1,375 @@
+/*
+ * tracegen.c - generate synthetic .rep traces
+ *
+ *   tracegen [-n ops] [-s seed] [-z sizes] [-l lifetimes] [-r prob]
+ *            [-p bytes] <out.rep>
+ *
+ * Each block gets a size drawn from the size distribution and a
+ * lifetime, counted in requests, drawn from the lifetime distribution;
+ * it is freed once that many requests have gone by.  With probability
+ * -r a request reallocates a live block to a new size instead of
+ * allocating one.  -p caps the live payload: a block that would go
+ * over it first frees the blocks closest to their end, which gives
+ * steady-state churn around that heap size, and a size drawn bigger
+ * than the cap is cut down to it.  Blocks still live after
+ * -n requests are freed at the end.
+ *
+ * Distributions are given as name:args, with
+ *
+ *   const:N              always N
+ *   uniform:LO:HI        uniform on [LO, HI]
+ *   exp:MEAN             exponential
+ *   lognormal:MEDIAN:S   lognormal, S the sigma of its log
+ *   pareto:MIN:ALPHA     heavy tailed, no smaller than MIN
+ *   bimodal:A:B:P        exponential of mean A with probability P,
+ *                        else of mean B
+ *
+ * The same seed always gives the same trace.  Only live blocks are
+ * kept in memory, so the trace length is bounded by disk, not memory.
+ */
+#include <errno.h>
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_SIZE  (1u << 30)   /* largest request written */
+#define MAX_ARGS  3
+
+/* Distributions */
+enum { D_CONST, D_UNIFORM, D_EXP, D_LOGNORMAL, D_PARETO, D_BIMODAL };
+
+typedef struct {
+    const char *name;
+    int nargs;
+} dist_name_t;
+
+static const dist_name_t dist_names[] = {
+    { "const", 1 }, { "uniform", 2 }, { "exp", 1 },
+    { "lognormal", 2 }, { "pareto", 2 }, { "bimodal", 3 },
+};
+
+typedef struct {
+    int type;
+    double arg[MAX_ARGS];
+} dist_t;
+
+/* A live block, kept in a min-heap on the request it dies at */
+typedef struct {
+    uint64_t death;
+    int id;
+    uint32_t size;
+} block_t;
+
+typedef struct {
+    block_t *b;
+    size_t n, cap;
+} heap_t;
+
+static uint64_t rng_state;
+
+/*****************
+ * Random numbers
+ *****************/
+
+/* splitmix64, so traces don't depend on the C library's rand() */
+static uint64_t rng_next(void)
+{
+    uint64_t z = (rng_state += 0x9e3779b97f4a7c15ULL);
+
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+/* Uniform on (0, 1) */
+static double rng_unit(void)
+{
+    return ((rng_next() >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+static double rng_normal(void)
+{
+    return sqrt(-2.0 * log(rng_unit())) * cos(2.0 * M_PI * rng_unit());
+}
+
+static double sample(const dist_t *d)
+{
+    switch (d->type) {
+    case D_CONST:
+        return d->arg[0];
+    case D_UNIFORM:
+        return d->arg[0] + (d->arg[1] - d->arg[0] + 1) * rng_unit();
+    case D_EXP:
+        return -d->arg[0] * log(rng_unit());
+    case D_LOGNORMAL:
+        return d->arg[0] * exp(d->arg[1] * rng_normal());
+    case D_PARETO:
+        return d->arg[0] / pow(rng_unit(), 1.0 / d->arg[1]);
+    case D_BIMODAL:
+        return -(rng_unit() < d->arg[2] ? d->arg[0] : d->arg[1]) *
+            log(rng_unit());
+    }
+    return 0;
+}
+
+static uint32_t sample_size(const dist_t *d)
+{
+    double s = sample(d);
+
+    return s < 1 ? 1 : s > MAX_SIZE ? MAX_SIZE : (uint32_t)s;
+}
+
+/*
+ * parse_dist - Parse a name:args spec into d; returns -1 if it is
+ *              malformed
+ */
+static int parse_dist(dist_t *d, const char *spec)
+{
+    const char *p;
+    char *end;
+    size_t len;
+    int i, type;
+
+    len = (p = strchr(spec, ':')) != NULL ? (size_t)(p - spec) : strlen(spec);
+    for (type = 0; type < (int)(sizeof(dist_names) / sizeof(*dist_names));
+         type++)
+        if (strlen(dist_names[type].name) == len &&
+            strncmp(dist_names[type].name, spec, len) == 0)
+            break;
+    if (type == sizeof(dist_names) / sizeof(*dist_names))
+        return -1;
+
+    d->type = type;
+    for (i = 0; i < dist_names[type].nargs; i++) {
+        if (p == NULL || *p != ':')
+            return -1;
+        errno = 0;
+        d->arg[i] = strtod(p + 1, &end);
+        if (errno != 0 || end == p + 1 || d->arg[i] < 0)
+            return -1;
+        p = end;
+    }
+    if (p != NULL && *p != '\0')
+        return -1;
+    if ((type == D_UNIFORM && d->arg[1] < d->arg[0]) ||
+        (type == D_PARETO && d->arg[1] == 0) ||
+        (type == D_BIMODAL && d->arg[2] > 1))
+        return -1;
+    return 0;
+}
+
+/*****************
+ * Live blocks
+ *****************/
+
+static void heap_swap(heap_t *h, size_t i, size_t j)
+{
+    block_t t = h->b[i];
+
+    h->b[i] = h->b[j];
+    h->b[j] = t;
+}
+
+static void heap_up(heap_t *h, size_t i)
+{
+    while (i > 0 && h->b[(i - 1) / 2].death > h->b[i].death) {
+        heap_swap(h, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void heap_down(heap_t *h, size_t i)
+{
+    for (;;) {
+        size_t min = i, l = 2 * i + 1, r = 2 * i + 2;
+
+        if (l < h->n && h->b[l].death < h->b[min].death)
+            min = l;
+        if (r < h->n && h->b[r].death < h->b[min].death)
+            min = r;
+        if (min == i)
+            return;
+        heap_swap(h, i, min);
+        i = min;
+    }
+}
+
+static void heap_push(heap_t *h, block_t b)
+{
+    if (h->n == h->cap) {
+        h->cap = h->cap ? 2 * h->cap : 1024;
+        if ((h->b = realloc(h->b, h->cap * sizeof(block_t))) == NULL) {
+            fprintf(stderr, "tracegen: out of memory\n");
+            exit(1);
+        }
+    }
+    h->b[h->n] = b;
+    heap_up(h, h->n++);
+}
+
+static block_t heap_pop(heap_t *h)
+{
+    block_t top = h->b[0];
+
+    h->b[0] = h->b[--h->n];
+    heap_down(h, 0);
+    return top;
+}
+
+/*****************
+ * Generating
+ *****************/
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracegen [-n ops] [-s seed] [-z sizes] "
+            "[-l lifetimes] [-r prob] [-p bytes] <out.rep>\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-n <n>     Generate about n requests (default 100000).\n");
+    fprintf(stderr, "\t-s <seed>  Seed the random numbers (default 1).\n");
+    fprintf(stderr, "\t-z <dist>  Block sizes (default exp:64).\n");
+    fprintf(stderr, "\t-l <dist>  Block lifetimes in requests (default exp:1000).\n");
+    fprintf(stderr, "\t-r <p>     Reallocate with probability p (default 0).\n");
+    fprintf(stderr, "\t-p <n>     Keep at most n bytes live (default no limit).\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+    fprintf(stderr, "Distributions: const:N uniform:LO:HI exp:MEAN "
+            "lognormal:MEDIAN:S\n               pareto:MIN:ALPHA "
+            "bimodal:A:B:P\n");
+}
+
+/*
+ * generate - Write the requests to out and count them.  Blocks are
+ *            freed in the order they die.
+ */
+static void generate(FILE *out, long num_reqs, const dist_t *sizes,
+                     const dist_t *lives, double realloc_prob,
+                     unsigned long long peak, int *num_ids, int *num_ops)
+{
+    heap_t live = { NULL, 0, 0 };
+    unsigned long long live_bytes = 0;
+    uint64_t now = 0;
+    double life;
+    block_t b;
+
+    *num_ids = 0;
+    while ((long)now < num_reqs) {
+        /* Free what has died */
+        if (live.n > 0 && live.b[0].death <= now) {
+            b = heap_pop(&live);
+            live_bytes -= b.size;
+            fprintf(out, "f %d\n", b.id);
+            now++;
+            continue;
+        }
+
+        if (live.n > 0 && rng_unit() < realloc_prob) {
+            size_t i = rng_next() % live.n;
+            uint32_t size = sample_size(sizes);
+            if (peak == 0 || live_bytes - live.b[i].size + size <= peak) {
+                live_bytes = live_bytes - live.b[i].size + size;
+                live.b[i].size = size;
+                fprintf(out, "r %d %u\n", live.b[i].id, size);
+                now++;
+                continue;
+            }
+        }
+
+        b.size = sample_size(sizes);
+        if (peak != 0 && b.size > peak)
+            b.size = (uint32_t)peak;    /* or it alone would break the cap */
+        while (peak != 0 && live.n > 0 && live_bytes + b.size > peak) {
+            block_t old = heap_pop(&live);
+            live_bytes -= old.size;
+            fprintf(out, "f %d\n", old.id);
+            now++;
+        }
+        b.id = (*num_ids)++;
+        life = sample(lives);
+        b.death = now + 1 + (uint64_t)(life < num_reqs ? life : num_reqs);
+        live_bytes += b.size;
+        heap_push(&live, b);
+        fprintf(out, "a %d %u\n", b.id, b.size);
+        now++;
+    }
+
+    while (live.n > 0) {
+        b = heap_pop(&live);
+        fprintf(out, "f %d\n", b.id);
+        now++;
+    }
+    *num_ops = now;
+    free(live.b);
+}
+
+int main(int argc, char **argv)
+{
+    dist_t sizes = { D_EXP, { 64 } }, lives = { D_EXP, { 1000 } };
+    long num_reqs = 100000;
+    double realloc_prob = 0;
+    unsigned long long peak = 0;
+    int c, num_ids, num_ops;
+    char *end;
+    FILE *out;
+
+    rng_state = 1;
+    while ((c = getopt(argc, argv, "n:s:z:l:r:p:h")) != EOF) {
+        switch (c) {
+        case 'n':
+            num_reqs = strtol(optarg, &end, 10);
+            if (*end != '\0' || num_reqs <= 0 || num_reqs > INT32_MAX / 2) {
+                fprintf(stderr, "tracegen: bad request count %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 's':
+            rng_state = strtoull(optarg, NULL, 0);
+            break;
+        case 'z':
+        case 'l':
+            if (parse_dist(c == 'z' ? &sizes : &lives, optarg) < 0) {
+                fprintf(stderr, "tracegen: bad distribution %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'r':
+            realloc_prob = strtod(optarg, &end);
+            if (*end != '\0' || realloc_prob < 0 || realloc_prob > 1) {
+                fprintf(stderr, "tracegen: bad probability %s\n", optarg);
+                exit(1);
+            }
+            break;
+        case 'p':
+            peak = strtoull(optarg, NULL, 0);
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (argc - optind != 1) {
+        usage();
+        exit(1);
+    }
+
+    if ((out = fopen(argv[optind], "w")) == NULL) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        exit(1);
+    }
+    /* The counts are only known at the end, so leave room for them */
+    fprintf(out, "%-12d\n%-12d\n%-12d\n%d\n", 1, 0, 0, 0);
+    generate(out, num_reqs, &sizes, &lives, realloc_prob, peak,
+             &num_ids, &num_ops);
+    rewind(out);
+    fprintf(out, "%-12d\n%-12d\n%-12d\n%d\n", 1, num_ids, num_ops, 0);
+    if (fclose(out) != 0) {
+        fprintf(stderr, "%s: %s\n", argv[optind], strerror(errno));
+        exit(1);
+    }
+    return 0;
+}
@@ -0,0 +1,375 @@
+/*
+ * tracestat.c - describe the workload in malloc lab traces
+ *
+ *   tracestat [-J <file>] <trace>...
+ *
+ * For each trace, loaded by the same code as the driver's (so .rep and
+ * binary traces both work), prints
+ *
+ *   - the request sizes and block lifetimes, as histograms with one
+ *     bucket per power of two and a few percentiles.  A lifetime is the
+ *     number of requests from a block's malloc to its free, reallocs
+ *     of it included; blocks the trace never frees are counted apart.
+ *   - the peak live payload, in bytes and in blocks, and where the
+ *     trace reaches it
+ *   - how much reallocs grow or shrink their blocks, new size over old
+ *   - how the requests fall in mm.c's free lists: the bucket
+ *     find_index() gives the block that serves a malloc or realloc,
+ *     or the block a free gives back (before it is coalesced)
+ *
+ * -J also writes all of it as JSON.  The point is to know what the
+ * traces ask for before tuning BUCKETS, CHUNKSIZE or the size classes.
+ */
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "trace.h"
+#include "hist.h"
+#include "json.h"
+#include "mm.h"
+
+#define POW2_BUCKETS 33     /* up to 1, 2, 4, ... 2^32 */
+#define NUM_RATIOS   8
+
+/* Upper ends of the realloc growth buckets above 1; the last is open */
+static const double grow_limits[NUM_RATIOS - 4] = { 1.25, 1.5, 2, 4 };
+static const char *ratio_names[NUM_RATIOS] = {
+    "<=0.5", "<1", "1", "<=1.25", "<=1.5", "<=2", "<=4", ">4"
+};
+
+static const char *request_names[] = { "malloc", "free", "realloc" };
+
+/* What one trace asks for */
+typedef struct {
+    char filename[TRACE_NAMELEN];
+    int num_ops, num_ids;
+    int count[3];                      /* requests by type */
+
+    hist_t sizes, lifetimes;           /* for the percentiles */
+    uint64_t size_pow2[POW2_BUCKETS];  /* and by power of two */
+    uint64_t life_pow2[POW2_BUCKETS];
+    int unfreed;                       /* blocks left at the end */
+
+    uint64_t peak_bytes;               /* live payload at its peak, */
+    int peak_blocks, peak_op;          /* blocks then, and where */
+    int max_blocks;                    /* most live blocks at any point */
+
+    int ratios[NUM_RATIOS];            /* realloc new size / old */
+    int buckets[MM_STAT_BUCKETS][3];   /* requests by free list and type */
+} tracestat_t;
+
+/*
+ * pow2_bucket - k for values in (2^(k-1), 2^k], as find_index() does it
+ */
+static int pow2_bucket(uint64_t value)
+{
+    int k = 0;
+
+    while (k < POW2_BUCKETS - 1 && value > (1ULL << k))
+        k++;
+    return k;
+}
+
+/* ratio_bucket - Which of ratio_names a realloc's new/old size is */
+static int ratio_bucket(double ratio)
+{
+    int k;
+
+    if (ratio <= 0.5)
+        return 0;
+    if (ratio < 1)
+        return 1;
+    if (ratio == 1)
+        return 2;
+    for (k = 0; k < NUM_RATIOS - 4; k++)
+        if (ratio <= grow_limits[k])
+            return 3 + k;
+    return NUM_RATIOS - 1;
+}
+
+/*
+ * analyze - Replay the requests of trace without an allocator, keeping
+ *     only the size and birth of each live block
+ */
+static void analyze(tracestat_t *st, const trace_t *trace)
+{
+    uint32_t *size;
+    int *birth, i, id, live_blocks = 0;
+    uint64_t live_bytes = 0, life;
+    const traceop_t *op;
+
+    memset(st, 0, sizeof(*st));
+    strcpy(st->filename, trace->filename);
+    st->num_ops = trace->num_ops;
+    st->num_ids = trace->num_ids;
+    hist_clear(&st->sizes);
+    hist_clear(&st->lifetimes);
+
+    size = calloc(trace->num_ids, sizeof(*size));
+    birth = malloc(trace->num_ids * sizeof(*birth));
+    if (trace->num_ids > 0 && (size == NULL || birth == NULL)) {
+        fprintf(stderr, "tracestat: out of memory\n");
+        exit(1);
+    }
+    for (i = 0; i < trace->num_ids; i++)
+        birth[i] = -1;
+
+    for (i = 0; i < trace->num_ops; i++) {
+        op = &trace->ops[i];
+        id = op->index;                 /* trace_load checked it */
+        st->count[op->type]++;
+
+        /* realloc(p, 0) frees p, as it does when the trace is replayed */
+        if (op->type == FREE || (op->type == REALLOC && op->size == 0)) {
+            if (id < 0 || birth[id] < 0)
+                continue;               /* free(NULL), realloc(NULL, 0) */
+            life = i - birth[id];
+            hist_add(&st->lifetimes, life);
+            st->life_pow2[pow2_bucket(life)]++;
+            st->buckets[mm_size_class(size[id])][FREE]++;
+            live_bytes -= size[id];
+            live_blocks--;
+            birth[id] = -1;
+            continue;
+        }
+
+        hist_add(&st->sizes, op->size);
+        st->size_pow2[pow2_bucket(op->size)]++;
+        st->buckets[mm_size_class(op->size)][op->type]++;
+        if (op->type == REALLOC && birth[id] >= 0) {
+            if (size[id] > 0)
+                st->ratios[ratio_bucket((double)op->size / size[id])]++;
+            live_bytes -= size[id];
+        } else {
+            birth[id] = i;
+            live_blocks++;
+        }
+        size[id] = op->size;
+        live_bytes += op->size;
+
+        if (live_bytes > st->peak_bytes) {
+            st->peak_bytes = live_bytes;
+            st->peak_blocks = live_blocks;
+            st->peak_op = i;
+        }
+        if (live_blocks > st->max_blocks)
+            st->max_blocks = live_blocks;
+    }
+
+    for (i = 0; i < trace->num_ids; i++)
+        if (birth[i] >= 0)
+            st->unfreed++;
+    free(size);
+    free(birth);
+}
+
+/*****************
+ * Text output
+ *****************/
+
+static double percent(uint64_t n, uint64_t total)
+{
+    return total > 0 ? 100.0 * n / total : 0;
+}
+
+static void print_percentiles(const char *name, const hist_t *h)
+{
+    printf("  %-10s p50 %llu  p90 %llu  p99 %llu  max %llu\n", name,
+           (unsigned long long)hist_quantile(h, 0.5),
+           (unsigned long long)hist_quantile(h, 0.9),
+           (unsigned long long)hist_quantile(h, 0.99),
+           (unsigned long long)h->max);
+}
+
+static void print_text(const tracestat_t *st)
+{
+    int k, t, lo = POW2_BUCKETS, hi = -1, total = st->num_ops;
+
+    printf("%s: %d requests (%d malloc, %d free, %d realloc), %d blocks\n",
+           st->filename, st->num_ops, st->count[ALLOC], st->count[FREE],
+           st->count[REALLOC], st->num_ids);
+    printf("  peak live  %llu bytes in %d blocks, at request %d; "
+           "at most %d blocks\n", (unsigned long long)st->peak_bytes,
+           st->peak_blocks, st->peak_op, st->max_blocks);
+    print_percentiles("size", &st->sizes);
+    print_percentiles("lifetime", &st->lifetimes);
+    if (st->unfreed > 0)
+        printf("  %d blocks never freed\n", st->unfreed);
+
+    for (k = 0; k < POW2_BUCKETS; k++)
+        if (st->size_pow2[k] || st->life_pow2[k]) {
+            if (k < lo)
+                lo = k;
+            hi = k;
+        }
+    if (hi >= 0)
+        printf("\n  %10s %9s %6s %11s %6s\n",
+               "up to", "sizes", "", "lifetimes", "");
+    for (k = lo; k <= hi; k++)
+        printf("  %10llu %9llu %5.1f%% %11llu %5.1f%%\n", 1ULL << k,
+               (unsigned long long)st->size_pow2[k],
+               percent(st->size_pow2[k], st->sizes.count),
+               (unsigned long long)st->life_pow2[k],
+               percent(st->life_pow2[k], st->lifetimes.count));
+
+    if (st->count[REALLOC] > 0) {
+        printf("\n  realloc new/old size:");
+        for (k = 0; k < NUM_RATIOS; k++)
+            printf(" %s %d", ratio_names[k], st->ratios[k]);
+        printf("\n");
+    }
+
+    printf("\n  %6s %10s %9s %9s %9s %6s\n", "bucket", "up to",
+           "malloc", "free", "realloc", "ops");
+    for (k = 0; k < MM_STAT_BUCKETS; k++) {
+        char limit[16];
+        int n = 0;
+
+        for (t = ALLOC; t <= REALLOC; t++)
+            n += st->buckets[k][t];
+        if (n == 0)
+            continue;
+        if (k < MM_STAT_BUCKETS - 1)
+            sprintf(limit, "%d", 1 << k);
+        else
+            strcpy(limit, "any");
+        printf("  %6d %10s %9d %9d %9d %5.1f%%\n", k, limit,
+               st->buckets[k][ALLOC], st->buckets[k][FREE],
+               st->buckets[k][REALLOC], percent(n, total));
+    }
+    printf("\n");
+}
+
+/*****************
+ * JSON output
+ *****************/
+
+/* json_pow2 - A histogram as [[up to, count], ...], its nonzero buckets */
+static void json_pow2(FILE *f, const uint64_t *counts)
+{
+    int k, first = 1;
+
+    fprintf(f, "[");
+    for (k = 0; k < POW2_BUCKETS; k++)
+        if (counts[k]) {
+            fprintf(f, "%s[%llu, %llu]", first ? "" : ", ", 1ULL << k,
+                    (unsigned long long)counts[k]);
+            first = 0;
+        }
+    fprintf(f, "]");
+}
+
+static void json_percentiles(FILE *f, const hist_t *h)
+{
+    fprintf(f, "{\"count\": %llu, \"p50\": %llu, \"p90\": %llu, "
+            "\"p99\": %llu, \"max\": %llu}",
+            (unsigned long long)h->count,
+            (unsigned long long)hist_quantile(h, 0.5),
+            (unsigned long long)hist_quantile(h, 0.9),
+            (unsigned long long)hist_quantile(h, 0.99),
+            (unsigned long long)h->max);
+}
+
+static void json_trace(FILE *f, const tracestat_t *st)
+{
+    int k, t;
+
+    fprintf(f, "  {\"trace\": ");
+    json_string(f, st->filename);
+    fprintf(f, ", \"ops\": %d, \"ids\": %d", st->num_ops, st->num_ids);
+    for (t = ALLOC; t <= REALLOC; t++)
+        fprintf(f, ", \"%s\": %d", request_names[t], st->count[t]);
+    fprintf(f, ",\n   \"peak_bytes\": %llu, \"peak_blocks\": %d, "
+            "\"peak_op\": %d, \"max_blocks\": %d, \"unfreed\": %d",
+            (unsigned long long)st->peak_bytes, st->peak_blocks,
+            st->peak_op, st->max_blocks, st->unfreed);
+    fprintf(f, ",\n   \"sizes\": ");
+    json_percentiles(f, &st->sizes);
+    fprintf(f, ",\n   \"size_histogram\": ");
+    json_pow2(f, st->size_pow2);
+    fprintf(f, ",\n   \"lifetimes\": ");
+    json_percentiles(f, &st->lifetimes);
+    fprintf(f, ",\n   \"lifetime_histogram\": ");
+    json_pow2(f, st->life_pow2);
+    fprintf(f, ",\n   \"realloc_ratios\": {");
+    for (k = 0; k < NUM_RATIOS; k++)
+        fprintf(f, "%s\"%s\": %d", k ? ", " : "", ratio_names[k],
+                st->ratios[k]);
+    fprintf(f, "},\n   \"buckets\": [");
+    for (k = 0; k < MM_STAT_BUCKETS; k++)
+        fprintf(f, "%s{\"malloc\": %d, \"free\": %d, \"realloc\": %d}",
+                k ? ",\n               " : "", st->buckets[k][ALLOC],
+                st->buckets[k][FREE], st->buckets[k][REALLOC]);
+    fprintf(f, "]}");
+}
+
+static void usage(void)
+{
+    fprintf(stderr, "Usage: tracestat [-J <file>] <trace>...\n");
+    fprintf(stderr, "Options\n");
+    fprintf(stderr, "\t-J <file>  Also write the results to file as JSON.\n");
+    fprintf(stderr, "\t-h         Print this message.\n");
+}
+
+int main(int argc, char **argv)
+{
+    const char *json = NULL;
+    tracestat_t *st;
+    trace_t trace;
+    FILE *f = NULL;
+    int c, i;
+
+    while ((c = getopt(argc, argv, "J:h")) != EOF) {
+        switch (c) {
+        case 'J':
+            json = optarg;
+            break;
+        case 'h':
+            usage();
+            exit(0);
+        default:
+            usage();
+            exit(1);
+        }
+    }
+    if (optind == argc) {
+        usage();
+        exit(1);
+    }
+
+    if (json != NULL) {
+        if ((f = fopen(json, "w")) == NULL) {
+            fprintf(stderr, "%s: %s\n", json, strerror(errno));
+            exit(1);
+        }
+        fprintf(f, "[\n");
+    }
+    if ((st = malloc(sizeof(*st))) == NULL) {
+        fprintf(stderr, "tracestat: out of memory\n");
+        exit(1);
+    }
+    for (i = optind; i < argc; i++) {
+        trace_load(&trace, argv[i]);
+        analyze(st, &trace);
+        trace_unload(&trace);
+        print_text(st);
+        if (f != NULL) {
+            json_trace(f, st);
+            fprintf(f, i < argc - 1 ? ",\n" : "\n");
+        }
+    }
+    free(st);
+
+    if (f != NULL) {
+        fprintf(f, "]\n");
+        if (fclose(f) != 0) {
+            fprintf(stderr, "%s: %s\n", json, strerror(errno));
+            exit(1);
+        }
+    }
+    return 0;
+}